@@ -10,6 +10,7 @@ int WhichTransfer;
 
 int SphereMode;
 int *Local_nx_table;
+int *Local_ny_table;
 
 FILE *FdTmp, *FdTmpInput;
 
@@ -31,6 +32,12 @@ long long TotNumPart;
 int NumPart;
 
 int *Slab_to_task;
+int *Slab_to_task_y;
+
+double *Kgrid, *Kgrid2;
+#ifdef CORRECT_CIC
+double *CicWindow;
+#endif
 
 int NTaskWithN;
 
@@ -51,25 +58,52 @@ double Nu;
 double Phase;
 // *** Collider Addition (End) ***
 
+#ifdef PNG_BATCH
+char PngTemplates[500];
+int  NumPngTemplates;
+struct png_template PngTemplate[MAXPNGTEMPLATES];
+#endif
+
+#if defined(SEPARABLE_FNL) || defined(PNG_BATCH)
+char PngTerms[200];
+int  NumPngTerms;
+struct png_term PngTerm[MAXPNGTERMS];
+#endif
+
 // *** FAVN/DSJ ***
 int FixedAmplitude;
 int PhaseFlip;
+int PairedOutput;
 // *** FAVN/DSJ ***
 
 char OutputDir[100], FileBase[100];
 int NumFilesWrittenInParallel;
+int NumFilesPerSnapshot;
 
 
 int ThisTask, NTask;
 
 int Local_nx, Local_x_start;
+int Local_ny, Local_y_start;
+int NTaskY;
+int Kspace_n0, Kspace_start0;
+int Kspace_n1, Kspace_start1;
 
 int IdStart;
 
-rfftwnd_mpi_plan Inverse_plan;
-rfftwnd_mpi_plan Forward_plan;
 unsigned int TotalSizePlusAdditional;
-fftw_real *Workspace;
+
+#ifdef USE_FFTW3
+int  FFTWPlannerRigor;
+char FFTWWisdomDir[100];
+#endif
+#ifdef PENCIL
+int  ProcessGridY;
+#endif
+#ifdef HDF5_OUTPUT
+int  HDF5ChunkSize;
+int  HDF5Alignment;
+#endif
 
 
 double UnitTime_in_s, UnitLength_in_cm, UnitMass_in_g, UnitVelocity_in_cm_per_s;
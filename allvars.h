@@ -1,10 +1,109 @@
+#ifdef USE_FFTW3
+#include <stdio.h>
+#include <mpi.h>
+#ifdef SINGLE_PRECISION
+typedef float fftw_real; /* FFTW3 itself is only included by fft.c */
+#else
+typedef double fftw_real; /* FFTW3 itself is only included by fft.c */
+#endif
+typedef struct
+{
+  fftw_real re, im;
+} fftw_complex;
+#else
+#ifdef SINGLE_PRECISION
+#include <srfftw_mpi.h>
+#else
 #include <drfftw_mpi.h>
+#endif
+#endif
+
+/* MPI types of the grid elements */
+#ifdef SINGLE_PRECISION
+#define MPI_FFTW_REAL    MPI_FLOAT
+#define MPI_FFTW_COMPLEX MPI_C_FLOAT_COMPLEX
+#else
+#define MPI_FFTW_REAL    MPI_DOUBLE
+#define MPI_FFTW_COMPLEX MPI_C_DOUBLE_COMPLEX
+#endif
 #include <time.h>
+#ifdef USE_OPENMP
+#include <omp.h>
+#else
+#define omp_get_max_threads() 1
+#define omp_get_thread_num()  0
+#endif
 
 #define  PI          3.14159265358979323846 
 #define  GRAVITY     6.672e-8
 #define  HUBBLE      3.2407789e-18   /* in h/sec */
 
+#define ASSERT_ALLOC(cond)                                                                     \
+  {                                                                                            \
+    if (!cond)                                                                                 \
+    {                                                                                          \
+      printf("failed to allocate %g Mbyte on Task %d\n", bytes / (1024.0 * 1024.0), ThisTask); \
+      printf("bailing out.\n");                                                                \
+      FatalError(1);                                                                           \
+    }                                                                                          \
+  }
+
+/* primordial non-Gaussian template shapes, see png.c */
+enum png_type
+{
+  PNG_LOCAL,
+  PNG_EQUIL,
+  PNG_ORTOG,
+  PNG_ORTOG_LSS,
+  PNG_QSFI,
+  PNG_OSC,
+  PNG_SEPARABLE,
+  PNG_NTYPES
+};
+
+/* template of the single-shape executables, selected by MODE in the Makefile */
+#if defined(LOCAL_FNL)
+#define PNG_MODE PNG_LOCAL
+#elif defined(EQUIL_FNL)
+#define PNG_MODE PNG_EQUIL
+#elif defined(ORTOG_FNL)
+#define PNG_MODE PNG_ORTOG
+#elif defined(ORTOG_LSS_FNL)
+#define PNG_MODE PNG_ORTOG_LSS
+#elif defined(QSFI_FNL)
+#define PNG_MODE PNG_QSFI
+#elif defined(OSC_FNL)
+#define PNG_MODE PNG_OSC
+#elif defined(SEPARABLE_FNL)
+#define PNG_MODE PNG_SEPARABLE
+#endif
+
+#define MAXPNGTEMPLATES 32
+
+/* one term  Coef * k^Out * FT[(k^Leg[0] Phi)(x) (k^Leg[1] Phi)(x)]  of a separable
+   template, powers of k in units of (4 - n_s)/3; see png_separable() */
+struct png_term
+{
+  double Coef;
+  double Leg[2];
+  double Out;
+};
+
+#define MAXPNGTERMS 16
+
+#ifdef PENCIL
+#ifndef USE_FFTW3
+#error "PENCIL needs USE_FFTW3"
+#endif
+#ifdef OUTPUT_DF
+#error "OUTPUT_DF assumes slabs and cannot be used with PENCIL"
+#endif
+#endif
+
+#if defined(ASYNC_OUTPUT) && defined(HDF5_OUTPUT)
+#error "ASYNC_OUTPUT is for the Gadget files, HDF5_OUTPUT writes collectively"
+#endif
+
 double PowerSpec(double kmag);
 double GrowthFactor(double astart, double aend);
 double F_Omega(double a);
@@ -55,6 +154,7 @@ extern clock_t previous_time;
 
 extern int      Nglass;
 extern int      *Local_nx_table;
+extern int      *Local_ny_table;
 extern int      WhichSpectrum;
 extern int      WhichTransfer;
 
@@ -84,6 +184,13 @@ extern int      NTaskWithN;
 
 
 extern int      *Slab_to_task;
+extern int      *Slab_to_task_y;  /* owner of (x,y) is Slab_to_task[x] + Slab_to_task_y[y] */
+
+extern double   *Kgrid;      /* wavenumber of grid index n along any axis, negative from Nmesh/2 on */
+extern double   *Kgrid2;     /* Kgrid[n] * Kgrid[n] */
+#ifdef CORRECT_CIC
+extern double   *CicWindow;  /* CIC window sin(x)/x of grid index n, x = Kgrid[n] Box / (2 Nmesh) */
+#endif
 
 
 extern struct part_data 
@@ -96,6 +203,29 @@ extern struct part_data
   long long ID;
 } *P;
 
+/* the particles of one type on this task, P[first..first+n-1], as they are
+   written: positions shifted by shift (PRODUCEGAS), IDs by idshift, and
+   with WDM thermal speeds if thermal is set; mass and hsml fill the
+   per-particle masses and smoothing lengths of the HDF5 files */
+struct ptype_part
+{
+  int first, n;
+  double shift;
+  long long idshift;
+  int thermal;
+  double mass, hsml;
+};
+
+enum snap_block
+{
+  BLOCK_POS,
+  BLOCK_VEL,
+  BLOCK_ID,
+  BLOCK_U,
+  BLOCK_MASS, /* HDF5_OUTPUT only, like BLOCK_HSML */
+  BLOCK_HSML
+};
+
 
 extern double InitTime;
 extern double Redshift;
@@ -110,28 +240,59 @@ extern double Nu;
 extern double Phase;
 // *** Collider Addition (End) ***
 
+#ifdef PNG_BATCH
+extern char PngTemplates[500];   /* list of <template>:<fnl> pairs from the parameter file */
+extern int  NumPngTemplates;
+extern struct png_template
+{
+  int    Shape;                  /* one of enum png_type */
+  double Fnl;
+} PngTemplate[MAXPNGTEMPLATES];
+#endif
+
+#if defined(SEPARABLE_FNL) || defined(PNG_BATCH)
+extern char PngTerms[200];       /* list of <coef>:<leg1>:<leg2>:<out> terms from the parameter file */
+extern int  NumPngTerms;
+extern struct png_term PngTerm[MAXPNGTERMS];
+#endif
+
 // ******* FAVN/DSJ ******
 extern int FixedAmplitude;
 extern int PhaseFlip;
+extern int PairedOutput;
 // ******* FAVN/DSJ ******
 
 extern char OutputDir[100], FileBase[100];
 extern int  NumFilesWrittenInParallel;
+extern int  NumFilesPerSnapshot;  /* files of a snapshot, each written by one task for a group; 0 for one per task */
 
 
 extern int      ThisTask, NTask;
 
 extern int      Local_nx, Local_x_start;
+extern int      Local_ny, Local_y_start;  /* y range of the local pencil; Nmesh and 0 for slabs */
+extern int      NTaskY;                   /* tasks along y in the process grid, 1 for slabs */
+extern int      Kspace_n0, Kspace_start0;  /* local planes of the k-space grid and their first index */
+extern int      Kspace_n1, Kspace_start1;  /* rows per plane, and the first; x and y swapped if TRANSPOSED_KSPACE */
 
 extern int  IdStart;
 
 extern unsigned int TotalSizePlusAdditional;
-extern rfftwnd_mpi_plan Inverse_plan;
-extern rfftwnd_mpi_plan Forward_plan;
 //extern fftw_real        *Disp;
-extern fftw_real        *Workspace;
 //extern fftw_complex     *Cdata;
 
+#ifdef USE_FFTW3
+extern int  FFTWPlannerRigor;
+extern char FFTWWisdomDir[100];
+#endif
+#ifdef PENCIL
+extern int  ProcessGridY;
+#endif
+#ifdef HDF5_OUTPUT
+extern int  HDF5ChunkSize;  /* particles per chunk of the datasets, 0 for contiguous ones */
+extern int  HDF5Alignment;  /* bytes the datasets are aligned to in the file, 0 for none */
+#endif
+
 
 extern double UnitTime_in_s, UnitLength_in_cm, UnitMass_in_g, UnitVelocity_in_cm_per_s;
 extern double InputSpectrum_UnitLength_in_cm;
@@ -162,3 +323,35 @@ extern int  *coord_i, *coord_j, *coord_k; // FIX THIS
 extern float     *amplitudes, *phases, *phi_lin;
 
 #endif
+
+
+/* One (i,j) column of the local half-complex grid, i and j local, i running
+   over the Kspace_n0 planes and j over the Kspace_n1 rows of each. The loops
+   over k then take k_z and k_z^2 from Kgrid[k] and Kgrid2[k], so the inner
+   loop has no branches; |k|^2 = kxy2 + Kgrid2[k]. */
+struct kcolumn
+{
+  int    coord;    /* index of the k = 0 cell */
+  double kx, ky;
+  double kxy2;     /* kx * kx + ky * ky */
+#ifdef CORRECT_CIC
+  double wxy;      /* CIC window of kx times that of ky */
+#endif
+};
+
+static inline void kspace_column(int i, int j, struct kcolumn *col)
+{
+#ifdef TRANSPOSED_KSPACE
+  int x = j + Kspace_start1, y = i + Kspace_start0;
+#else
+  int x = i + Kspace_start0, y = j + Kspace_start1;
+#endif
+
+  col->coord = (i * Kspace_n1 + j) * (Nmesh / 2 + 1);
+  col->kx = Kgrid[x];
+  col->ky = Kgrid[y];
+  col->kxy2 = Kgrid2[x] + Kgrid2[y];
+#ifdef CORRECT_CIC
+  col->wxy = CicWindow[x] * CicWindow[y];
+#endif
+}
@@ -2,6 +2,10 @@
 #include "allvars.h"
 #include "proto.h"
 
+/* tasks per file beyond which ASYNC_OUTPUT warns about the file image the
+   writing task of the file holds */
+#define ASYNC_TASKS_PER_FILE 8
+
 void checkchoose(void)
 {
 
@@ -11,6 +15,39 @@ void checkchoose(void)
       fprintf(stdout,"\n ERROR: You are running with two input files: power and transfer function \n Please select only one of them\n"); exit(2);
   } 
   
+#ifdef PNG_BATCH
+  if(WhichSpectrum != 0) {
+		fprintf(stdout,"\n PngTemplates requires the transfer function as input\n switch WhichSpectrum to zero in the input parameter file\n"); 
+		exit(2);
+  }
+#endif
+
+#ifdef USE_FFTW3
+  if(FFTWPlannerRigor < 0 || FFTWPlannerRigor > 3) {
+		fprintf(stdout,"\n FFTWPlannerRigor must be 0 (estimate), 1 (measure), 2 (patient) or 3 (exhaustive)\n"); 
+		exit(2);
+  }
+#endif
+
+  if(NumFilesPerSnapshot < 0 || NumFilesPerSnapshot > NTask) {
+		fprintf(stdout,"\n NumFilesPerSnapshot must be 0 (a file per task) or at most the number of tasks, %d\n", NTask); 
+		exit(2);
+  }
+
+#ifdef ASYNC_OUTPUT
+  if(NumFilesPerSnapshot > 0 && NTask > ASYNC_TASKS_PER_FILE * NumFilesPerSnapshot && ThisTask == 0) {
+		fprintf(stdout,"\n WARNING: with ASYNC_OUTPUT the first task of each of the %d files holds the image of the whole file,\n the particles of up to %d tasks; --dry-run gives its size, more files make it smaller\n",
+			NumFilesPerSnapshot, (NTask + NumFilesPerSnapshot - 1) / NumFilesPerSnapshot); 
+  }
+#endif
+
+#ifdef PENCIL
+  if(ProcessGridY < 0) {
+		fprintf(stdout,"\n ProcessGridY must be 0 (automatic) or the number of tasks along y\n"); 
+		exit(2);
+  }
+#endif
+
   if (Fnl != 0.) {
     if(WhichSpectrum != 0) {
 		fprintf(stdout,"\n Fnl != 0. requires the transfer function as input\n switch WhichSpectrum to zero in the input parameter file\n"); 
@@ -0,0 +1,285 @@
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <mpi.h>
+#include "allvars.h"
+#include "proto.h"
+
+/* Pre-flight planner for `--dry-run': sizes the decomposition like
+   initialize_ffts() and walks the allocation schedule of displacement_fields()
+   for the compiled template(s), without allocating a grid or running a
+   transform. The schedule below mirrors main.c and png.c and has to be kept
+   in step with them. Sizes are those of the largest task; the particle load
+   per task is estimated from its share of the mesh. */
+
+static double Grid_bytes;  /* one field grid, TotalSizePlusAdditional reals */
+static double Base_bytes;  /* held throughout: particles, FFT buffers, seed table, k tables */
+static double Order_bytes; /* the readout order of the particles, see cell_order() */
+#ifdef ASYNC_OUTPUT
+static double Image_bytes; /* the file image of a writing task */
+#endif
+static double Pending_bytes; /* the image still being written in the background */
+static double Peak_bytes;
+static char  *Peak_stage;
+static int    Total_ffts;
+
+static void stage(char *name, double grids, int ffts, double extra)
+{
+  double bytes = Base_bytes + grids * Grid_bytes + extra + Pending_bytes;
+
+  if (bytes > Peak_bytes)
+  {
+    Peak_bytes = bytes;
+    Peak_stage = name;
+  }
+  Total_ffts += ffts;
+
+  if (ThisTask == 0)
+    printf("  %-32s %6.1f %6d %12.1f\n", name, grids, ffts, bytes / (1024.0 * 1024.0));
+}
+
+/* lpt_displacements() with `held' grids and `extra' bytes still allocated by
+   the caller on top of the three cdisp grids; za if the ZA displacements are kept */
+static void lpt_stages(double held, double extra, int za)
+{
+#ifdef LOWMEM_2LPT
+  stage("  2LPT source", held + 5, 8, extra);
+  stage("  2LPT displacements", held + 5, 6 + 3 * za, extra + Order_bytes);
+#else
+  stage("  2LPT displacement gradients", held + 9, 7, extra);
+  stage("  2LPT displacements", held + 6, 6, extra + Order_bytes);
+#endif
+}
+
+/* write_particle_data() with `held' grids and `extra' bytes still allocated:
+   with ASYNC_OUTPUT the file image, which stays until the next snapshot
+   waits for it (finish_output()) */
+static void write_stage(double held, double extra)
+{
+#ifdef ASYNC_OUTPUT
+  Pending_bytes = 0;
+  stage("  file image", held, 0, extra + Image_bytes);
+  Pending_bytes = Image_bytes;
+#endif
+}
+
+#ifndef ONLY_GAUSSIAN
+/* grids png_potential() allocates on top of cpot, and its number of FFTs */
+static void template_cost(int type, int *grids, int *ffts)
+{
+  switch (type)
+  {
+  case PNG_LOCAL:
+    *grids = 0;
+    *ffts = 2;
+    break;
+  case PNG_EQUIL:
+  case PNG_ORTOG:
+  case PNG_ORTOG_LSS:
+  case PNG_SEPARABLE:
+    png_separable_cost(type, grids, ffts);
+    break;
+  case PNG_QSFI:
+    *grids = 3;
+    *ffts = 6;
+    break;
+  case PNG_OSC:
+    *grids = 3;
+    *ffts = 8;
+    break;
+  }
+}
+#endif
+
+void dry_run(void)
+{
+  int total_size, max_size, nrows;
+  double npart, workspace, part_bytes, file_bytes, nfiles;
+  long long tot_part;
+#ifndef LATTICE_LOAD
+  int k;
+#endif
+#ifndef ONLY_GAUSSIAN
+  int t, ntemplates, shape, grids, ffts, keep;
+  char name[100];
+#endif
+
+  workspace = fft_sizes(&total_size);
+
+  TotalSizePlusAdditional = total_size + (Local_nx + Local_ny + 1) * (2 * (Nmesh / 2 + 1));
+
+  /* the largest task sets the pace */
+  MPI_Allreduce(&total_size, &max_size, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &TotalSizePlusAdditional, 1, MPI_UNSIGNED, MPI_MAX, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &workspace, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  nrows = 2 * Local_nx;
+  MPI_Allreduce(MPI_IN_PLACE, &nrows, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
+#ifdef LATTICE_LOAD
+  Nglass = 1; /* one particle per tile, see read_lattice() */
+#else
+  if (ThisTask == 0)
+  {
+    find_files(GlassFile); /* reads the header of the first file */
+    for (k = 0, Nglass = 0; k < 6; k++)
+      Nglass += header.npartTotal[k];
+  }
+  MPI_Bcast(&Nglass, 1, MPI_INT, 0, MPI_COMM_WORLD);
+#endif
+
+  tot_part = (long long)Nglass * GlassTileFac * GlassTileFac * GlassTileFac;
+  npart = (double)tot_part * max_size / (2.0 * Nmesh * Nmesh * (Nmesh / 2 + 1));
+  part_bytes = npart * sizeof(struct part_data);
+  Order_bytes = npart * sizeof(int);
+
+#ifdef COMPACT_OUTPUT
+  /* 16-bit displacements and 8-bit velocity remainders, IDs implicit */
+  file_bytes = 3 * 2 + 3 * 1;
+#else
+  /* Gadget format 1: header, positions, velocities and IDs, each block framed by its size */
+#ifdef NO64BITID
+  file_bytes = 24 + 4;
+#else
+  file_bytes = 24 + 8;
+#endif
+#ifdef HDF5_OUTPUT
+  file_bytes += 4; /* the Masses dataset */
+#endif
+#ifdef PRODUCEGAS
+  file_bytes *= 2;
+#ifdef HDF5_OUTPUT
+  file_bytes += 4; /* SmoothingLength of the gas */
+#endif
+#endif
+#endif
+  file_bytes *= tot_part;
+
+#ifdef ASYNC_OUTPUT
+  /* the first task of a group of NumFilesPerSnapshot holds the whole group's file */
+  Image_bytes = (NumFilesPerSnapshot > 0 ? (NTask + NumFilesPerSnapshot - 1) / NumFilesPerSnapshot : 1) * npart *
+                (file_bytes / tot_part);
+#endif
+
+  Grid_bytes = (double)sizeof(fftw_real) * TotalSizePlusAdditional;
+  Base_bytes = part_bytes + workspace + 2.0 * Nmesh * sizeof(double);
+#ifndef PHILOX_RNG
+  Base_bytes += (double)nrows * Nmesh * sizeof(unsigned int);
+#endif
+  Peak_bytes = 0;
+  Pending_bytes = 0;
+  Total_ffts = 0;
+
+  if (ThisTask == 0)
+  {
+    printf("\nDry run: Nmesh = %d, NTask = %d (%d x %d process grid), %d thread(s) per task\n",
+           Nmesh, NTask, NTask / NTaskY, NTaskY, omp_get_max_threads());
+    printf("  field grid  %10.1f MB per task (largest task)\n", Grid_bytes / (1024.0 * 1024.0));
+    printf("  FFT buffers %10.1f MB per task%s\n", workspace / (1024.0 * 1024.0),
+#if defined(USE_FFTW3) && !defined(PENCIL)
+           " (plus what FFTW3 allocates internally)"
+#else
+           ""
+#endif
+    );
+    printf("  particles   %10.1f MB per task (about %.0f of %lld)\n\n", part_bytes / (1024.0 * 1024.0), npart,
+           tot_part);
+    printf("  %-32s %6s %6s %12s\n", "stage", "grids", "FFTs", "MB per task");
+  }
+
+#ifndef LATTICE_LOAD
+  /* on the first task of a node, which holds the node's copy of the glass */
+  stage("reading the glass", 0, 0, 3.0 * sizeof(float) * Nglass);
+#endif
+
+#ifdef ONLY_GAUSSIAN
+  stage("Gaussian modes", 3, 0, PairedOutput ? 3.0 * sizeof(float) * npart : 0);
+#ifdef TRANSPOSED_KSPACE
+  /* fft_transpose_kspace() stages one grid */
+  stage("  transpose to y slabs", 4, 0, PairedOutput ? 3.0 * sizeof(float) * npart : 0);
+#endif
+  lpt_stages(0, PairedOutput ? 3.0 * sizeof(float) * npart : 0, PairedOutput);
+  write_stage(0, PairedOutput ? 3.0 * sizeof(float) * npart : 0);
+#else
+
+#ifdef PNG_BATCH
+  ntemplates = NumPngTemplates;
+#else
+  ntemplates = 1;
+#endif
+
+  /* the Gaussian potential and the Lagrangian positions are kept for the next template or pair member */
+  keep = (ntemplates > 1 || PairedOutput);
+
+#ifdef TRANSPOSED_KSPACE
+  stage("transpose to y slabs", 2, 0, 0);
+#endif
+  stage("Gaussian potential", 1 + keep, 0, keep * 3.0 * sizeof(float) * npart);
+
+  for (t = 0; t < ntemplates; t++)
+  {
+#ifdef PNG_BATCH
+    shape = PngTemplate[t].Shape;
+#else
+    shape = PNG_MODE;
+#endif
+    template_cost(shape, &grids, &ffts);
+
+    snprintf(name, sizeof(name), "template %s", png_template_name(shape));
+    stage(name, 1 + keep + grids, ffts, keep * 3.0 * sizeof(float) * npart);
+
+    /* png_realization(), the twin potential is held while the first member is done */
+    stage("  potential gradient", keep + PairedOutput + 4, 0, keep * 3.0 * sizeof(float) * npart);
+    lpt_stages(keep + PairedOutput, keep * 3.0 * sizeof(float) * npart, 0);
+    write_stage(keep + PairedOutput, keep * 3.0 * sizeof(float) * npart);
+
+    if (PairedOutput)
+    {
+      stage("  twin potential gradient", keep + 4, 0, keep * 3.0 * sizeof(float) * npart);
+      lpt_stages(keep, keep * 3.0 * sizeof(float) * npart, 0);
+      write_stage(keep, keep * 3.0 * sizeof(float) * npart);
+    }
+  }
+#endif
+
+#ifdef ASYNC_OUTPUT
+  /* the last file is still in flight when the run ends */
+  stage("end of run", 0, 0, 0);
+#endif
+
+
+#ifdef ONLY_GAUSSIAN
+  nfiles = 1 + PairedOutput;
+#else
+  nfiles = ntemplates * (1 + PairedOutput);
+#endif
+
+  if (ThisTask == 0)
+  {
+    printf("\n  peak memory %.1f MB per task, in stage `%s'\n", Peak_bytes / (1024.0 * 1024.0), Peak_stage);
+    printf("  %d FFTs of %d^3\n", Total_ffts, Nmesh);
+#ifdef HDF5_OUTPUT
+    printf("  output: %g snapshot(s) of %.1f MB, in %d HDF5 file(s) each\n", nfiles,
+           file_bytes / (1024.0 * 1024.0), NumFilesPerSnapshot > 0 ? NumFilesPerSnapshot : NumFilesWrittenInParallel);
+#elif defined(COMPACT_OUTPUT)
+    if (NumFilesPerSnapshot > 0)
+      printf("  output: %g snapshot(s) of %.1f MB, in %d compact files each\n", nfiles,
+             file_bytes / (1024.0 * 1024.0), NumFilesPerSnapshot);
+    else
+      printf("  output: %g snapshot(s) of %.1f MB, in up to %d compact files each\n", nfiles,
+             file_bytes / (1024.0 * 1024.0), NTask);
+#else
+    if (NumFilesPerSnapshot > 0)
+      printf("  output: %g snapshot(s) of %.1f MB, in %d files each\n", nfiles,
+             (file_bytes + NumFilesPerSnapshot * (256 + 6 * 4)) / (1024.0 * 1024.0), NumFilesPerSnapshot);
+    else
+      printf("  output: %g snapshot(s) of %.1f MB, in up to %d files each\n", nfiles,
+             (file_bytes + NTask * (256 + 6 * 4)) / (1024.0 * 1024.0), NTask);
+#endif
+#ifdef ASYNC_OUTPUT
+    printf("  the peak counts %.1f MB on each writing task, for the file image written in the background\n",
+           Image_bytes / (1024.0 * 1024.0));
+#endif
+    printf("\n");
+    fflush(stdout);
+  }
+}
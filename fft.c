@@ -0,0 +1,957 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <mpi.h>
+#ifdef USE_FFTW3
+#define fftw_complex fftw3_complex /* allvars.h has its own fftw_complex with .re/.im */
+#include <fftw3-mpi.h>
+#undef fftw_complex
+#ifdef SINGLE_PRECISION
+/* the single-precision library, same interface with the fftwf_ prefix */
+#define fftw3_complex                    fftwf_complex
+#define fftw_plan                        fftwf_plan
+#define fftw_malloc                      fftwf_malloc
+#define fftw_free                        fftwf_free
+#define fftw_init_threads                fftwf_init_threads
+#define fftw_plan_with_nthreads          fftwf_plan_with_nthreads
+#define fftw_cleanup_threads             fftwf_cleanup_threads
+#define fftw_import_wisdom_from_filename fftwf_import_wisdom_from_filename
+#define fftw_export_wisdom_to_filename   fftwf_export_wisdom_to_filename
+#define fftw_plan_many_dft               fftwf_plan_many_dft
+#define fftw_plan_many_dft_r2c           fftwf_plan_many_dft_r2c
+#define fftw_plan_many_dft_c2r           fftwf_plan_many_dft_c2r
+#define fftw_execute                     fftwf_execute
+#define fftw_execute_dft_r2c             fftwf_execute_dft_r2c
+#define fftw_execute_dft_c2r             fftwf_execute_dft_c2r
+#define fftw_destroy_plan                fftwf_destroy_plan
+#define fftw_mpi_init                    fftwf_mpi_init
+#define fftw_mpi_cleanup                 fftwf_mpi_cleanup
+#define fftw_mpi_local_size_3d           fftwf_mpi_local_size_3d
+#define fftw_mpi_local_size_many         fftwf_mpi_local_size_many
+#define fftw_mpi_local_size_3d_transposed   fftwf_mpi_local_size_3d_transposed
+#define fftw_mpi_local_size_many_transposed fftwf_mpi_local_size_many_transposed
+#define fftw_mpi_plan_many_dft_r2c       fftwf_mpi_plan_many_dft_r2c
+#define fftw_mpi_plan_many_dft_c2r       fftwf_mpi_plan_many_dft_c2r
+#define fftw_mpi_plan_dft_r2c_3d         fftwf_mpi_plan_dft_r2c_3d
+#define fftw_mpi_plan_dft_c2r_3d         fftwf_mpi_plan_dft_c2r_3d
+#define fftw_mpi_execute_dft_r2c         fftwf_mpi_execute_dft_r2c
+#define fftw_mpi_execute_dft_c2r         fftwf_mpi_execute_dft_c2r
+#define fftw_mpi_broadcast_wisdom        fftwf_mpi_broadcast_wisdom
+#define fftw_mpi_gather_wisdom           fftwf_mpi_gather_wisdom
+#define WISDOM_NAME "fftw3f_wisdom"
+#else
+#define WISDOM_NAME "fftw3_wisdom"
+#endif
+#endif
+#include "allvars.h"
+#include "proto.h"
+
+/* Thin layer over the MPI FFT library: in-place real transforms of the
+   Nmesh^3 grid, decomposed into blocks of Local_nx planes along x starting at
+   Local_x_start and Local_ny rows along y starting at Local_y_start, and the
+   allocation of the grids they act on. FFTW 2.1.5 is used by default, FFTW3
+   with -DUSE_FFTW3; both give slabs (Local_ny = Nmesh). -DPENCIL splits y as
+   well, with serial FFTW3 transforms and our own transposes. All use the same
+   padded layout and leave the transforms unnormalized. -DSINGLE_PRECISION
+   switches to the single-precision build of either library.
+
+   fft_forward_many() and fft_inverse_many() transform several grids at once,
+   FFT_BATCH of them per call to the library (set with -DFFT_BATCH=n), so that
+   they share the transposes: one all-to-all of n times the size instead of n.
+   The slab transforms want the fields of a batch interleaved, which costs a
+   staging copy of n grids; the pencil transposes pack them straight into
+   their buffers, which are n times larger.
+
+   With -DTRANSPOSED_KSPACE the slab transforms skip their last transpose:
+   the forward transform leaves k-space in slabs along y, [ky][kx][kz], and
+   the inverse takes it back from there. Kspace_n0 and Kspace_start0 are then
+   the local ky planes and each plane has all Nmesh kx rows; without it they
+   are the x planes of the real grid. kspace_column() hides the difference
+   from the k-space loops. */
+
+#ifndef FFT_BATCH
+#define FFT_BATCH 1
+#endif
+
+#if FFT_BATCH < 1
+#error "FFT_BATCH must be at least 1"
+#endif
+
+#if defined(TRANSPOSED_KSPACE) && defined(PENCIL)
+#error "TRANSPOSED_KSPACE is for the slab transforms, PENCIL has its own transposes"
+#endif
+
+#if defined(TRANSPOSED_KSPACE) && defined(OUTPUT_DF)
+#error "OUTPUT_DF writes the modes in x-slab order, it does not go with TRANSPOSED_KSPACE"
+#endif
+
+/* the local part of the k-space grid, from the y slab the transforms leave
+   it in when TRANSPOSED_KSPACE is set */
+static void kspace_layout(int local_ny_after_transpose, int local_y_start_after_transpose)
+{
+#ifdef TRANSPOSED_KSPACE
+  Kspace_n0 = local_ny_after_transpose;
+  Kspace_start0 = local_y_start_after_transpose;
+  Kspace_n1 = Nmesh;
+  Kspace_start1 = 0;
+#else
+  Kspace_n0 = Local_nx;
+  Kspace_start0 = Local_x_start;
+  Kspace_n1 = Local_ny;
+  Kspace_start1 = Local_y_start;
+#endif
+}
+
+#ifndef PENCIL
+/* Interleaves the n reals of each grid in elements of w reals, 1 for real
+   space and 2 for k-space: the libraries keep the fields of a batch together
+   per fftw_real on the real side and per fftw_complex on the complex side */
+static void interleave(fftw_real **data, int nf, fftw_real *buf, int n, int w)
+{
+  int q, f, r;
+
+  #pragma omp parallel for private(f, r)
+  for (q = 0; q < n / w; q++)
+    for (f = 0; f < nf; f++)
+      for (r = 0; r < w; r++)
+        buf[((size_t)q * nf + f) * w + r] = data[f][(size_t)q * w + r];
+}
+
+static void deinterleave(fftw_real **data, int nf, fftw_real *buf, int n, int w)
+{
+  int q, f, r;
+
+  #pragma omp parallel for private(f, r)
+  for (q = 0; q < n / w; q++)
+    for (f = 0; f < nf; f++)
+      for (r = 0; r < w; r++)
+        data[f][(size_t)q * w + r] = buf[((size_t)q * nf + f) * w + r];
+}
+#endif
+
+#ifdef USE_FFTW3
+
+static unsigned int planner_flags(void)
+{
+  switch (FFTWPlannerRigor)
+  {
+  case 0:
+    return FFTW_ESTIMATE;
+  case 1:
+    return FFTW_MEASURE;
+  case 2:
+    return FFTW_PATIENT;
+  case 3:
+  default:
+    return FFTW_EXHAUSTIVE;
+  }
+}
+
+/* FFTW3 uses the OpenMP threads of each task as well */
+static void start_fftw(void)
+{
+#ifdef USE_OPENMP
+  fftw_init_threads();
+  fftw_plan_with_nthreads(omp_get_max_threads());
+#endif
+  fftw_mpi_init();
+}
+
+static void stop_fftw(void)
+{
+  fftw_mpi_cleanup();
+#ifdef USE_OPENMP
+  fftw_cleanup_threads();
+#endif
+}
+
+static void import_wisdom(char *fname)
+{
+  if (ThisTask == 0)
+  {
+    printf("Planning FFTs (%s)...", fname);
+    fflush(stdout);
+    if (!fftw_import_wisdom_from_filename(fname))
+      printf(" no wisdom yet...");
+  }
+  fftw_mpi_broadcast_wisdom(MPI_COMM_WORLD);
+}
+
+static void export_wisdom(char *fname)
+{
+  fftw_mpi_gather_wisdom(MPI_COMM_WORLD);
+  if (ThisTask == 0)
+  {
+    if (!fftw_export_wisdom_to_filename(fname))
+      printf(" could not write wisdom...");
+    print_timed_done(24);
+  }
+}
+
+#ifdef PENCIL
+
+/* Pencil decomposition: the tasks form a Px x Py grid (Py = NTaskY, task =
+   px * Py + py), and each holds the x-range px and the y-range py of the
+   grid with all of z, in real as well as in k-space. The z transform is
+   local; for the y (x) transform the row (column) of tasks sharing px (py)
+   swaps the data so that each holds full lines along y (x) for a share of
+   the remaining modes, and swaps it back afterwards. */
+
+static int Px, Ncz, Lkz, Lm;
+static int *Nx_count, *Nx_start, *Ny_count, *Ny_start;
+static int *Kz_count, *Kz_start, *M_count, *M_start;
+static int *Sendcounts, *Sdispls, *Recvcounts, *Rdispls;
+static MPI_Comm Row_comm, Col_comm;
+static MPI_Datatype Complex_type;
+static fftw3_complex *Buf_a, *Buf_b;
+static fftw_plan R2c_plan, C2r_plan;
+/* the line transforms of a batch of nf fields are plan[nf] */
+static fftw_plan Y_forward_plan[FFT_BATCH + 1], Y_inverse_plan[FFT_BATCH + 1];
+static fftw_plan X_forward_plan[FFT_BATCH + 1], X_inverse_plan[FFT_BATCH + 1];
+
+/* n items over nparts tasks, the first n % nparts get one more */
+static void split_range(int n, int nparts, int *count, int *start)
+{
+  int p;
+
+  for (p = 0; p < nparts; p++)
+  {
+    count[p] = n / nparts + (p < n % nparts);
+    start[p] = (p == 0) ? 0 : start[p - 1] + count[p - 1];
+  }
+}
+
+/* as square a grid as the mesh allows */
+static int choose_process_grid(void)
+{
+  int py, best = 0;
+
+  for (py = 1; py <= NTask; py++)
+    if (NTask % py == 0 && py <= Nmesh / 2 + 1 && NTask / py <= Nmesh)
+      if (best == 0 || abs(NTask / py - py) < abs(NTask / best - best))
+        best = py;
+
+  return best;
+}
+
+/* Sets up the process grid and the local ranges, and returns the size in
+   complex elements of each of the two transpose buffers, for one field */
+static size_t decompose(int *local_size)
+{
+  size_t nbuf;
+  int px, py, nmax;
+
+  Ncz = Nmesh / 2 + 1;
+  NTaskY = ProcessGridY ? ProcessGridY : choose_process_grid();
+
+  if (NTaskY < 1 || NTask % NTaskY != 0 || NTaskY > Ncz || NTask / NTaskY > Nmesh)
+  {
+    if (ThisTask == 0)
+      printf("cannot arrange %d tasks in a pencil grid with ProcessGridY=%d for Nmesh=%d\n"
+             "(ProcessGridY must divide the number of tasks, be at most Nmesh/2+1, and leave at most Nmesh tasks along x)\n",
+             NTask, ProcessGridY, Nmesh);
+    FatalError(141);
+  }
+
+  Px = NTask / NTaskY;
+  px = ThisTask / NTaskY;
+  py = ThisTask % NTaskY;
+
+  nmax = (Px > NTaskY) ? Px : NTaskY;
+  Nx_count = malloc(sizeof(int) * Px);
+  Nx_start = malloc(sizeof(int) * Px);
+  Ny_count = malloc(sizeof(int) * NTaskY);
+  Ny_start = malloc(sizeof(int) * NTaskY);
+  Kz_count = malloc(sizeof(int) * NTaskY);
+  Kz_start = malloc(sizeof(int) * NTaskY);
+  M_count = malloc(sizeof(int) * Px);
+  M_start = malloc(sizeof(int) * Px);
+  Sendcounts = malloc(sizeof(int) * nmax);
+  Sdispls = malloc(sizeof(int) * nmax);
+  Recvcounts = malloc(sizeof(int) * nmax);
+  Rdispls = malloc(sizeof(int) * nmax);
+
+  split_range(Nmesh, Px, Nx_count, Nx_start);
+  split_range(Nmesh, NTaskY, Ny_count, Ny_start);
+  Local_nx = Nx_count[px];
+  Local_x_start = Nx_start[px];
+  Local_ny = Ny_count[py];
+  Local_y_start = Ny_start[py];
+  kspace_layout(0, 0);
+
+  /* kz is shared out over the row for the y transform, the (y, kz) columns
+     of the local pencil over the column for the x transform */
+  split_range(Ncz, NTaskY, Kz_count, Kz_start);
+  split_range(Local_ny * Ncz, Px, M_count, M_start);
+  Lkz = Kz_count[py];
+  Lm = M_count[px];
+
+  *local_size = 2 * Local_nx * Local_ny * Ncz;
+
+  nbuf = (size_t)Local_nx * Local_ny * Ncz;
+  if ((size_t)Nmesh * Local_nx * Lkz > nbuf)
+    nbuf = (size_t)Nmesh * Local_nx * Lkz;
+  if ((size_t)Nmesh * Lm > nbuf)
+    nbuf = (size_t)Nmesh * Lm;
+
+  return nbuf;
+}
+
+size_t fft_sizes(int *local_size)
+{
+  return 2 * sizeof(fftw3_complex) * FFT_BATCH * decompose(local_size);
+}
+
+void fft_init(int *local_size)
+{
+  fftw_real *scratch;
+  char fname[300];
+  unsigned int flags;
+  size_t bytes, nbuf;
+  int n, nf, ok;
+
+  start_fftw();
+
+  nbuf = FFT_BATCH * decompose(local_size);
+
+  MPI_Comm_split(MPI_COMM_WORLD, ThisTask / NTaskY, ThisTask % NTaskY, &Row_comm);
+  MPI_Comm_split(MPI_COMM_WORLD, ThisTask % NTaskY, ThisTask / NTaskY, &Col_comm);
+
+  MPI_Type_contiguous(sizeof(fftw3_complex), MPI_BYTE, &Complex_type);
+  MPI_Type_commit(&Complex_type);
+
+  Buf_a = (fftw3_complex *)fft_malloc(bytes = sizeof(fftw3_complex) * nbuf);
+  ASSERT_ALLOC(Buf_a);
+  Buf_b = (fftw3_complex *)fft_malloc(bytes = sizeof(fftw3_complex) * nbuf);
+  ASSERT_ALLOC(Buf_b);
+
+  flags = planner_flags();
+
+  /* wisdom depends on the grid and on the decomposition, hence on NTask and Py */
+  sprintf(fname, "%s/" WISDOM_NAME "_%d_%d_p%d.dat", FFTWWisdomDir, Nmesh, NTask, NTaskY);
+
+  import_wisdom(fname);
+
+  scratch = (fftw_real *)fft_malloc(bytes = sizeof(fftw_real) * (*local_size));
+  ASSERT_ALLOC(scratch);
+
+  n = Nmesh;
+  R2c_plan = fftw_plan_many_dft_r2c(1, &n, Local_nx * Local_ny, scratch, NULL, 1, 2 * Ncz,
+                                    (fftw3_complex *)scratch, NULL, 1, Ncz, flags);
+  C2r_plan = fftw_plan_many_dft_c2r(1, &n, Local_nx * Local_ny, (fftw3_complex *)scratch, NULL, 1, Ncz,
+                                    scratch, NULL, 1, 2 * Ncz, flags);
+  fft_free(scratch);
+
+  /* lines along y (x) for nf * Local_nx * Lkz (Lm) modes, y (x) major */
+  ok = (R2c_plan && C2r_plan);
+  for (nf = 1; nf <= FFT_BATCH; nf++)
+  {
+    Y_forward_plan[nf] = Y_inverse_plan[nf] = X_forward_plan[nf] = X_inverse_plan[nf] = NULL;
+    if (Local_nx * Lkz > 0)
+    {
+      Y_forward_plan[nf] = fftw_plan_many_dft(1, &n, nf * Local_nx * Lkz, Buf_a, NULL, nf * Local_nx * Lkz, 1,
+                                              Buf_a, NULL, nf * Local_nx * Lkz, 1, FFTW_FORWARD, flags);
+      Y_inverse_plan[nf] = fftw_plan_many_dft(1, &n, nf * Local_nx * Lkz, Buf_a, NULL, nf * Local_nx * Lkz, 1,
+                                              Buf_a, NULL, nf * Local_nx * Lkz, 1, FFTW_BACKWARD, flags);
+      ok = ok && Y_forward_plan[nf] && Y_inverse_plan[nf];
+    }
+    if (Lm > 0)
+    {
+      X_forward_plan[nf] = fftw_plan_many_dft(1, &n, nf * Lm, Buf_b, NULL, nf * Lm, 1, Buf_b, NULL, nf * Lm, 1,
+                                              FFTW_FORWARD, flags);
+      X_inverse_plan[nf] = fftw_plan_many_dft(1, &n, nf * Lm, Buf_b, NULL, nf * Lm, 1, Buf_b, NULL, nf * Lm, 1,
+                                              FFTW_BACKWARD, flags);
+      ok = ok && X_forward_plan[nf] && X_inverse_plan[nf];
+    }
+  }
+
+  if (!ok)
+  {
+    printf("FFTW3 could not create the plans on task %d\n", ThisTask);
+    FatalError(140);
+  }
+
+  export_wisdom(fname);
+
+  if (ThisTask == 0)
+  {
+    printf("Pencil decomposition on a %d x %d process grid\n", Px, NTaskY);
+    fflush(stdout);
+  }
+}
+
+void fft_finalize(void)
+{
+  int nf;
+
+  for (nf = FFT_BATCH; nf >= 1; nf--)
+  {
+    if (Lm > 0)
+    {
+      fftw_destroy_plan(X_inverse_plan[nf]);
+      fftw_destroy_plan(X_forward_plan[nf]);
+    }
+    if (Local_nx * Lkz > 0)
+    {
+      fftw_destroy_plan(Y_inverse_plan[nf]);
+      fftw_destroy_plan(Y_forward_plan[nf]);
+    }
+  }
+  fftw_destroy_plan(C2r_plan);
+  fftw_destroy_plan(R2c_plan);
+  fft_free(Buf_b);
+  fft_free(Buf_a);
+  MPI_Type_free(&Complex_type);
+  MPI_Comm_free(&Col_comm);
+  MPI_Comm_free(&Row_comm);
+  free(Rdispls);
+  free(Recvcounts);
+  free(Sdispls);
+  free(Sendcounts);
+  free(M_start);
+  free(M_count);
+  free(Kz_start);
+  free(Kz_count);
+  free(Ny_start);
+  free(Ny_count);
+  free(Nx_start);
+  free(Nx_count);
+  stop_fftw();
+}
+
+/* 1D transforms along y of the local pencils c[f], [Local_nx][Local_ny][Ncz] complex,
+   of nf fields; the fields travel together, interleaved per (x, y) row */
+static void transform_y(fftw_real **c, int nf, fftw_plan plan)
+{
+  int p, i, j, f;
+
+  /* to task p of the row goes its share of kz, [Local_nx][Local_ny][nf][Kz_count[p]] */
+  for (p = 0; p < NTaskY; p++)
+  {
+    Sdispls[p] = (p == 0) ? 0 : Sdispls[p - 1] + Sendcounts[p - 1];
+    Sendcounts[p] = nf * Local_nx * Local_ny * Kz_count[p];
+    Rdispls[p] = nf * Local_nx * Ny_start[p] * Lkz;
+    Recvcounts[p] = nf * Local_nx * Ny_count[p] * Lkz;
+  }
+
+#pragma omp parallel for collapse(2) private(p, f)
+  for (i = 0; i < Local_nx; i++)
+    for (j = 0; j < Local_ny; j++)
+      for (p = 0; p < NTaskY; p++)
+        for (f = 0; f < nf; f++)
+          memcpy(Buf_a[Sdispls[p] + ((i * Local_ny + j) * nf + f) * Kz_count[p]],
+                 (fftw3_complex *)c[f] + (i * Local_ny + j) * Ncz + Kz_start[p], sizeof(fftw3_complex) * Kz_count[p]);
+
+  MPI_Alltoallv(Buf_a, Sendcounts, Sdispls, Complex_type, Buf_b, Recvcounts, Rdispls, Complex_type, Row_comm);
+
+  /* reorder to [Nmesh][Local_nx][nf][Lkz] */
+#pragma omp parallel for private(p, i)
+  for (j = 0; j < Nmesh; j++)
+  {
+    for (p = NTaskY - 1; Ny_start[p] > j; p--)
+      ;
+    for (i = 0; i < Local_nx; i++)
+      memcpy(Buf_a[(j * Local_nx + i) * nf * Lkz], Buf_b[Rdispls[p] + (i * Ny_count[p] + j - Ny_start[p]) * nf * Lkz],
+             sizeof(fftw3_complex) * nf * Lkz);
+  }
+
+  if (plan)
+    fftw_execute(plan);
+
+#pragma omp parallel for private(p, i)
+  for (j = 0; j < Nmesh; j++)
+  {
+    for (p = NTaskY - 1; Ny_start[p] > j; p--)
+      ;
+    for (i = 0; i < Local_nx; i++)
+      memcpy(Buf_b[Rdispls[p] + (i * Ny_count[p] + j - Ny_start[p]) * nf * Lkz], Buf_a[(j * Local_nx + i) * nf * Lkz],
+             sizeof(fftw3_complex) * nf * Lkz);
+  }
+
+  MPI_Alltoallv(Buf_b, Recvcounts, Rdispls, Complex_type, Buf_a, Sendcounts, Sdispls, Complex_type, Row_comm);
+
+#pragma omp parallel for collapse(2) private(p, f)
+  for (i = 0; i < Local_nx; i++)
+    for (j = 0; j < Local_ny; j++)
+      for (p = 0; p < NTaskY; p++)
+        for (f = 0; f < nf; f++)
+          memcpy((fftw3_complex *)c[f] + (i * Local_ny + j) * Ncz + Kz_start[p],
+                 Buf_a[Sdispls[p] + ((i * Local_ny + j) * nf + f) * Kz_count[p]], sizeof(fftw3_complex) * Kz_count[p]);
+}
+
+/* 1D transforms along x; the (y, kz) columns of a plane are contiguous, so
+   what arrives from the column is already x major, [Nmesh][nf][Lm] */
+static void transform_x(fftw_real **c, int nf, fftw_plan plan)
+{
+  int p, i, f;
+
+  for (p = 0; p < Px; p++)
+  {
+    Sdispls[p] = (p == 0) ? 0 : Sdispls[p - 1] + Sendcounts[p - 1];
+    Sendcounts[p] = nf * Local_nx * M_count[p];
+    Rdispls[p] = nf * Nx_start[p] * Lm;
+    Recvcounts[p] = nf * Nx_count[p] * Lm;
+  }
+
+#pragma omp parallel for collapse(2) private(f)
+  for (i = 0; i < Local_nx; i++)
+    for (p = 0; p < Px; p++)
+      for (f = 0; f < nf; f++)
+        memcpy(Buf_a[Sdispls[p] + (i * nf + f) * M_count[p]], (fftw3_complex *)c[f] + i * Local_ny * Ncz + M_start[p],
+               sizeof(fftw3_complex) * M_count[p]);
+
+  MPI_Alltoallv(Buf_a, Sendcounts, Sdispls, Complex_type, Buf_b, Recvcounts, Rdispls, Complex_type, Col_comm);
+
+  if (plan)
+    fftw_execute(plan);
+
+  MPI_Alltoallv(Buf_b, Recvcounts, Rdispls, Complex_type, Buf_a, Sendcounts, Sdispls, Complex_type, Col_comm);
+
+#pragma omp parallel for collapse(2) private(f)
+  for (i = 0; i < Local_nx; i++)
+    for (p = 0; p < Px; p++)
+      for (f = 0; f < nf; f++)
+        memcpy((fftw3_complex *)c[f] + i * Local_ny * Ncz + M_start[p], Buf_a[Sdispls[p] + (i * nf + f) * M_count[p]],
+               sizeof(fftw3_complex) * M_count[p]);
+}
+
+static void forward_batch(fftw_real **data, int nf)
+{
+  int f;
+
+  for (f = 0; f < nf; f++)
+    fftw_execute_dft_r2c(R2c_plan, data[f], (fftw3_complex *)data[f]);
+  transform_y(data, nf, Y_forward_plan[nf]);
+  transform_x(data, nf, X_forward_plan[nf]);
+}
+
+static void inverse_batch(fftw_real **data, int nf)
+{
+  int f;
+
+  transform_x(data, nf, X_inverse_plan[nf]);
+  transform_y(data, nf, Y_inverse_plan[nf]);
+  for (f = 0; f < nf; f++)
+    fftw_execute_dft_c2r(C2r_plan, (fftw3_complex *)data[f], data[f]);
+}
+
+void fft_forward(fftw_real *data)
+{
+  forward_batch(&data, 1);
+}
+
+void fft_inverse(fftw_real *data)
+{
+  inverse_batch(&data, 1);
+}
+
+#else
+
+#ifdef TRANSPOSED_KSPACE
+#define TRANSPOSED_OUT FFTW_MPI_TRANSPOSED_OUT
+#define TRANSPOSED_IN  FFTW_MPI_TRANSPOSED_IN
+#else
+#define TRANSPOSED_OUT 0
+#define TRANSPOSED_IN  0
+#endif
+
+static fftw_plan Forward_plan, Inverse_plan;
+static fftw_plan Forward_many[FFT_BATCH + 1], Inverse_many[FFT_BATCH + 1];
+static fftw_real *Batch;  /* the fields of a batch, interleaved */
+static int Batch_n;       /* reals per field */
+
+/* reals of the staging grid for batches of FFT_BATCH fields */
+static size_t batch_size(int local_size)
+{
+  ptrdiff_t nc[3], local_n0, local_0_start;
+#ifdef TRANSPOSED_KSPACE
+  ptrdiff_t local_n1, local_1_start;
+#endif
+  size_t n;
+
+  if (FFT_BATCH == 1)
+    return 0;
+
+  nc[0] = nc[1] = Nmesh;
+  nc[2] = Nmesh / 2 + 1;
+#ifdef TRANSPOSED_KSPACE
+  n = 2 * fftw_mpi_local_size_many_transposed(3, nc, FFT_BATCH, FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK,
+                                              MPI_COMM_WORLD, &local_n0, &local_0_start, &local_n1, &local_1_start);
+#else
+  n = 2 * fftw_mpi_local_size_many(3, nc, FFT_BATCH, FFTW_MPI_DEFAULT_BLOCK, MPI_COMM_WORLD, &local_n0, &local_0_start);
+#endif
+  if (n < (size_t)FFT_BATCH * local_size)
+    n = (size_t)FFT_BATCH * local_size;
+
+  return n;
+}
+
+static void decompose(int *local_size)
+{
+  ptrdiff_t alloc_local, local_n0, local_0_start, local_n1 = 0, local_1_start = 0;
+
+  /* the complex output has Nmesh/2+1 elements in the last dimension */
+#ifdef TRANSPOSED_KSPACE
+  alloc_local = fftw_mpi_local_size_3d_transposed(Nmesh, Nmesh, Nmesh / 2 + 1, MPI_COMM_WORLD, &local_n0,
+                                                  &local_0_start, &local_n1, &local_1_start);
+#else
+  alloc_local = fftw_mpi_local_size_3d(Nmesh, Nmesh, Nmesh / 2 + 1, MPI_COMM_WORLD, &local_n0, &local_0_start);
+#endif
+
+  Local_nx = local_n0;
+  Local_x_start = local_0_start;
+  Local_ny = Nmesh;
+  Local_y_start = 0;
+  NTaskY = 1;
+  kspace_layout(local_n1, local_1_start);
+  *local_size = 2 * alloc_local;
+}
+
+/* the transposes work in place or in buffers that FFTW allocates and sizes
+   itself, so there is only the staging grid of the batches to add here */
+size_t fft_sizes(int *local_size)
+{
+  start_fftw();
+  decompose(local_size);
+  return sizeof(fftw_real) * batch_size(*local_size);
+}
+
+void fft_init(int *local_size)
+{
+  fftw_real *scratch;
+  char fname[300];
+  unsigned int flags;
+  size_t bytes;
+  ptrdiff_t n[3];
+  int nf;
+
+  start_fftw();
+
+  decompose(local_size);
+
+  flags = planner_flags();
+
+  /* wisdom depends on the grid and on the decomposition, hence on NTask */
+  sprintf(fname, "%s/" WISDOM_NAME "_%d_%d.dat", FFTWWisdomDir, Nmesh, NTask);
+
+  import_wisdom(fname);
+
+  /* the planner may overwrite the array, so plan on a scratch grid. Later
+     grids come from fft_malloc() and thus have the same alignment */
+  scratch = (fftw_real *)fft_malloc(bytes = sizeof(fftw_real) * (*local_size));
+  ASSERT_ALLOC(scratch);
+
+  Forward_plan = fftw_mpi_plan_dft_r2c_3d(Nmesh, Nmesh, Nmesh, scratch, (fftw3_complex *)scratch,
+                                          MPI_COMM_WORLD, flags | TRANSPOSED_OUT);
+  Inverse_plan = fftw_mpi_plan_dft_c2r_3d(Nmesh, Nmesh, Nmesh, (fftw3_complex *)scratch, scratch,
+                                          MPI_COMM_WORLD, flags | TRANSPOSED_IN);
+  fft_free(scratch);
+
+  if (!Forward_plan || !Inverse_plan)
+  {
+    printf("FFTW3 could not create the plans on task %d\n", ThisTask);
+    FatalError(140);
+  }
+
+  /* the batches are planned on their staging grid */
+  Batch = NULL;
+  Batch_n = *local_size;
+  if (FFT_BATCH > 1)
+  {
+    Batch = (fftw_real *)fft_malloc(bytes = sizeof(fftw_real) * batch_size(*local_size));
+    ASSERT_ALLOC(Batch);
+  }
+
+  n[0] = n[1] = n[2] = Nmesh;
+  for (nf = 2; nf <= FFT_BATCH; nf++)
+  {
+    Forward_many[nf] = fftw_mpi_plan_many_dft_r2c(3, n, nf, FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK, Batch,
+                                                  (fftw3_complex *)Batch, MPI_COMM_WORLD, flags | TRANSPOSED_OUT);
+    Inverse_many[nf] = fftw_mpi_plan_many_dft_c2r(3, n, nf, FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK,
+                                                  (fftw3_complex *)Batch, Batch, MPI_COMM_WORLD, flags | TRANSPOSED_IN);
+    if (!Forward_many[nf] || !Inverse_many[nf])
+    {
+      printf("FFTW3 could not create the plans for batches of %d on task %d\n", nf, ThisTask);
+      FatalError(140);
+    }
+  }
+
+  export_wisdom(fname);
+}
+
+void fft_finalize(void)
+{
+  int nf;
+
+  for (nf = FFT_BATCH; nf >= 2; nf--)
+  {
+    fftw_destroy_plan(Inverse_many[nf]);
+    fftw_destroy_plan(Forward_many[nf]);
+  }
+  if (Batch)
+    fft_free(Batch);
+  fftw_destroy_plan(Inverse_plan);
+  fftw_destroy_plan(Forward_plan);
+  stop_fftw();
+}
+
+void fft_forward(fftw_real *data)
+{
+  fftw_mpi_execute_dft_r2c(Forward_plan, data, (fftw3_complex *)data);
+}
+
+void fft_inverse(fftw_real *data)
+{
+  fftw_mpi_execute_dft_c2r(Inverse_plan, (fftw3_complex *)data, data);
+}
+
+static void forward_batch(fftw_real **data, int nf)
+{
+  if (nf == 1)
+  {
+    fft_forward(data[0]);
+    return;
+  }
+  interleave(data, nf, Batch, Batch_n, 1);
+  fftw_mpi_execute_dft_r2c(Forward_many[nf], Batch, (fftw3_complex *)Batch);
+  deinterleave(data, nf, Batch, Batch_n, 2);
+}
+
+static void inverse_batch(fftw_real **data, int nf)
+{
+  if (nf == 1)
+  {
+    fft_inverse(data[0]);
+    return;
+  }
+  interleave(data, nf, Batch, Batch_n, 2);
+  fftw_mpi_execute_dft_c2r(Inverse_many[nf], (fftw3_complex *)Batch, Batch);
+  deinterleave(data, nf, Batch, Batch_n, 1);
+}
+
+#endif
+
+/* SIMD-aligned, as the plans require */
+void *fft_malloc(size_t n)
+{
+  return fftw_malloc(n);
+}
+
+void fft_free(void *p)
+{
+  fftw_free(p);
+}
+
+#else
+
+#ifdef TRANSPOSED_KSPACE
+#define KSPACE_ORDER FFTW_TRANSPOSED_ORDER
+#else
+#define KSPACE_ORDER FFTW_NORMAL_ORDER
+#endif
+
+static rfftwnd_mpi_plan Forward_plan, Inverse_plan;
+static fftw_real *Workspace;
+static fftw_real *Batch;  /* the fields of a batch, interleaved */
+static int Batch_n;       /* reals per field */
+
+/* the local sizes are only known to a plan */
+size_t fft_sizes(int *local_size)
+{
+  rfftwnd_mpi_plan plan;
+  int local_ny_after_transpose, local_y_start_after_transpose;
+
+  plan = rfftw3d_mpi_create_plan(MPI_COMM_WORLD, Nmesh, Nmesh, Nmesh, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE);
+
+  rfftwnd_mpi_local_sizes(plan, &Local_nx, &Local_x_start,
+                          &local_ny_after_transpose, &local_y_start_after_transpose, local_size);
+  Local_ny = Nmesh;
+  Local_y_start = 0;
+  NTaskY = 1;
+  kspace_layout(local_ny_after_transpose, local_y_start_after_transpose);
+
+  rfftwnd_mpi_destroy_plan(plan);
+
+  /* the Workspace, and the staging grid of the batches, for FFT_BATCH fields */
+  return sizeof(fftw_real) * (*local_size) * FFT_BATCH * (FFT_BATCH > 1 ? 2 : 1);
+}
+
+void fft_init(int *local_size)
+{
+  int local_ny_after_transpose, local_y_start_after_transpose;
+  size_t bytes;
+
+  Inverse_plan = rfftw3d_mpi_create_plan(MPI_COMM_WORLD,
+                                         Nmesh, Nmesh, Nmesh, FFTW_COMPLEX_TO_REAL, FFTW_ESTIMATE);
+
+  Forward_plan = rfftw3d_mpi_create_plan(MPI_COMM_WORLD,
+                                         Nmesh, Nmesh, Nmesh, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE);
+
+  rfftwnd_mpi_local_sizes(Forward_plan, &Local_nx, &Local_x_start,
+                          &local_ny_after_transpose, &local_y_start_after_transpose, local_size);
+  Local_ny = Nmesh;
+  Local_y_start = 0;
+  NTaskY = 1;
+  kspace_layout(local_ny_after_transpose, local_y_start_after_transpose);
+
+  Workspace = (fftw_real *)malloc(bytes = sizeof(fftw_real) * (*local_size) * FFT_BATCH);
+
+  ASSERT_ALLOC(Workspace)
+
+  Batch = NULL;
+  Batch_n = *local_size;
+  if (FFT_BATCH > 1)
+  {
+    Batch = (fftw_real *)malloc(bytes = sizeof(fftw_real) * (*local_size) * FFT_BATCH);
+    ASSERT_ALLOC(Batch);
+  }
+}
+
+void fft_finalize(void)
+{
+  free(Batch);
+  free(Workspace);
+  rfftwnd_mpi_destroy_plan(Inverse_plan);
+  rfftwnd_mpi_destroy_plan(Forward_plan);
+}
+
+void fft_forward(fftw_real *data)
+{
+  rfftwnd_mpi(Forward_plan, 1, data, Workspace, KSPACE_ORDER);
+}
+
+void fft_inverse(fftw_real *data)
+{
+  rfftwnd_mpi(Inverse_plan, 1, data, Workspace, KSPACE_ORDER);
+}
+
+static void forward_batch(fftw_real **data, int nf)
+{
+  if (nf == 1)
+  {
+    fft_forward(data[0]);
+    return;
+  }
+  interleave(data, nf, Batch, Batch_n, 1);
+  rfftwnd_mpi(Forward_plan, nf, Batch, Workspace, KSPACE_ORDER);
+  deinterleave(data, nf, Batch, Batch_n, 2);
+}
+
+static void inverse_batch(fftw_real **data, int nf)
+{
+  if (nf == 1)
+  {
+    fft_inverse(data[0]);
+    return;
+  }
+  interleave(data, nf, Batch, Batch_n, 2);
+  rfftwnd_mpi(Inverse_plan, nf, Batch, Workspace, KSPACE_ORDER);
+  deinterleave(data, nf, Batch, Batch_n, 1);
+}
+
+void *fft_malloc(size_t n)
+{
+  return malloc(n);
+}
+
+void fft_free(void *p)
+{
+  free(p);
+}
+
+#endif
+
+/* Transforms the n grids data[0..n-1], FFT_BATCH of them at a time */
+void fft_forward_many(fftw_real **data, int n)
+{
+  int b;
+
+  for (b = 0; b < n; b += FFT_BATCH)
+    forward_batch(data + b, (n - b < FFT_BATCH) ? n - b : FFT_BATCH);
+}
+
+void fft_inverse_many(fftw_real **data, int n)
+{
+  int b;
+
+  for (b = 0; b < n; b += FFT_BATCH)
+    inverse_batch(data + b, (n - b < FFT_BATCH) ? n - b : FFT_BATCH);
+}
+
+#ifdef TRANSPOSED_KSPACE
+/* Takes a k-space grid from the x slabs its modes are drawn in, [kx][ky][kz]
+   with Local_nx planes, to the y slabs the transforms work on, [ky][kx][kz]
+   with Kspace_n0 planes. The rows for each task are packed into a buffer,
+   and one all-to-all drops the incoming rows in place with a datatype per
+   source task */
+void fft_transpose_kspace(fftw_real *data)
+{
+  fftw_complex *c = (fftw_complex *)data;
+  char *buf;
+  int *nx, *x0, *ny, *y0, *sendcounts, *sdispls, *recvcounts, *rdispls;
+  MPI_Datatype *sendtypes, *recvtypes, column;
+  int p, i, j, rowlen, off;
+  size_t bytes;
+
+  rowlen = sizeof(fftw_complex) * (Nmesh / 2 + 1);
+
+  nx = malloc(sizeof(int) * NTask);
+  x0 = malloc(sizeof(int) * NTask);
+  ny = malloc(sizeof(int) * NTask);
+  y0 = malloc(sizeof(int) * NTask);
+  sendcounts = malloc(sizeof(int) * NTask);
+  sdispls = malloc(sizeof(int) * NTask);
+  recvcounts = malloc(sizeof(int) * NTask);
+  rdispls = malloc(sizeof(int) * NTask);
+  sendtypes = malloc(sizeof(MPI_Datatype) * NTask);
+  recvtypes = malloc(sizeof(MPI_Datatype) * NTask);
+
+  MPI_Allgather(&Local_nx, 1, MPI_INT, nx, 1, MPI_INT, MPI_COMM_WORLD);
+  MPI_Allgather(&Local_x_start, 1, MPI_INT, x0, 1, MPI_INT, MPI_COMM_WORLD);
+  MPI_Allgather(&Kspace_n0, 1, MPI_INT, ny, 1, MPI_INT, MPI_COMM_WORLD);
+  MPI_Allgather(&Kspace_start0, 1, MPI_INT, y0, 1, MPI_INT, MPI_COMM_WORLD);
+
+  buf = malloc(bytes = (size_t)rowlen * Local_nx * Nmesh + 1);
+  ASSERT_ALLOC(buf);
+
+  /* to task p go the rows of its ky planes, [kx][ky] */
+  for (p = 0, off = 0; p < NTask; p++)
+  {
+    sendcounts[p] = rowlen * Local_nx * ny[p];
+    sdispls[p] = off;
+    sendtypes[p] = MPI_BYTE;
+
+    for (i = 0; i < Local_nx; i++)
+      for (j = 0; j < ny[p]; j++, off += rowlen)
+        memcpy(buf + off, &c[(i * Nmesh + y0[p] + j) * (Nmesh / 2 + 1)], rowlen);
+  }
+
+  /* from task p come its kx planes for all our ky, each a column of the [ky][kx] planes */
+  MPI_Type_vector(Kspace_n0, rowlen, Nmesh * rowlen, MPI_BYTE, &column);
+  for (p = 0; p < NTask; p++)
+  {
+    MPI_Type_create_hvector(nx[p], 1, rowlen, column, &recvtypes[p]);
+    MPI_Type_commit(&recvtypes[p]);
+    recvcounts[p] = (nx[p] > 0 && Kspace_n0 > 0);
+    rdispls[p] = rowlen * x0[p];
+  }
+  MPI_Type_free(&column);
+
+  MPI_Alltoallw(buf, sendcounts, sdispls, sendtypes, data, recvcounts, rdispls, recvtypes, MPI_COMM_WORLD);
+
+  for (p = 0; p < NTask; p++)
+    MPI_Type_free(&recvtypes[p]);
+
+  free(buf);
+  free(recvtypes);
+  free(sendtypes);
+  free(rdispls);
+  free(recvcounts);
+  free(sdispls);
+  free(sendcounts);
+  free(y0);
+  free(ny);
+  free(x0);
+  free(nx);
+}
+#endif
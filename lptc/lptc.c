@@ -0,0 +1,134 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lptc.h"
+
+void lptc_filename(char *buf, size_t len, const char *base, int file_num, int num_files)
+{
+  if (num_files > 1)
+    snprintf(buf, len, "%s.%d.lptc", base, file_num);
+  else
+    snprintf(buf, len, "%s.lptc", base);
+}
+
+int lptc_open(struct lptc_file *f, const char *fname)
+{
+  int b;
+
+  memset(f, 0, sizeof(struct lptc_file));
+
+  if (!(f->fd = fopen(fname, "r")))
+    return -1;
+
+  if (fread(&f->header, sizeof(struct lptc_header), 1, f->fd) != 1)
+  {
+    lptc_close(f);
+    return -1;
+  }
+
+  if (memcmp(f->header.magic, LPTC_MAGIC, 4) || f->header.version != LPTC_VERSION || f->header.nbricks < 0)
+  {
+    lptc_close(f);
+    return -2;
+  }
+
+  f->brick = malloc((f->header.nbricks + 1) * sizeof(struct lptc_brick));
+  f->brick_first = malloc((f->header.nbricks + 1) * sizeof(int64_t));
+
+  if (!f->brick || !f->brick_first ||
+      fread(f->brick, sizeof(struct lptc_brick), f->header.nbricks, f->fd) != (size_t)f->header.nbricks)
+  {
+    lptc_close(f);
+    return -1;
+  }
+
+  for (b = 0, f->brick_first[0] = 0; b < f->header.nbricks; b++)
+    f->brick_first[b + 1] = f->brick_first[b] + (int64_t)f->brick[b].nx * f->brick[b].ny * f->header.lattice;
+
+  if (f->brick_first[f->header.nbricks] != f->header.npart_file)
+  {
+    lptc_close(f);
+    return -2;
+  }
+
+  f->data = ftell(f->fd);
+
+  return 0;
+}
+
+/* x wrapped into [0, box) */
+static double wrap(double x, double box)
+{
+  x = fmod(x, box);
+  if (x < 0)
+    x += box;
+  if (x >= box)
+    x -= box;
+  return x;
+}
+
+int64_t lptc_read(struct lptc_file *f, int64_t first, int64_t n, float *pos, float *vel, int64_t *id)
+{
+  struct lptc_header *h = &f->header;
+  int16_t *disp;
+  int8_t *vres;
+  int64_t m, idx, ijk[3];
+  int b, k;
+
+  if (first < 0 || first > h->npart_file)
+    return -1;
+  if (n > h->npart_file - first)
+    n = h->npart_file - first;
+  if (n <= 0)
+    return 0;
+
+  disp = malloc(3 * n * sizeof(int16_t));
+  vres = malloc(3 * n * sizeof(int8_t));
+
+  if (!disp || !vres || fseek(f->fd, f->data + first * 3 * sizeof(int16_t), SEEK_SET) ||
+      fread(disp, 3 * sizeof(int16_t), n, f->fd) != (size_t)n ||
+      fseek(f->fd, f->data + h->npart_file * 3 * sizeof(int16_t) + first * 3 * sizeof(int8_t), SEEK_SET) ||
+      fread(vres, 3 * sizeof(int8_t), n, f->fd) != (size_t)n)
+  {
+    free(vres);
+    free(disp);
+    return -1;
+  }
+
+  for (m = 0, b = 0; m < n; m++)
+  {
+    while (first + m >= f->brick_first[b + 1])
+      b++;
+
+    idx = first + m - f->brick_first[b];
+    ijk[0] = f->brick[b].x0 + idx / ((int64_t)f->brick[b].ny * h->lattice);
+    ijk[1] = f->brick[b].y0 + idx / h->lattice % f->brick[b].ny;
+    ijk[2] = idx % h->lattice;
+
+    for (k = 0; k < 3; k++)
+    {
+      if (pos)
+        pos[3 * m + k] = wrap(h->origin[k] + h->spacing * ijk[k] + h->disp_step * disp[3 * m + k], h->BoxSize);
+      if (vel)
+        vel[3 * m + k] = h->vel_fac * h->disp_step * disp[3 * m + k] + h->vel_step * vres[3 * m + k];
+    }
+
+    if (id)
+      id[m] = (ijk[0] * h->lattice + ijk[1]) * h->lattice + ijk[2] + 1;
+  }
+
+  free(vres);
+  free(disp);
+
+  return n;
+}
+
+void lptc_close(struct lptc_file *f)
+{
+  if (f->fd)
+    fclose(f->fd);
+  free(f->brick);
+  free(f->brick_first);
+  memset(f, 0, sizeof(struct lptc_file));
+}
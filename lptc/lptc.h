@@ -0,0 +1,87 @@
+#ifndef LPTC_H
+#define LPTC_H
+
+/* Compact initial conditions of a lattice particle load (COMPACT_OUTPUT):
+   every particle is the lattice point it started from plus its displacement,
+   and its ID is its lattice index. A file holds
+
+     struct lptc_header                     (256 bytes)
+     struct lptc_brick[nbricks]             the lattice blocks in the file
+     int16_t  disp[npart_file][3]           displacement / disp_step
+     int8_t   vres[npart_file][3]           (velocity - vel_fac * displacement) / vel_step
+
+   The particles of a brick are in lattice order, z fastest: the n-th one
+   of brick b is the lattice point (i, j, k) with i = x0 + n / (ny * lattice),
+   j = y0 + n / lattice % ny, k = n % lattice, and has the ID
+   (i * lattice + j) * lattice + k + 1. Its position is origin + spacing *
+   (i, j, k) + disp_step * disp, wrapped into the box, to within
+   disp_step / 2; the velocity is vel_fac * disp_step * disp + vel_step *
+   vres, to within vel_step / 2. vel_fac is the Zel'dovich ratio of
+   velocity to displacement, so vres only holds the second-order (and
+   rounding) remainder, small enough for 8 bits.
+
+   Integers and doubles are in the byte order of the machine that wrote
+   the file, as in the Gadget format. */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define LPTC_MAGIC "LPTC"
+#define LPTC_VERSION 1
+
+struct lptc_header
+{
+  char magic[4];       /* LPTC_MAGIC */
+  int32_t version;     /* LPTC_VERSION */
+  int32_t num_files;   /* files of the snapshot, NumFilesPerSnapshot or one per task with particles */
+  int32_t file_num;    /* this one */
+  int32_t nbricks;     /* lattice blocks in this file */
+  int32_t lattice;     /* particles per side of the whole lattice */
+  int64_t npart_file;  /* particles in this file */
+  int64_t npart_total; /* in the snapshot, lattice^3 */
+  double mass;         /* particle mass */
+  double time;         /* scale factor */
+  double redshift;
+  double BoxSize;
+  double Omega0;
+  double OmegaLambda;
+  double HubbleParam;
+  double origin[3];    /* position of lattice point (0, 0, 0) */
+  double spacing;      /* between lattice points */
+  double disp_step;    /* quantization step of the displacements */
+  double vel_fac;      /* velocity predicted from the displacement */
+  double vel_step;     /* quantization step of the velocity remainder */
+  char fill[104];      /* to 256 bytes */
+};
+
+/* lattice points x0 <= i < x0 + nx, y0 <= j < y0 + ny, 0 <= k < lattice */
+struct lptc_brick
+{
+  int32_t x0, nx, y0, ny;
+};
+
+struct lptc_file
+{
+  FILE *fd;
+  struct lptc_header header;
+  struct lptc_brick *brick;
+  int64_t *brick_first; /* index in the file of the first particle of each brick */
+  long data;            /* offset of the displacements */
+};
+
+/* Opens a file and reads its header and brick table: 0 on success, -1 if
+   the file cannot be read, -2 if it is not a compact IC file of this
+   version. */
+int lptc_open(struct lptc_file *f, const char *fname);
+
+/* Reads particles first..first+n-1 of the file into pos[3 * n], vel[3 * n]
+   and id[n] (any of them may be NULL): the number read, -1 on error. */
+int64_t lptc_read(struct lptc_file *f, int64_t first, int64_t n, float *pos, float *vel, int64_t *id);
+
+void lptc_close(struct lptc_file *f);
+
+/* The name of file file_num of the snapshot base: <base>.<file_num>.lptc,
+   or <base>.lptc for a snapshot in one file. */
+void lptc_filename(char *buf, size_t len, const char *base, int file_num, int num_files);
+
+#endif
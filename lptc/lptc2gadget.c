@@ -0,0 +1,169 @@
+/* Converts compact initial conditions (COMPACT_OUTPUT) to the Gadget format
+   the code writes otherwise, file by file:
+
+     lptc2gadget <input base> <output base>
+
+   reads <input base>.<n>.lptc (or <input base>.lptc) and writes
+   <output base>.<n> (or <output base>). IDs are 64-bit, or 32-bit if built
+   with -DNO64BITID. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lptc.h"
+
+#define CHUNK (1 << 20)
+
+/* the Gadget format-1 header, as in allvars.h */
+struct gadget_header
+{
+  uint32_t npart[6];
+  double mass[6];
+  double time;
+  double redshift;
+  int32_t flag_sfr;
+  int32_t flag_feedback;
+  uint32_t npartTotal[6];
+  int32_t flag_cooling;
+  int32_t num_files;
+  double BoxSize;
+  double Omega0;
+  double OmegaLambda;
+  double HubbleParam;
+  int32_t flag_stellarage;
+  int32_t flag_metals;
+  int32_t hashtabsize;
+  char fill[84];
+};
+
+#ifdef NO64BITID
+typedef uint32_t gadget_id;
+#else
+typedef uint64_t gadget_id;
+#endif
+
+static void fail(const char *msg, const char *fname)
+{
+  fprintf(stderr, "%s '%s'\n", msg, fname);
+  exit(1);
+}
+
+static void write_framed(FILE *fd, const void *data, size_t size, const char *fname)
+{
+  if (fwrite(data, 1, size, fd) != size)
+    fail("I/O error writing", fname);
+}
+
+/* one block of the Gadget file: 0 positions, 1 velocities, 2 IDs */
+static void convert_block(struct lptc_file *f, FILE *out, int block, const char *in_name, const char *out_name)
+{
+  static float buf[3 * CHUNK];
+  static int64_t id[CHUNK];
+  static gadget_id gid[CHUNK];
+  int64_t first, n, i;
+  int32_t dummy;
+
+  dummy = f->header.npart_file * (block < 2 ? 3 * sizeof(float) : sizeof(gadget_id));
+  write_framed(out, &dummy, sizeof(dummy), out_name);
+
+  for (first = 0; first < f->header.npart_file; first += n)
+  {
+    if ((n = lptc_read(f, first, CHUNK, block == 0 ? buf : NULL, block == 1 ? buf : NULL, block == 2 ? id : NULL)) <= 0)
+      fail("I/O error reading", in_name);
+
+    if (block < 2)
+      write_framed(out, buf, 3 * n * sizeof(float), out_name);
+    else
+    {
+      for (i = 0; i < n; i++)
+        gid[i] = id[i];
+      write_framed(out, gid, n * sizeof(gadget_id), out_name);
+    }
+  }
+
+  write_framed(out, &dummy, sizeof(dummy), out_name);
+}
+
+static void open_file(struct lptc_file *f, const char *fname)
+{
+  switch (lptc_open(f, fname))
+  {
+  case -1:
+    fail("can't read file", fname);
+  case -2:
+    fail("not a compact IC file of this version:", fname);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  struct lptc_file f;
+  struct gadget_header header;
+  char in_name[1000], out_name[1000];
+  int file_num, num_files, block;
+  int32_t dummy;
+  FILE *out;
+
+  if (argc != 3)
+  {
+    fprintf(stderr, "usage: %s <input base> <output base>\n", argv[0]);
+    return 1;
+  }
+
+  /* the first file tells how many there are */
+  lptc_filename(in_name, sizeof(in_name), argv[1], 0, 1);
+  if (lptc_open(&f, in_name) == -1) /* not a snapshot in one file */
+    lptc_filename(in_name, sizeof(in_name), argv[1], 0, 2);
+  else
+    lptc_close(&f);
+  open_file(&f, in_name);
+
+  num_files = f.header.num_files;
+
+  for (file_num = 0; file_num < num_files; file_num++)
+  {
+    if (file_num > 0)
+    {
+      lptc_filename(in_name, sizeof(in_name), argv[1], file_num, num_files);
+      open_file(&f, in_name);
+    }
+
+    if (num_files > 1)
+      snprintf(out_name, sizeof(out_name), "%s.%d", argv[2], file_num);
+    else
+      snprintf(out_name, sizeof(out_name), "%s", argv[2]);
+
+    if (!(out = fopen(out_name, "w")))
+      fail("can't write file", out_name);
+
+    memset(&header, 0, sizeof(header));
+    header.npart[1] = f.header.npart_file;
+    header.mass[1] = f.header.mass;
+    header.time = f.header.time;
+    header.redshift = f.header.redshift;
+    header.npartTotal[1] = f.header.npart_total;
+    header.npartTotal[2] = f.header.npart_total >> 32; /* as save.c has it */
+    header.num_files = num_files;
+    header.BoxSize = f.header.BoxSize;
+    header.Omega0 = f.header.Omega0;
+    header.OmegaLambda = f.header.OmegaLambda;
+    header.HubbleParam = f.header.HubbleParam;
+
+    dummy = sizeof(header);
+    write_framed(out, &dummy, sizeof(dummy), out_name);
+    write_framed(out, &header, sizeof(header), out_name);
+    write_framed(out, &dummy, sizeof(dummy), out_name);
+
+    for (block = 0; block < 3; block++)
+      convert_block(&f, out, block, in_name, out_name);
+
+    if (fclose(out))
+      fail("I/O error writing", out_name);
+
+    printf("%s -> %s: %lld particles\n", in_name, out_name, (long long)f.header.npart_file);
+
+    lptc_close(&f);
+  }
+
+  return 0;
+}
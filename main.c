@@ -1,21 +1,38 @@
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <mpi.h>
-#include <complex.h> 
 #include <gsl/gsl_rng.h>
 #include "allvars.h"
 #include "proto.h"
 
-#define ASSERT_ALLOC(cond)                                                                     \
-  {                                                                                            \
-    if (!cond)                                                                                 \
-    {                                                                                          \
-      printf("failed to allocate %g Mbyte on Task %d\n", bytes / (1024.0 * 1024.0), ThisTask); \
-      printf("bailing out.\n");                                                                \
-      FatalError(1);                                                                           \
-    }                                                                                          \
-  }
+#ifndef ONLY_GAUSSIAN
+static void potential_gradient(fftw_complex *cpot, fftw_complex *cdisp[3], double Beta);
+static double png_displacements(fftw_complex *cpot, double Beta);
+static double png_realization(fftw_complex *cpot, fftw_complex *cpot_gauss, float *lagrangian_pos,
+                              double Beta, char *suffix);
+#else
+static void flip_first_order(float *zadisp);
+#endif
+static double lpt_displacements(fftw_complex *cdisp[3], float *zadisp);
+
+/* ghost planes in flight, see post_ghost_exchange() */
+#define MAXGHOSTFIELDS 6
+struct ghost_exchange
+{
+  int nreq;
+  MPI_Request request[2 * MAXGHOSTFIELDS];
+};
+static void post_ghost_exchange(struct ghost_exchange *gx, fftw_real **fields, int n);
+static void finish_ghost_exchange(struct ghost_exchange *gx);
+static int Left_task, Right_task;  /* nearest tasks along x that hold planes, on either side */
+
+/* readout order of the particles, see cell_order() */
+#define READOUT_BLOCK 16  /* cells along each side of a block */
+#define READOUT_TILE  32  /* glass tiles up to this many cells across are read in glass order */
+
+static void write_snapshot(char *suffix);
 
 int frequency_of_primes(int n)
 {
@@ -53,7 +70,14 @@ void print_timed_done(int n)
 int main(int argc, char **argv)
 {
 
+#if defined(USE_OPENMP) || defined(ASYNC_OUTPUT)
+  int provided;
+
+  /* only the master thread talks to MPI */
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+#else
   MPI_Init(&argc, &argv);
+#endif
   MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
   MPI_Comm_size(MPI_COMM_WORLD, &NTask);
 
@@ -65,7 +89,7 @@ int main(int argc, char **argv)
     if (ThisTask == 0)
     {
       fprintf(stdout, "\nParameters are missing.\n");
-      fprintf(stdout, "Call with <ParameterFile>\n\n");
+      fprintf(stdout, "Call with <ParameterFile> [--dry-run]\n\n");
     }
     MPI_Finalize();
     exit(0);
@@ -76,25 +100,32 @@ int main(int argc, char **argv)
   set_units();
   initialize_transferfunction();
   initialize_powerspectrum();
+
+  if (argc > 2 && strcmp(argv[2], "--dry-run") == 0)
+  {
+    dry_run(); /* memory and FFT plan only, no fields are allocated */
+    MPI_Finalize();
+    exit(0);
+  }
+
   initialize_ffts();
+#ifdef LATTICE_LOAD
+  read_lattice();
+#else
   read_glass(GlassFile);
+#endif
 
   if (ThisTask == 0)
     print_setup();
 
-  displacement_fields();
+  displacement_fields(); /* moves the particles and writes the snapshot(s) */
 
-  if (ThisTask == 0)
-  {
-    printf("Writing initial conditions snapshot...");
-    fflush(stdout);
-  };
-  write_particle_data();
-  if (ThisTask == 0)
-    print_timed_done(10);
   if (NumPart)
     free(P);
   free_ffts();
+#ifdef ASYNC_OUTPUT
+  finish_output(); /* the last snapshot is written while the fields are freed */
+#endif
   MPI_Barrier(MPI_COMM_WORLD);
   print_spec();
   MPI_Finalize(); /* clean up & finalize MPI */
@@ -134,6 +165,12 @@ void print_setup(void)
   char exec[] = "2LPTNGOSC";
 #endif
 // *** Collider Addition (End) ***
+#ifdef SEPARABLE_FNL
+  char exec[] = "2LPTNGSEP";
+#endif
+#ifdef PNG_BATCH
+  char exec[] = "2LPTNGBATCH";
+#endif
 
   pstr[0] = '*';
   for (int i = 1; i < 79 / 2 - 3; i++)
@@ -155,7 +192,17 @@ void print_setup(void)
   printf(" sigma8 = %.4f     Anorm = %.3e     PrimoridalIndex = %.4f       Redshift = %.2e\n", Sigma8, Anorm, PrimordialIndex, Redshift);
   printf(" HubbleParam = %.4f  OmegaDM_2ndSpecies = %.2e    fNL = %+.2e    Delta = %+.2e\n", HubbleParam, OmegaDM_2ndSpecies, Fnl, Delta);
   printf(" Klong_max = %+.2e  Spin = %d    Nu = %+.2e    Phase = %+.2e\n", Klong_max, Spin, Nu, Phase);
-  printf(" FixedAmplitude = %d    PhaseFlip = % d   SphereMode = %d    Seed = %d\n", FixedAmplitude, PhaseFlip, SphereMode, Seed);
+  printf(" FixedAmplitude = %d    PhaseFlip = % d   PairedOutput = %d   SphereMode = %d    Seed = %d\n", FixedAmplitude, PhaseFlip, PairedOutput, SphereMode, Seed);
+  printf(" NTask = %d    threads per task = %d\n", NTask, omp_get_max_threads());
+#ifdef PNG_BATCH
+  for (int i = 0; i < NumPngTemplates; i++)
+    printf(" Template %2d: %-10s fNL = %+.2e\n", i, png_template_name(PngTemplate[i].Shape), PngTemplate[i].Fnl);
+#endif
+#if defined(SEPARABLE_FNL) || defined(PNG_BATCH)
+  for (int i = 0; i < NumPngTerms; i++)
+    printf(" Separable term %2d: %+.6e k^%+g FT[(k^%+g Phi)(k^%+g Phi)]\n", i, PngTerm[i].Coef, PngTerm[i].Out,
+           PngTerm[i].Leg[0], PngTerm[i].Leg[1]);
+#endif
   printf("***************************************************************************************************\n");
   // Write code to check if OSC_FNL and Delta!=1.5. If so, throw a warning because cosmo collider template is motivated for Delta=1.5. ALthough code will run for bothcases
   #ifdef OSC_FNL
@@ -172,212 +219,180 @@ void print_setup(void)
   return;
 }
 
-void displacement_fields(void){
-  MPI_Request request;
-  MPI_Status status;
-  gsl_rng *random_generator;
-  int i, j, k, ii, jj, kk, i_herm, j_herm, k_herm, axes;
-  int n;
-  int sendTask, recvTask;
-  #ifdef ONLY_GAUSSIAN
-    double p_of_k, delta;
-  #else
-  // Initialize variables relevant for local FNL (and QSFI)
-  double t_of_k, phig, Beta, twb;
-  fftw_complex *(cpot); /* For computing nongaussian fnl ic */
-  fftw_real *(pot);
-
-  #ifdef OUTPUT_DF
-    fftw_real *(pot_global);
-  #endif
-
-
-  // *** Collider Addition (Start) ***
-  #ifdef QSFI_FNL
-    // |k|^Delta/3*(4-ns)~|k|^Delta for scale invariant
-    double kmag_Delta_QSFI;
-    
-    // Define the k^Delta phi_G(k) field and its Fourier transform
-    fftw_complex *(ckdeltaphi);
-    fftw_real *(kdeltaphi);
-
-    // Define the auxiliary field, Psi, which is computed from kdeltaphi
-    fftw_complex *(cpsi);
-    fftw_real *(psi);
-
-    // Define squared Gaussian potential which must be subtracted to construct
-    // psi field. Note that we create a new field for this because we need to 
-    // apply the high-pass filter in Fourier space on IFFT[pot^2](k).
-    fftw_complex *(cpot_sq);
-    fftw_real *(pot_sq);
-
-  #else
-  #ifdef OSC_FNL
-    // Define momentum powers |k|^{0.5*(4-ns)+i\nu}~|k|^3/2+i\nu for scale 
-    // invariant
-    double complex kmag_Delta_plus_inu; 
-    double complex kmag_Delta_min_inu;
-
-    // Define phase coefficients e^{i delta}
-    double complex exp_plus_iphase;
-    double complex exp_min_iphase;
-
-    // Define some temporary complex numbers used for manipulations
-    double complex temp_ck_coord, temp_ck_herm, temp_real, temp_imag, temp_complex, temp_cpsi_plus, temp_cpsi_min;
-
-
-
-    // Define the k^{3/2+/-i\nu}phi_G(k) field and its Fourier transform. Since
-    // we are working with a complex field, we need to define two fields for
-    // the real and imaginary parts. 
-
-    // Define the +i\nu field
-    // fftw_complex *(ck_Delta_plus_inu_full); // k^{Delta+i\nu} (fully complex FFT)
-    fftw_complex *(ck_Delta_plus_inu_phi_full); // k^{Delta+i\nu}phi(k) (fully complex FFT)
-
-    fftw_complex *(ck_Delta_plus_inu_phi_real);
-    fftw_real *(k_Delta_plus_inu_phi_real);    
-    fftw_complex *(ck_Delta_plus_inu_phi_imag); 
-    fftw_real *(k_Delta_plus_inu_phi_imag);   
-  
-    // Define the -i\nu field
-    // fftw_complex *(ck_Delta_min_inu_full); // k^{Delta-i\nu} (fully complex FFT)
-    fftw_complex *(ck_Delta_min_inu_phi_full); // k^{Delta-i\nu}phi(k) (fully complex FFT)
-  
-    fftw_complex *(ck_Delta_min_inu_phi_real); 
-    fftw_real *(k_Delta_min_inu_phi_real);    
-    fftw_complex *(ck_Delta_min_inu_phi_imag); 
-    fftw_real *(k_Delta_min_inu_phi_imag);   
-  
-    // Define the auxiliary field, Psi=Psi_plus+Psi_minus
-    fftw_complex *(cpsi);
-    fftw_real *(psi);
-
-
-    // Define squared Gaussian potential which must be subtracted to construct
-    // psi field.
-    fftw_complex *(cpot_sq);
-    fftw_real *(pot_sq);
-    
-    // Define receive fields for MPI communication (used for Hermitian indices)
-    fftw_complex *(cpot_received);
-    fftw_complex *(ck_Delta_plus_inu_phi_full_received);
-    fftw_complex *(ck_Delta_min_inu_phi_full_received);
-    
-  #else
-  // *** Collider Addition (END) ***
-  #ifndef LOCAL_FNL
-    if (ThisTask == 0)
-    {
-      printf("Defining quantities for non-local non-collider PNG\n");
-      fflush(stdout);
-    };
-    // *************************** DSJ *******************************
-    double exp_1_over_3, exp_1_over_6, kmag_1_over_3, kmag_2_over_3;
-    // *************************** DSJ *******************************
-    fftw_complex *(cpartpot); /* For non-local fluctuations */
-    fftw_real *(partpot);
-    fftw_complex *(cp1p2p3sym);
-    fftw_real *(p1p2p3sym);
-    fftw_complex *(cp1p2p3sca);
-    fftw_real *(p1p2p3sca);
-    fftw_complex *(cp1p2p3nab);
-    fftw_real *(p1p2p3nab);
-    fftw_complex *(cp1p2p3tre);
-    fftw_real *(p1p2p3tre);
-  // ****  wrc ****
-  #ifdef ORTOG_LSS_FNL
-    // Will contain phi_G/k (hence invs)
-    fftw_complex *(cp1p2p3inv);
-    fftw_real *(p1p2p3inv);
-    // names correspond to kernels in Appendix A of Coulton et al.
-    fftw_complex *(cp1p2p3_K12D);
-    fftw_real *(p1p2p3_K12D);
-    fftw_complex *(cp1p2p3_K12E);
-    fftw_real *(p1p2p3_K12E);
-    fftw_complex *(cp1p2p3_K12F);
-    fftw_real *(p1p2p3_K12F);
-    fftw_complex *(cp1p2p3_K12G);
-    fftw_real *(p1p2p3_K12G);
-    double orth_p = 27.0 / (-21.0 + 743.0 / (7 * (20.0 * pow(PI, 2.0) - 193.0)));
-    double orth_t = (2.0 + 20.0 / 9.0 * orth_p) / (6 * (1.0 + 5.0 / 9.0 * orth_p));
-  #endif
-  // ****  wrc ****
-  #endif // Addition
-  #endif // Addition
-  #endif
-  #endif
-  double fac, vel_prefac, vel_prefac2;
-  double kvec[3], kmag, kmag2;
-  double phase, ampl, hubble_a;
-  double u, v, w;
-  double f1, f2, f3, f4, f5, f6, f7, f8;
-  double dis, dis2, maxdisp, max_disp_glob;
-  unsigned int *seedtable;
-  // ******* FAVN *****
-  double phase_shift;
-  // ******* FAVN *****
-
-  unsigned int bytes, nmesh3;
-  int coord_1d, coord, coord_herm; /* Used for converting 3D->1D index when accessing array elements. coord_herm is used to store index of Hermitian entry */
-  fftw_complex *(cdisp[3]), *(cdisp2[3]); /* ZA and 2nd order displacements */
-  fftw_real *(disp[3]), *(disp2[3]);
+#ifndef PHILOX_RNG
+/* The columns of modes are seeded from one ranlxd1 stream that fills the
+   Nmesh x Nmesh seed table shell by shell, |i| and |j| growing outwards, so
+   every task has to run through all of it. A task only keeps the rows x it
+   owns and their conjugates (Nmesh - x) % Nmesh, though: seedtable holds
+   these rows and seedrow[x] is the place of row x in it, -1 for the rows of
+   the other tasks. */
+static unsigned int *seedtable;
+static int *seedrow;
+
+static void store_seed(gsl_rng *random_generator, int i, int j)
+{
+  unsigned int seed = 0x7fffffff * gsl_rng_uniform(random_generator);
 
-  fftw_complex *(cdigrad[6]);
-  fftw_real *(digrad[6]);
+  if (seedrow[i] >= 0)
+    seedtable[seedrow[i] * Nmesh + j] = seed;
+}
 
-  #ifdef CORRECT_CIC
-    double fx, fy, fz, ff, smth;
-  #endif
+static void init_seedtable(void)
+{
+  gsl_rng *random_generator;
+  int i, j, nrows;
 
-  hubble_a = Hubble * sqrt(Omega / pow(InitTime, 3) + (1 - Omega - OmegaLambda) / pow(InitTime, 2) + OmegaLambda);
-  vel_prefac = InitTime * hubble_a * F_Omega(InitTime) / sqrt(InitTime);
-  vel_prefac2 = InitTime * hubble_a * F2_Omega(InitTime) / sqrt(InitTime);
+  if (!(seedrow = malloc(Nmesh * sizeof(int))))
+    FatalError(4);
 
-  // ******************************************** FAVN **********************************************
-  phase_shift = 0.0;
-  if (PhaseFlip == 1)
-    phase_shift = PI;
-  // ******************************************** FAVN **********************************************
+  for (i = 0; i < Nmesh; i++)
+    seedrow[i] = -1;
 
-  fac = pow(2 * PI / Box, 1.5);
+  for (i = Local_x_start, nrows = 0; i < Local_x_start + Local_nx; i++)
+  {
+    if (seedrow[i] < 0)
+      seedrow[i] = nrows++;
+    if (seedrow[(Nmesh - i) % Nmesh] < 0)
+      seedrow[(Nmesh - i) % Nmesh] = nrows++;
+  }
 
-  maxdisp = 0;
+  if (!(seedtable = malloc((size_t)nrows * Nmesh * sizeof(unsigned int) + 1)))
+    FatalError(4);
 
   random_generator = gsl_rng_alloc(gsl_rng_ranlxd1);
 
   gsl_rng_set(random_generator, Seed);
 
-  if (!(seedtable = malloc(Nmesh * Nmesh * sizeof(unsigned int))))
-    FatalError(4);
-
   for (i = 0; i < Nmesh / 2; i++)
   {
     for (j = 0; j < i; j++)
-      seedtable[i * Nmesh + j] = 0x7fffffff * gsl_rng_uniform(random_generator);
+      store_seed(random_generator, i, j);
 
     for (j = 0; j < i + 1; j++)
-      seedtable[j * Nmesh + i] = 0x7fffffff * gsl_rng_uniform(random_generator);
+      store_seed(random_generator, j, i);
 
     for (j = 0; j < i; j++)
-      seedtable[(Nmesh - 1 - i) * Nmesh + j] = 0x7fffffff * gsl_rng_uniform(random_generator);
+      store_seed(random_generator, Nmesh - 1 - i, j);
 
     for (j = 0; j < i + 1; j++)
-      seedtable[(Nmesh - 1 - j) * Nmesh + i] = 0x7fffffff * gsl_rng_uniform(random_generator);
+      store_seed(random_generator, Nmesh - 1 - j, i);
 
     for (j = 0; j < i; j++)
-      seedtable[i * Nmesh + (Nmesh - 1 - j)] = 0x7fffffff * gsl_rng_uniform(random_generator);
+      store_seed(random_generator, i, Nmesh - 1 - j);
 
     for (j = 0; j < i + 1; j++)
-      seedtable[j * Nmesh + (Nmesh - 1 - i)] = 0x7fffffff * gsl_rng_uniform(random_generator);
+      store_seed(random_generator, j, Nmesh - 1 - i);
 
     for (j = 0; j < i; j++)
-      seedtable[(Nmesh - 1 - i) * Nmesh + (Nmesh - 1 - j)] = 0x7fffffff * gsl_rng_uniform(random_generator);
+      store_seed(random_generator, Nmesh - 1 - i, Nmesh - 1 - j);
 
     for (j = 0; j < i + 1; j++)
-      seedtable[(Nmesh - 1 - j) * Nmesh + (Nmesh - 1 - i)] = 0x7fffffff * gsl_rng_uniform(random_generator);
+      store_seed(random_generator, Nmesh - 1 - j, Nmesh - 1 - i);
+  }
+
+  gsl_rng_free(random_generator);
+}
+
+/* Does this task hold the k-space column (i,j)? */
+static int local_column(int i, int j)
+{
+  return i >= Local_x_start && i < (Local_x_start + Local_nx) &&
+         j >= Local_y_start && j < (Local_y_start + Local_ny);
+}
+#endif
+
+#ifdef PHILOX_RNG
+/* Phase and amplitude deviate of the mode at the global grid point (i,j,k),
+   k < Nmesh/2, from the counter-based generator. As in the ranlxd1 path the
+   Nyquist planes and the zero mode stay empty (returns 0), and of each
+   conjugate pair in the k=0 plane only the member with 0 < i < Nmesh/2, or
+   i = 0 and j < Nmesh/2, is drawn: the other one gets the deviates and the
+   k vector of its partner and has to take the complex conjugate (returns -1). */
+static int counter_mode(int i, int j, int k, double *phase, double *ampl, double *kvec)
+{
+  int conj = 1;
+
+  if (i == Nmesh / 2 || j == Nmesh / 2)
+    return 0;
+  if (i == 0 && j == 0 && k == 0)
+    return 0;
+
+  if (k == 0 && (i > Nmesh / 2 || (i == 0 && j > Nmesh / 2)))
+  {
+    i = (Nmesh - i) % Nmesh;
+    j = (Nmesh - j) % Nmesh;
+    conj = -1;
   }
 
+  philox_mode(i, j, k, phase, ampl);
+  *phase *= 2 * PI;
+
+  kvec[0] = Kgrid[i];
+  kvec[1] = Kgrid[j];
+  kvec[2] = Kgrid[k];
+
+  return conj;
+}
+#endif
+
+void displacement_fields(void){
+#ifdef PHILOX_RNG
+  int conj;
+#else
+  gsl_rng **column_rng, *rng; /* one generator per thread for the mode columns */
+  int ii, jj, nthreads;
+#endif
+  int i, j, k, axes;
+  #ifdef ONLY_GAUSSIAN
+    double p_of_k, delta;
+    float *zadisp = NULL; /* ZA displacement of every particle, for the twin of a pair */
+    char suffix[20];
+    fftw_complex *(cdisp[3]); /* ZA displacements */
+  #else
+  // Initialize variables relevant for the non-Gaussian potential
+  double phig, Beta;
+  fftw_complex *(cpot); /* For computing nongaussian fnl ic */
+  fftw_complex *(cpot_gauss) = NULL; /* Gaussian potential, shared by all templates and pair members */
+  float *lagrangian_pos = NULL;
+  int n, t, ntemplates, shape;
+  double fnl_t;
+  char suffix[100];
+  #endif
+  double fac;
+  double kvec[3], kmag, kmag2;
+  double phase, ampl;
+  double maxdisp, max_disp_glob, dmax;
+  // ******* FAVN *****
+  double phase_shift;
+  // ******* FAVN *****
+
+  unsigned int bytes;
+#if defined(PHILOX_RNG) || !defined(ONLY_GAUSSIAN)
+  int coord;
+#endif
+
+  // ******************************************** FAVN **********************************************
+  phase_shift = 0.0;
+  if (PhaseFlip == 1)
+    phase_shift = PI;
+  // ******************************************** FAVN **********************************************
+
+  fac = pow(2 * PI / Box, 1.5);
+
+  maxdisp = 0;
+
+#ifndef PHILOX_RNG
+  init_seedtable();
+
+  /* every column is reseeded from the table, so it does not matter which
+     thread draws it */
+  nthreads = omp_get_max_threads();
+  if (!(column_rng = malloc(nthreads * sizeof(gsl_rng *))))
+    FatalError(4);
+  for (i = 0; i < nthreads; i++)
+    column_rng[i] = gsl_rng_alloc(gsl_rng_ranlxd1);
+#endif
+
   #ifdef ONLY_GAUSSIAN
 
     if (ThisTask == 0)
@@ -387,26 +402,30 @@ void displacement_fields(void){
     };
 
     for (axes = 0, bytes = 0; axes < 3; axes++)
-    {
-      cdisp[axes] = (fftw_complex *)malloc(bytes += sizeof(fftw_real) * TotalSizePlusAdditional);
-      disp[axes] = (fftw_real *)cdisp[axes];
-    }
+      cdisp[axes] = (fftw_complex *)fft_malloc(bytes += sizeof(fftw_real) * TotalSizePlusAdditional);
 
     ASSERT_ALLOC(cdisp[0] && cdisp[1] && cdisp[2]);
 
+    if (PairedOutput)
+    {
+      zadisp = (float *)malloc(bytes = sizeof(float) * 3 * NumPart + 1);
+      ASSERT_ALLOC(zadisp);
+    }
+
   #if defined(MULTICOMPONENTGLASSFILE) && defined(DIFFERENT_TRANSFER_FUNC)
     for (Type = MinType; Type <= MaxType; Type++)
   #endif
   {
 
     /* first, clean the array */
+    #pragma omp parallel for collapse(2) private(k, axes)
     for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
+      for (j = 0; j < Local_ny; j++)
         for (k = 0; k <= Nmesh / 2; k++)
           for (axes = 0; axes < 3; axes++)
           {
-            cdisp[axes][(i * Nmesh + j) * (Nmesh / 2 + 1) + k].re = 0;
-            cdisp[axes][(i * Nmesh + j) * (Nmesh / 2 + 1) + k].im = 0;
+            cdisp[axes][(i * Local_ny + j) * (Nmesh / 2 + 1) + k].re = 0;
+            cdisp[axes][(i * Local_ny + j) * (Nmesh / 2 + 1) + k].im = 0;
 
               /* ADDITION FOR OUTPUTTING MODES */
               #ifdef OUTPUT_DF
@@ -414,14 +433,62 @@ void displacement_fields(void){
                 //amplitudes and phases
                 if (axes==0)
                   {
-                    coord_DF[(i * Nmesh + j) * (Nmesh / 2 + 1) + k] = ((i+Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k;
-                    amplitudes[(i * Nmesh + j) * (Nmesh / 2 + 1) + k] = 0;
-                    phases[(i * Nmesh + j) * (Nmesh / 2 + 1) + k] = 0;
+                    coord_DF[(i * Local_ny + j) * (Nmesh / 2 + 1) + k] = ((i+Local_x_start) * Nmesh + (j + Local_y_start)) * (Nmesh / 2 + 1) + k;
+                    amplitudes[(i * Local_ny + j) * (Nmesh / 2 + 1) + k] = 0;
+                    phases[(i * Local_ny + j) * (Nmesh / 2 + 1) + k] = 0;
                   }
               #endif
               /* ADDITION FOR OUTPUTTING MODES */
           }
 
+#ifdef PHILOX_RNG
+    #pragma omp parallel for collapse(2) private(k, conj, phase, ampl, kvec, kmag, kmag2, p_of_k, delta, coord, axes)
+    for (i = 0; i < Local_nx; i++)
+      for (j = 0; j < Local_ny; j++)
+        for (k = 0; k < Nmesh / 2; k++)
+        {
+          if (!(conj = counter_mode(i + Local_x_start, j + Local_y_start, k, &phase, &ampl, kvec)))
+            continue;
+
+          phase += phase_shift;
+
+          kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
+          kmag = sqrt(kmag2);
+
+          if (SphereMode == 1)
+          {
+            if (kmag * Box / (2 * PI) > Nsample / 2) /* select a sphere in k-space */
+              continue;
+          }
+          else
+          {
+            if (fabs(kvec[0]) * Box / (2 * PI) > Nsample / 2)
+              continue;
+            if (fabs(kvec[1]) * Box / (2 * PI) > Nsample / 2)
+              continue;
+            if (fabs(kvec[2]) * Box / (2 * PI) > Nsample / 2)
+              continue;
+          }
+
+          p_of_k = PowerSpec(kmag);
+          if (!FixedAmplitude)
+            p_of_k *= -log(ampl);
+
+          delta = fac * sqrt(p_of_k) / Dplus; /* scale back to starting redshift */
+
+          coord = (i * Local_ny + j) * (Nmesh / 2 + 1) + k;
+          for (axes = 0; axes < 3; axes++)
+          {
+            cdisp[axes][coord].re = -kvec[axes] / kmag2 * delta * sin(phase);
+            cdisp[axes][coord].im = conj * kvec[axes] / kmag2 * delta * cos(phase);
+          }
+
+          #ifdef OUTPUT_DF
+            amplitudes[coord] = delta;
+            phases[coord] = conj * phase;
+          #endif
+        }
+#else
     for (i = 0; i < Nmesh; i++){
       ii = Nmesh - i;
       if (ii == Nmesh)
@@ -429,18 +496,24 @@ void displacement_fields(void){
       if ((i >= Local_x_start && i < (Local_x_start + Local_nx)) ||
           (ii >= Local_x_start && ii < (Local_x_start + Local_nx)))
       {
+        #pragma omp parallel for schedule(dynamic) private(k, jj, rng, phase, ampl, kvec, kmag, kmag2, p_of_k, delta, axes) firstprivate(ii)
         for (j = 0; j < Nmesh; j++)
         {
-          gsl_rng_set(random_generator, seedtable[i * Nmesh + j]);
+          jj = (Nmesh - j) % Nmesh;
+          if (!local_column(i, j) && !local_column(ii, jj))
+            continue; /* neither this column nor its k=0 conjugate is ours */
+
+          rng = column_rng[omp_get_thread_num()];
+          gsl_rng_set(rng, seedtable[seedrow[i] * Nmesh + j]);
 
           for (k = 0; k < Nmesh / 2; k++)
           {
-            phase = gsl_rng_uniform(random_generator) * 2 * PI;
+            phase = gsl_rng_uniform(rng) * 2 * PI;
             //************ FAVN ***************
             phase += phase_shift;
             //************ FAVN ***************
             do
-              ampl = gsl_rng_uniform(random_generator);
+              ampl = gsl_rng_uniform(rng);
             while (ampl == 0);
 
             if (i == Nmesh / 2 || j == Nmesh / 2 || k == Nmesh / 2)
@@ -448,22 +521,11 @@ void displacement_fields(void){
             if (i == 0 && j == 0 && k == 0)
               continue;
 
-            if (i < Nmesh / 2)
-              kvec[0] = i * 2 * PI / Box;
-            else
-              kvec[0] = -(Nmesh - i) * 2 * PI / Box;
-
-            if (j < Nmesh / 2)
-              kvec[1] = j * 2 * PI / Box;
-            else
-              kvec[1] = -(Nmesh - j) * 2 * PI / Box;
-
-            if (k < Nmesh / 2)
-              kvec[2] = k * 2 * PI / Box;
-            else
-              kvec[2] = -(Nmesh - k) * 2 * PI / Box;
+            kvec[0] = Kgrid[i];
+            kvec[1] = Kgrid[j];
+            kvec[2] = Kgrid[k];
 
-            kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
+            kmag2 = Kgrid2[i] + Kgrid2[j] + Kgrid2[k];
             kmag = sqrt(kmag2);
 
             if (SphereMode == 1)
@@ -491,19 +553,19 @@ void displacement_fields(void){
 
             if (k > 0)
             {
-              if (i >= Local_x_start && i < (Local_x_start + Local_nx))
+              if (local_column(i, j))
                 for (axes = 0; axes < 3; axes++)
                 {
-                  cdisp[axes][((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k].re =
+                  cdisp[axes][((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k].re =
                       -kvec[axes] / kmag2 * delta * sin(phase);
-                  cdisp[axes][((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k].im =
+                  cdisp[axes][((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k].im =
                       kvec[axes] / kmag2 * delta * cos(phase);
 
                   #ifdef OUTPUT_DF
                     if (axes==0)
                       {
-                        amplitudes[((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k] = delta;
-                        phases[((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k] = phase;
+                        amplitudes[((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k] = delta;
+                        phases[((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k] = phase;
                       }
                   #endif
                 }
@@ -516,32 +578,39 @@ void displacement_fields(void){
                   continue;
                 else
                 {
-                  if (i >= Local_x_start && i < (Local_x_start + Local_nx))
-                  {
-                    jj = Nmesh - j; /* note: j!=0 surely holds at this point */
+                  jj = Nmesh - j; /* note: j!=0 surely holds at this point */
 
+                  if (local_column(i, j))
                     for (axes = 0; axes < 3; axes++)
                     {
-                      cdisp[axes][((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k].re =
+                      cdisp[axes][((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k].re =
                           -kvec[axes] / kmag2 * delta * sin(phase);
-                      cdisp[axes][((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k].im =
+                      cdisp[axes][((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k].im =
                           kvec[axes] / kmag2 * delta * cos(phase);
 
-                      cdisp[axes][((i - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k].re =
+                      #ifdef OUTPUT_DF
+                        if (axes==0){
+                          amplitudes[((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k] = delta;
+                          phases[((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k] = phase;
+                        }
+                      #endif
+                    }
+
+                  if (local_column(i, jj))
+                    for (axes = 0; axes < 3; axes++)
+                    {
+                      cdisp[axes][((i - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) + k].re =
                           -kvec[axes] / kmag2 * delta * sin(phase);
-                      cdisp[axes][((i - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k].im =
+                      cdisp[axes][((i - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) + k].im =
                           -kvec[axes] / kmag2 * delta * cos(phase);
 
                       #ifdef OUTPUT_DF
                         if (axes==0){
-                          amplitudes[((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k] = delta;
-                          phases[((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k] = phase;
-                          amplitudes[((i - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k] = delta;
-          					      phases[((i - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k] = -phase;
+                          amplitudes[((i - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) + k] = delta;
+          					      phases[((i - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) + k] = -phase;
                         }
                       #endif
                     }
-                  }
                 }
               }
               else /* here comes i!=0 : conjugate can be on other processor! */
@@ -557,35 +626,35 @@ void displacement_fields(void){
                   if (jj == Nmesh)
                     jj = 0;
 
-                  if (i >= Local_x_start && i < (Local_x_start + Local_nx))
+                  if (local_column(i, j))
                     for (axes = 0; axes < 3; axes++)
                     {
-                      cdisp[axes][((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k].re =
+                      cdisp[axes][((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k].re =
                           -kvec[axes] / kmag2 * delta * sin(phase);
-                      cdisp[axes][((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k].im =
+                      cdisp[axes][((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k].im =
                           kvec[axes] / kmag2 * delta * cos(phase);
 
                       #ifdef OUTPUT_DF
                         if (axes==0){
-                          amplitudes[((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k] = delta;
-                          phases[((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k] = phase;
+                          amplitudes[((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k] = delta;
+                          phases[((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k] = phase;
                         }
                       #endif
                     }
 
-                  if (ii >= Local_x_start && ii < (Local_x_start + Local_nx))
+                  if (local_column(ii, jj))
                     for (axes = 0; axes < 3; axes++)
                     {
-                      cdisp[axes][((ii - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) +
+                      cdisp[axes][((ii - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) +
                                   k]
                           .re = -kvec[axes] / kmag2 * delta * sin(phase);
-                      cdisp[axes][((ii - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) +
+                      cdisp[axes][((ii - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) +
                                   k]
                           .im = -kvec[axes] / kmag2 * delta * cos(phase);
                       #ifdef OUTPUT_DF
           					  if (axes==0){
-                        amplitudes[((ii - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k] = delta;
-                        phases[((ii - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k] = -phase;
+                        amplitudes[((ii - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) + k] = delta;
+                        phases[((ii - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) + k] = -phase;
                       }
                       #endif					  
                     }
@@ -596,6 +665,7 @@ void displacement_fields(void){
         }
       }
     }
+#endif
 
     if (ThisTask == 0)
       print_timed_done(4);
@@ -610,6 +680,34 @@ void displacement_fields(void){
 		#endif
     
 
+#ifdef TRANSPOSED_KSPACE
+    /* the modes are drawn slab by slab along x, the k-space kernels want them along y */
+    for (axes = 0; axes < 3; axes++)
+      fft_transpose_kspace((fftw_real *)cdisp[axes]);
+#endif
+
+    dmax = lpt_displacements(cdisp, zadisp);
+    if (dmax > maxdisp)
+      maxdisp = dmax;
+  }
+
+  for (axes = 0; axes < 3; axes++)
+    fft_free(cdisp[axes]);
+
+  if (PairedOutput)
+  {
+    sprintf(suffix, "_pf%d", PhaseFlip);
+    write_snapshot(suffix);
+
+    flip_first_order(zadisp);
+    free(zadisp);
+
+    sprintf(suffix, "_pf%d", 1 - PhaseFlip);
+    write_snapshot(suffix);
+  }
+  else
+    write_snapshot("");
+
   #else /* non gaussian initial potential fnl type  */
 
   if (ThisTask == 0)
@@ -619,24 +717,24 @@ void displacement_fields(void){
   };
 
   bytes = 0; /*initialize*/
-  cpot = (fftw_complex *)malloc(bytes += sizeof(fftw_real) * TotalSizePlusAdditional);
-  pot = (fftw_real *)cpot;
+  cpot = (fftw_complex *)fft_malloc(bytes += sizeof(fftw_real) * TotalSizePlusAdditional);
 
   ASSERT_ALLOC(cpot);
 
   /* first, clean the cpot array */
+  #pragma omp parallel for collapse(2) private(k)
   for (i = 0; i < Local_nx; i++)
-    for (j = 0; j < Nmesh; j++)
+    for (j = 0; j < Local_ny; j++)
       for (k = 0; k <= Nmesh / 2; k++)
       {
-        cpot[(i * Nmesh + j) * (Nmesh / 2 + 1) + k].re = 0;
-        cpot[(i * Nmesh + j) * (Nmesh / 2 + 1) + k].im = 0;
+        cpot[(i * Local_ny + j) * (Nmesh / 2 + 1) + k].re = 0;
+        cpot[(i * Local_ny + j) * (Nmesh / 2 + 1) + k].im = 0;
 
         // Also clean linear field arrays if requested as output
         #ifdef OUTPUT_DF
-          coord_DF[(i * Nmesh + j) * (Nmesh / 2 + 1) + k] = ((i+Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k;
-          amplitudes[(i * Nmesh + j) * (Nmesh / 2 + 1) + k] = 0;
-          phases[(i * Nmesh + j) * (Nmesh / 2 + 1) + k] = 0;
+          coord_DF[(i * Local_ny + j) * (Nmesh / 2 + 1) + k] = ((i+Local_x_start) * Nmesh + (j + Local_y_start)) * (Nmesh / 2 + 1) + k;
+          amplitudes[(i * Local_ny + j) * (Nmesh / 2 + 1) + k] = 0;
+          phases[(i * Local_ny + j) * (Nmesh / 2 + 1) + k] = 0;
         #endif
       }
 
@@ -644,6 +742,51 @@ void displacement_fields(void){
   /* Beta = 3/2 H(z)^2 a^3 Om(a) / D0 = 3/2 Ho^2 Om0 / D0 at redshift z = 0.0 */
   Beta = 1.5 * Omega / (2998. * 2998. / UnitLength_in_cm / UnitLength_in_cm * 3.085678e24 * 3.085678e24) / D0;
 
+#ifdef PHILOX_RNG
+  #pragma omp parallel for collapse(2) private(k, conj, phase, ampl, kvec, kmag, kmag2, phig, coord)
+  for (i = 0; i < Local_nx; i++)
+    for (j = 0; j < Local_ny; j++)
+      for (k = 0; k < Nmesh / 2; k++)
+      {
+        if (!(conj = counter_mode(i + Local_x_start, j + Local_y_start, k, &phase, &ampl, kvec)))
+          continue;
+
+        phase += phase_shift;
+
+        kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
+        kmag = sqrt(kmag2);
+
+        if (SphereMode == 1)
+        {
+          if (kmag * Box / (2 * PI) > Nsample / 2) /* select a sphere in k-space */
+            continue;
+        }
+        else
+        {
+          if (fabs(kvec[0]) * Box / (2 * PI) > Nsample / 2)
+            continue;
+          if (fabs(kvec[1]) * Box / (2 * PI) > Nsample / 2)
+            continue;
+          if (fabs(kvec[2]) * Box / (2 * PI) > Nsample / 2)
+            continue;
+        }
+
+        phig = Anorm * exp(PrimordialIndex * log(kmag)); /* initial normalized power */
+        if (!FixedAmplitude)
+          phig *= -log(ampl);
+
+        phig = sqrt(phig) * fac * Beta / kmag2; /* amplitude of the initial gaussian potential */
+
+        coord = (i * Local_ny + j) * (Nmesh / 2 + 1) + k;
+        cpot[coord].re = phig * cos(phase);
+        cpot[coord].im = conj * phig * sin(phase);
+
+        #ifdef OUTPUT_DF
+          amplitudes[coord] = phig;
+          phases[coord] = conj * phase;
+        #endif
+      }
+#else
   for (i = 0; i < Nmesh; i++)
   {
     ii = Nmesh - i;
@@ -652,18 +795,24 @@ void displacement_fields(void){
     if ((i >= Local_x_start && i < (Local_x_start + Local_nx)) ||
         (ii >= Local_x_start && ii < (Local_x_start + Local_nx)))
     {
+      #pragma omp parallel for schedule(dynamic) private(k, jj, rng, phase, ampl, kvec, kmag, kmag2, phig, coord) firstprivate(ii)
       for (j = 0; j < Nmesh; j++)
       {
-        gsl_rng_set(random_generator, seedtable[i * Nmesh + j]);
+        jj = (Nmesh - j) % Nmesh;
+        if (!local_column(i, j) && !local_column(ii, jj))
+          continue; /* neither this column nor its k=0 conjugate is ours */
+
+        rng = column_rng[omp_get_thread_num()];
+        gsl_rng_set(rng, seedtable[seedrow[i] * Nmesh + j]);
 
         for (k = 0; k < Nmesh / 2; k++)
         {
-          phase = gsl_rng_uniform(random_generator) * 2 * PI;
+          phase = gsl_rng_uniform(rng) * 2 * PI;
           // ***************** FAVN *****************
           phase += phase_shift;
           // ***************** FAVN *****************
           do
-            ampl = gsl_rng_uniform(random_generator);
+            ampl = gsl_rng_uniform(rng);
 
           while (ampl == 0);
 
@@ -672,22 +821,11 @@ void displacement_fields(void){
           if (i == 0 && j == 0 && k == 0)
             continue;
 
-          if (i < Nmesh / 2)
-            kvec[0] = i * 2 * PI / Box;
-          else
-            kvec[0] = -(Nmesh - i) * 2 * PI / Box;
-
-          if (j < Nmesh / 2)
-            kvec[1] = j * 2 * PI / Box;
-          else
-            kvec[1] = -(Nmesh - j) * 2 * PI / Box;
-
-          if (k < Nmesh / 2)
-            kvec[2] = k * 2 * PI / Box;
-          else
-            kvec[2] = -(Nmesh - k) * 2 * PI / Box;
+          kvec[0] = Kgrid[i];
+          kvec[1] = Kgrid[j];
+          kvec[2] = Kgrid[k];
 
-          kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
+          kmag2 = Kgrid2[i] + Kgrid2[j] + Kgrid2[k];
           kmag = sqrt(kmag2);
 
           if (SphereMode == 1)
@@ -716,17 +854,17 @@ void displacement_fields(void){
 
           if (k > 0)
           {
-            if (i >= Local_x_start && i < (Local_x_start + Local_nx))
+            if (local_column(i, j))
             {
 
-              coord = ((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k;
+              coord = ((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k;
 
               cpot[coord].re = phig * cos(phase);
               cpot[coord].im = phig * sin(phase);
 
               #ifdef OUTPUT_DF //SAM ADDED
-                amplitudes[((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k] = phig;
-                phases[((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k] = phase;
+                amplitudes[((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k] = phig;
+                phases[((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k] = phase;
               #endif
             }
           }
@@ -738,26 +876,31 @@ void displacement_fields(void){
                 continue;
               else
               {
-                if (i >= Local_x_start && i < (Local_x_start + Local_nx))
-                {
-                  jj = Nmesh - j; /* note: j!=0 surely holds at this point */
+                jj = Nmesh - j; /* note: j!=0 surely holds at this point */
 
-                  coord = ((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k;
+                if (local_column(i, j))
+                {
+                  coord = ((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k;
 
                   cpot[coord].re = phig * cos(phase);
                   cpot[coord].im = phig * sin(phase);
 
-                  coord = ((i - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k;
+                  #ifdef OUTPUT_DF //SAM ADDED
+                    amplitudes[((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k] = phig;
+                    phases[((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k] = phase;
+                  #endif
+                }
+
+                if (local_column(i, jj))
+                {
+                  coord = ((i - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) + k;
                   cpot[coord].re = phig * cos(phase);
                   cpot[coord].im = -phig * sin(phase);
 
                   #ifdef OUTPUT_DF //SAM ADDED
-                    amplitudes[((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k] = phig;
-                    phases[((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k] = phase;
-                    amplitudes[((i - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k] = phig;
-    					      phases[((i - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k] = -phase;
+                    amplitudes[((i - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) + k] = phig;
+    					      phases[((i - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) + k] = -phase;
                   #endif
-
                 }
               }
             }
@@ -774,28 +917,28 @@ void displacement_fields(void){
                 if (jj == Nmesh)
                   jj = 0;
 
-                if (i >= Local_x_start && i < (Local_x_start + Local_nx))
+                if (local_column(i, j))
                 {
 
-                  coord = ((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k;
+                  coord = ((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k;
 
                   cpot[coord].re = phig * cos(phase);
                   cpot[coord].im = phig * sin(phase);
 
                   #ifdef OUTPUT_DF 
-					          amplitudes[((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k] = phig;
-					          phases[((i - Local_x_start) * Nmesh + j) * (Nmesh / 2 + 1) + k] = phase;
+					          amplitudes[((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k] = phig;
+					          phases[((i - Local_x_start) * Local_ny + (j - Local_y_start)) * (Nmesh / 2 + 1) + k] = phase;
                   #endif
                 }
-                if (ii >= Local_x_start && ii < (Local_x_start + Local_nx))
+                if (local_column(ii, jj))
                 {
-                  coord = ((ii - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k;
+                  coord = ((ii - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) + k;
 
                   cpot[coord].re = phig * cos(phase);
                   cpot[coord].im = -phig * sin(phase);
                   #ifdef OUTPUT_DF
-					          amplitudes[((ii - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k] = phig;
-					          phases[((ii - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k] = -phase;
+					          amplitudes[((ii - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) + k] = phig;
+					          phases[((ii - Local_x_start) * Local_ny + (jj - Local_y_start)) * (Nmesh / 2 + 1) + k] = -phase;
                   #endif					  
                 }
               }
@@ -805,1721 +948,1143 @@ void displacement_fields(void){
       }
     }
   }
+#endif
 
+#ifdef TRANSPOSED_KSPACE
+  /* the modes are drawn slab by slab along x, the k-space kernels want them along y */
+  fft_transpose_kspace((fftw_real *)cpot);
+#endif
 
-  // #ifdef OUTPUT_DF (DOES"T WORK FOR OSCILLATORY MODE. Only outputs P(k) so not super useful)
-  // if (ThisTask == 0){
-  //   printf("\nWriting linear field.");
-  //   printf("Anorm = %.5e     Conversion = %.5e \n", Anorm,fac * Beta);
-  // }
-	//   write_density_field_data(); //NEED TO FIX THIS
-  // #endif
+  #ifdef PNG_BATCH
+    ntemplates = NumPngTemplates;
+  #else
+    ntemplates = 1;
+  #endif
 
-  /*** For non-local models it is important to keep all factors of SQRT(-1) as done below ***/
-  /*** Notice also that there is a minus to convert from Bardeen to gravitational potential ***/
-  #ifdef LOCAL_FNL
+  if (ntemplates > 1 || PairedOutput)
+  {
+    /* Keep the Gaussian potential and the Lagrangian particle positions, so that
+       every template and both members of a pair start from the same initial state */
+    cpot_gauss = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+    ASSERT_ALLOC(cpot_gauss);
+    memcpy(cpot_gauss, cpot, bytes);
+
+    lagrangian_pos = (float *)malloc(bytes = sizeof(float) * 3 * NumPart + 1);
+    ASSERT_ALLOC(lagrangian_pos);
+    for (n = 0; n < NumPart; n++)
+      for (axes = 0; axes < 3; axes++)
+        lagrangian_pos[3 * n + axes] = P[n].Pos[axes];
+  }
 
+  for (t = 0; t < ntemplates; t++)
+  {
+  #ifdef PNG_BATCH
+    shape = PngTemplate[t].Shape;
+    fnl_t = PngTemplate[t].Fnl;
+    snprintf(suffix, sizeof(suffix), "_%d_%s", t, png_template_name(shape));
 
     if (ThisTask == 0)
     {
-      printf("Computing local non-Gaussian potential...");
+      printf("\nTemplate %d of %d: %s with fNL = %+.2e\n", t + 1, ntemplates, png_template_name(shape), fnl_t);
       fflush(stdout);
     };
-
-    /******* LOCAL PRIMORDIAL POTENTIAL ************/
-    rfftwnd_mpi(Inverse_plan, 1, pot, Workspace, FFTW_NORMAL_ORDER);
-    fflush(stdout);
-
-    /* square the potential in configuration space */
-    MPI_Barrier(MPI_COMM_WORLD); // Maybe not necessary?
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k < Nmesh; k++)
-        {
-          coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k;
-          pot[coord] = pot[coord] + Fnl * pot[coord] * pot[coord];
-        }
-
-    /* Code to save the linear field */
-    #ifdef OUTPUT_DF
-      if (ThisTask == 0) printf("\nWriting linear field.");
-
-      // Define global potential for I/O. Note that it is Nmesh*Nmesh*(Nmesh+2) because of zero padding!
-      int local_size_pot = Local_nx * Nmesh * (2 * (Nmesh / 2 + 1)); 
-      int nprocs = (Nmesh+1) / Local_nx;  //(Nmesh + Local_nx - 1) / Local_nx;                        // Number of processes
-      pot_global = (fftw_real *)malloc(bytes = nprocs * sizeof(fftw_real) * TotalSizePlusAdditional);
-
-      MPI_Barrier(MPI_COMM_WORLD);
-      MPI_Allgather(pot, local_size_pot, MPI_DOUBLE, pot_global, local_size_pot, MPI_DOUBLE, MPI_COMM_WORLD);
-      if(ThisTask == 0){
-        // Open the file for writing
-        FILE *file = fopen("output_potential.txt", "w");
-        if (file == NULL) {
-            fprintf(stderr, "Error: Could not open output_potential.txt for writing.\n");
-            MPI_Abort(MPI_COMM_WORLD, 1);
-        }
-        for (i = 0; i < Nmesh; i++)
-          for (j = 0; j < Nmesh; j++)
-            for (k = 0; k < Nmesh; k++){
-              coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k;
-              fprintf(file, "i= %d, j= %d, k= %d, pot= %.5e\n", i, j, k, pot_global[coord]); 
-            }
-        fclose(file);
-      }
-      free(pot_global);
-    #endif
-
-    
-    MPI_Barrier(MPI_COMM_WORLD);
-    rfftwnd_mpi(Forward_plan, 1, pot, Workspace, FFTW_NORMAL_ORDER);
-
-    /* remove the N^3 I got by forwardfurier and put zero to zero mode */
-
-    nmesh3 = ((unsigned int)Nmesh) * ((unsigned int)Nmesh) * ((unsigned int)Nmesh);
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k <= Nmesh / 2; k++)
-        {
-          coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
-
-          // ****************************** DSJ *************************
-          if (SphereMode == 1)
-          {
-            ii = i + Local_x_start;
-
-            if (ii < Nmesh / 2)
-              kvec[0] = ii * 2 * PI / Box;
-            else
-              kvec[0] = -(Nmesh - ii) * 2 * PI / Box;
-
-            if (j < Nmesh / 2)
-              kvec[1] = j * 2 * PI / Box;
-            else
-              kvec[1] = -(Nmesh - j) * 2 * PI / Box;
-
-            if (k < Nmesh / 2)
-              kvec[2] = k * 2 * PI / Box;
-            else
-              kvec[2] = -(Nmesh - k) * 2 * PI / Box;
-
-            kmag = sqrt(kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2]);
-
-            if (kmag * Box / (2 * PI) > Nsample / 2)
-            { /* select a sphere in k-space */
-              cpot[coord].re = 0.;
-              cpot[coord].im = 0.;
-              continue;
-            }
-          }
-          // ****************************** DSJ *************************
-
-          cpot[coord].re /= (double)nmesh3;
-          cpot[coord].im /= (double)nmesh3;
-        }
-
-    if (ThisTask == 0)
-    {
-      cpot[0].re = 0.;
-      cpot[0].im = 0.;
-    }
-
-    if (ThisTask == 0)
-      print_timed_done(7);
-
   #else
+    shape = PNG_MODE;
+    fnl_t = Fnl;
+    suffix[0] = 0;
+  #endif
 
-  #ifdef QSFI_FNL
-  // ********************** Collider Addition (Start) ****************************
-    if (ThisTask == 0)
+    if (t > 0)
     {
-      printf("\nComputing QSFI non-Gaussian potential... ");
-      fflush(stdout);
-    };
-
-    // Initialize FFT's for auxiliary field
-    ckdeltaphi = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-    kdeltaphi = (fftw_real *)ckdeltaphi;
-    ASSERT_ALLOC(ckdeltaphi);
-
-    cpsi = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-    psi = (fftw_real *)cpsi;
-    ASSERT_ALLOC(cpsi);
+      cpot = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+      ASSERT_ALLOC(cpot);
+      memcpy(cpot, cpot_gauss, bytes);
 
-    cpot_sq = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-    pot_sq = (fftw_real *)cpot_sq;
-    ASSERT_ALLOC(cpot_sq);
+      for (n = 0; n < NumPart; n++)
+        for (axes = 0; axes < 3; axes++)
+          P[n].Pos[axes] = lagrangian_pos[3 * n + axes];
+    }
 
-    // Construct psi field
-    MPI_Barrier(MPI_COMM_WORLD);
-    // Clean all arrays
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k <= Nmesh / 2; k++)
-        {
-          coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
-          ckdeltaphi[coord].re = 0.0;
-          ckdeltaphi[coord].im = 0.0;
-          cpsi[coord].re = 0.0;
-          cpsi[coord].im = 0.0;
-          cpot_sq[coord].re = 0.0;
-          cpot_sq[coord].im = 0.0;
-        }
+    png_potential(cpot, shape, fnl_t);
 
-    
-    // Multiply by k^Delta
-    MPI_Barrier(MPI_COMM_WORLD);
-    for (ii = 0; ii < Local_nx; ii++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k <= Nmesh / 2; k++)
-        {
-          coord = (ii * Nmesh + j) * (Nmesh / 2 + 1) + k;
-          i = ii + Local_x_start;
+    dmax = png_realization(cpot, cpot_gauss, lagrangian_pos, Beta, suffix);
+    if (dmax > maxdisp)
+      maxdisp = dmax;
+  }
 
-          // Get knorm
-          if (i < Nmesh / 2)
-            kvec[0] = i * 2 * PI / Box;
-          else
-            kvec[0] = -(Nmesh - i) * 2 * PI / Box;
+  if (cpot_gauss)
+  {
+    free(lagrangian_pos);
+    fft_free(cpot_gauss);
+  }
+  #endif
 
-          if (j < Nmesh / 2)
-            kvec[1] = j * 2 * PI / Box;
-          else
-            kvec[1] = -(Nmesh - j) * 2 * PI / Box;
+#ifndef PHILOX_RNG
+  for (i = 0; i < nthreads; i++)
+    gsl_rng_free(column_rng[i]);
+  free(column_rng);
+  free(seedtable);
+  free(seedrow);
+#endif
 
-          if (k < Nmesh / 2)
-            kvec[2] = k * 2 * PI / Box;
-          else
-            kvec[2] = -(Nmesh - k) * 2 * PI / Box;
+  MPI_Reduce(&maxdisp, &max_disp_glob, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
 
-          kmag = sqrt(kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2]);
-          kmag_Delta_QSFI = pow(kmag, Delta/3.*(4.-PrimordialIndex)); 
-          ckdeltaphi[coord].re = kmag_Delta_QSFI * cpot[coord].re;
-          ckdeltaphi[coord].im = kmag_Delta_QSFI * cpot[coord].im;
+  /*  if(ThisTask == 0)
+      {
+        printf("\nMaximum displacement (1D): %g kpc/h, in units of the part-spacing= %g\n",
+         max_disp_glob, max_disp_glob / (Box / Nmesh));
+      }*/
+}
 
-        }
+#ifndef ONLY_GAUSSIAN
+/* ZA displacement field from the (non-)Gaussian primordial potential */
+static void potential_gradient(fftw_complex *cpot, fftw_complex *cdisp[3], double Beta)
+{
+  int i, j, k, axes, coord;
+  double kvec[3], kmag, t_of_k, twb;
+  struct kcolumn col;
 
-    // Fourier transform back to real space
-    MPI_Barrier(MPI_COMM_WORLD);
-    rfftwnd_mpi(Inverse_plan, 1, pot, Workspace, FFTW_NORMAL_ORDER);
-    rfftwnd_mpi(Inverse_plan, 1, kdeltaphi, Workspace, FFTW_NORMAL_ORDER);
+  if (ThisTask == 0)
+  {
+    printf("Computing gradient of non-Gaussian potential...");
+    fflush(stdout);
+  };
 
-    // Construct psi field
-    MPI_Barrier(MPI_COMM_WORLD);
-    /* Compute real space product for psi */
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k < Nmesh; k++)
+  /* first, clean the array */
+  #pragma omp parallel for collapse(2) private(k, axes)
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
+      for (k = 0; k <= Nmesh / 2; k++)
+        for (axes = 0; axes < 3; axes++)
         {
-          coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k;
-          /* Following line computes psi(x)=phi_g(x)*F(k^DeltaPhi_g)[x]
-              To get the full psi(x) we need to do the following:
-              1) Go back to fourier space and comptue 2/k^Delta*psi(k)
-              2) Go back to real space and subtract off Phi^2(x)
-          */
-          psi[coord] = kdeltaphi[coord] * pot[coord];
-          pot_sq[coord] = pot[coord]*pot[coord]; 
+          cdisp[axes][(i * Kspace_n1 + j) * (Nmesh / 2 + 1) + k].re = 0;
+          cdisp[axes][(i * Kspace_n1 + j) * (Nmesh / 2 + 1) + k].im = 0;
         }
 
-    // Fourier transform back to Fourier space
-    MPI_Barrier(MPI_COMM_WORLD);
-    rfftwnd_mpi(Forward_plan, 1, psi, Workspace, FFTW_NORMAL_ORDER);
-    rfftwnd_mpi(Forward_plan, 1, pot_sq, Workspace, FFTW_NORMAL_ORDER);
-
-    // Multiply by 2/k^Delta
-    MPI_Barrier(MPI_COMM_WORLD);
-    nmesh3 = ((unsigned int)Nmesh) * ((unsigned int)Nmesh) * ((unsigned int)Nmesh);
-    for (ii = 0; ii < Local_nx; ii++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k <= Nmesh / 2; k++)
-        {
-          coord = (ii * Nmesh + j) * (Nmesh / 2 + 1) + k;
-          i = ii + Local_x_start;
-
-          // Get knorm
-          if (i < Nmesh / 2)
-            kvec[0] = i * 2 * PI / Box;
-          else
-            kvec[0] = -(Nmesh - i) * 2 * PI / Box;
-
-          if (j < Nmesh / 2)
-            kvec[1] = j * 2 * PI / Box;
-          else
-            kvec[1] = -(Nmesh - j) * 2 * PI / Box;
-
-          if (k < Nmesh / 2)
-            kvec[2] = k * 2 * PI / Box;
-          else
-            kvec[2] = -(Nmesh - k) * 2 * PI / Box;
-
-          kmag = sqrt(kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2]);
-          kmag_Delta_QSFI = pow(kmag, Delta/3.*(4.-PrimordialIndex));
-
-          // Set minimum |k| for numerical stability. 1e-12 should be sufficiently
-          // small since this corresponds to kF for a ____ Gpc box (in units of h/kpc)
-          if (kmag_Delta_QSFI < 1e-12){
-            kmag_Delta_QSFI = 1e-12;
-          }
-          cpsi[coord].re = 2. / kmag_Delta_QSFI * cpsi[coord].re - cpot_sq[coord].re;
-          cpsi[coord].im = 2. / kmag_Delta_QSFI * cpsi[coord].im - cpot_sq[coord].im;
-
-          // Apply high-pass filter
-          // if((kmag * 1000) < Klong_max){
-          //   cpsi[coord].re = 0.;
-          //   cpsi[coord].im = 0.;
-          // }
-
-          cpsi[coord].re *= 0.5*(1 + tanh((kmag*1000 - 0.08) /(0.01) - 1 ));
-          cpsi[coord].im *= 0.5*(1 + tanh((kmag*1000 - 0.08) /(0.01) - 1 ));
-
-          // Normalize from FFT and set zero mode to zero
-          cpsi[coord].re /= (double) nmesh3; 
-          cpsi[coord].im /= (double) nmesh3;
-          if(i == 0 && j == 0 && k == 0){
-            cpsi[0].re=0.;
-            cpsi[0].im=0.;
-            continue;
-          }
-
-        }
+  #pragma omp parallel for collapse(2) private(k, col, coord, kvec, kmag, t_of_k, twb, axes)
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
+    {
+      kspace_column(i, j, &col);
+      kvec[0] = col.kx;
+      kvec[1] = col.ky;
 
-    // Go back to real space and add psi to phi
-    MPI_Barrier(MPI_COMM_WORLD);
-    rfftwnd_mpi(Inverse_plan, 1, psi, Workspace, FFTW_NORMAL_ORDER);
-    
-    MPI_Barrier(MPI_COMM_WORLD);
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k < Nmesh; k++){
-          coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k; 
-          pot[coord] = pot[coord] + Fnl * (psi[coord]); 
+      for (k = 0; k <= Nmesh / 2; k++)
+      {
+        coord = col.coord + k;
+        kvec[2] = Kgrid[k];
 
-    }
-    
-      /* Code to save the linear field */
-    #ifdef OUTPUT_DF
-      if (ThisTask == 0) printf("\nWriting linear field.");
-
-      // Define global potential for I/O. Note that it is Nmesh*Nmesh*(Nmesh+2) because of zero padding!
-      int local_size_pot = Local_nx * Nmesh * (2 * (Nmesh / 2 + 1)); 
-      int nprocs = (Nmesh+1) / Local_nx;
-      pot_global = (fftw_real *)malloc(bytes = nprocs * sizeof(fftw_real) * TotalSizePlusAdditional);
-
-      MPI_Barrier(MPI_COMM_WORLD);
-      MPI_Allgather(pot, local_size_pot, MPI_DOUBLE, pot_global, local_size_pot, MPI_DOUBLE, MPI_COMM_WORLD);
-      if(ThisTask == 0){
-        // Open the file for writing
-        FILE *file = fopen("output_potential.txt", "w");
-        if (file == NULL) {
-            fprintf(stderr, "Error: Could not open output_potential.txt for writing.\n");
-            MPI_Abort(MPI_COMM_WORLD, 1);
-        }
-        for (i = 0; i < Nmesh; i++)
-          for (j = 0; j < Nmesh; j++)
-            for (k = 0; k < Nmesh; k++){
-              coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k;
-              fprintf(file, "i= %d, j= %d, k= %d, pot= %.5e\n", i, j, k, pot_global[coord]); 
-            }
-        fclose(file);
-      }
-      free(pot_global);
-    #endif
+        kmag = sqrt(col.kxy2 + Kgrid2[k]);
 
-    
-    // Go back to Fourier space, remove 1/N^3 factor, and set zero mode to zero
-    MPI_Barrier(MPI_COMM_WORLD);
-    rfftwnd_mpi(Forward_plan, 1, pot, Workspace, FFTW_NORMAL_ORDER);
+        t_of_k = TransferFunc(kmag);
 
-    /* remove the N^3 I got by forwardfurier and put zero to zero mode */
+        twb = t_of_k / Dplus / Beta;
 
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k <= Nmesh / 2; k++)
+        for (axes = 0; axes < 3; axes++)
         {
-          coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
-          // ****************************** DSJ *************************
-          if (SphereMode == 1)
-          {
-            ii = i + Local_x_start;
-
-            if (ii < Nmesh / 2)
-              kvec[0] = ii * 2 * PI / Box;
-            else
-              kvec[0] = -(Nmesh - ii) * 2 * PI / Box;
-
-            if (j < Nmesh / 2)
-              kvec[1] = j * 2 * PI / Box;
-            else
-              kvec[1] = -(Nmesh - j) * 2 * PI / Box;
-
-            if (k < Nmesh / 2)
-              kvec[2] = k * 2 * PI / Box;
-            else
-              kvec[2] = -(Nmesh - k) * 2 * PI / Box;
-
-            kmag = sqrt(kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2]);
-
-            if (kmag * Box / (2 * PI) > Nsample / 2)
-            { /* select a sphere in k-space */
-              cpot[coord].re = 0.;
-              cpot[coord].im = 0.;
-              continue;
-            }
-          }
-          // ****************************** DSJ *************************
-          cpot[coord].re /= (double)nmesh3;
-          cpot[coord].im /= (double)nmesh3;
+          cdisp[axes][coord].im = kvec[axes] * twb * cpot[coord].re;
+          cdisp[axes][coord].re = -kvec[axes] * twb * cpot[coord].im;
         }
-
-    if (ThisTask == 0)
-    {
-      cpot[0].re = 0.;
-      cpot[0].im = 0.;
+      }
     }
 
-    if (ThisTask == 0 ) print_timed_done(1);
-    free(cpsi);
-    free(ckdeltaphi);
-#else
-#ifdef OSC_FNL
   if (ThisTask == 0)
-    {
-      printf("Computing oscillatory bispectra non-Gaussian potential...\n ");
-      fflush(stdout);
-    };
-
+    print_timed_done(1);
+}
 
+/* Displacements of the non-Gaussian potential cpot, which is freed. Returns
+   the maximum 1D displacement on this task. */
+static double png_displacements(fftw_complex *cpot, double Beta)
+{
+  fftw_complex *(cdisp[3]);
+  double dmax, maxdisp = 0;
+  unsigned int bytes;
+  int axes;
 
-     // We never FFT the full fields. We just use it to store the full k-space 
-     // field before splitting into real and imaginary parts
-    ck_Delta_plus_inu_phi_full = (fftw_complex *)malloc(bytes = sizeof(fftw_complex) * TotalSizePlusAdditional);
-    ck_Delta_min_inu_phi_full = (fftw_complex *)malloc(bytes = sizeof(fftw_complex) * TotalSizePlusAdditional);
-    ASSERT_ALLOC(ck_Delta_plus_inu_phi_full);
-    ASSERT_ALLOC(ck_Delta_min_inu_phi_full);
-    
-    // Real and imaginary components of full FFT needed for intermediate steps
-
-    // Plus field
-    ck_Delta_plus_inu_phi_real = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-    k_Delta_plus_inu_phi_real = (fftw_real *)ck_Delta_plus_inu_phi_real;
-    ASSERT_ALLOC(ck_Delta_plus_inu_phi_real);
-
-    ck_Delta_plus_inu_phi_imag = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-    k_Delta_plus_inu_phi_imag = (fftw_real *)ck_Delta_plus_inu_phi_imag;
-    ASSERT_ALLOC(ck_Delta_plus_inu_phi_imag);
-
-    // Minus field
-    ck_Delta_min_inu_phi_real = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-    k_Delta_min_inu_phi_real = (fftw_real *)ck_Delta_min_inu_phi_real;
-    ASSERT_ALLOC(ck_Delta_min_inu_phi_real);
-
-    ck_Delta_min_inu_phi_imag = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-    k_Delta_min_inu_phi_imag = (fftw_real *)ck_Delta_min_inu_phi_imag;
-    ASSERT_ALLOC(ck_Delta_min_inu_phi_imag);
-
-    cpsi = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-    psi = (fftw_real *)cpsi;
-    ASSERT_ALLOC(cpsi);
-
-    cpot_sq = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-    pot_sq = (fftw_real *)cpot_sq;
-    ASSERT_ALLOC(cpot_sq);
-
-    int local_size = Local_nx * Nmesh * (Nmesh / 2 + 1); // Size of local `cpot` chunk
-    int nprocs = (Nmesh+1) / Local_nx;  
-
-        
-    cpot_received = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-    ck_Delta_plus_inu_phi_full_received= (fftw_complex *)malloc(bytes =  sizeof(fftw_complex) * TotalSizePlusAdditional);
-    ck_Delta_min_inu_phi_full_received = (fftw_complex *)malloc(bytes =  sizeof(fftw_complex) * TotalSizePlusAdditional);
-    ASSERT_ALLOC(cpot_received);
-    ASSERT_ALLOC(ck_Delta_plus_inu_phi_full_received);
-    ASSERT_ALLOC(ck_Delta_min_inu_phi_full_received);
-
-    // Clean all arrays
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k=0; k<Nmesh; k++){   //for (k = 0; k <= Nmesh / 2; k++)
+  for (axes = 0, bytes = 0; axes < 3; axes++)
+    cdisp[axes] = (fftw_complex *)fft_malloc(bytes += sizeof(fftw_real) * TotalSizePlusAdditional);
 
-          coord = (i * Nmesh + j) * Nmesh + k;
+  ASSERT_ALLOC(cdisp[0] && cdisp[1] && cdisp[2]);
 
-          ck_Delta_plus_inu_phi_full[coord].re = 0.0;
-          ck_Delta_plus_inu_phi_full[coord].im = 0.0;
-          ck_Delta_min_inu_phi_full[coord].re = 0.0;
-          ck_Delta_min_inu_phi_full[coord].im = 0.0;
+#if defined(MULTICOMPONENTGLASSFILE) && defined(DIFFERENT_TRANSFER_FUNC)
+  for (Type = MinType; Type <= MaxType; Type++)
+#endif
+  {
+    potential_gradient(cpot, cdisp, Beta);
+    fft_free(cpot);
 
-          // Fill entires for real FFT
-          if(k<= Nmesh/2){
-            coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
-            ck_Delta_plus_inu_phi_real[coord].re = 0.0;
-            ck_Delta_plus_inu_phi_real[coord].im = 0.0;
-            ck_Delta_plus_inu_phi_imag[coord].re = 0.0;
-            ck_Delta_plus_inu_phi_imag[coord].im = 0.0;
+    dmax = lpt_displacements(cdisp, NULL);
+    if (dmax > maxdisp)
+      maxdisp = dmax;
+  }
 
-            ck_Delta_min_inu_phi_real[coord].re = 0.0;
-            ck_Delta_min_inu_phi_real[coord].im = 0.0;
-            ck_Delta_min_inu_phi_imag[coord].re = 0.0;
-            ck_Delta_min_inu_phi_imag[coord].im = 0.0;
+  for (axes = 0; axes < 3; axes++)
+    fft_free(cdisp[axes]);
 
-            cpsi[coord].re = 0.0;
-            cpsi[coord].im = 0.0;
+  return maxdisp;
+}
 
-            cpot_sq[coord].re = 0.0;
-            cpot_sq[coord].im = 0.0;
-            }
-          }
+/* Moves the particles by the non-Gaussian potential cpot (which is freed) and
+   writes the snapshot <FileBase><suffix>. With PairedOutput the phase-flipped
+   twin is written as well: flipping the phases negates Phi_G, while the
+   quadratic template term fnl * Psi[Phi_G] keeps its sign, so the twin
+   potential is cpot - 2 cpot_gauss and neither the modes nor the template
+   have to be computed again. */
+static double png_realization(fftw_complex *cpot, fftw_complex *cpot_gauss, float *lagrangian_pos,
+                              double Beta, char *suffix)
+{
+  fftw_complex *(cpot_twin);
+  double dmax, maxdisp;
+  unsigned int bytes;
+  char name[120];
+  int i, n, axes;
 
+  if (!PairedOutput)
+  {
+    maxdisp = png_displacements(cpot, Beta);
+    write_snapshot(suffix);
+    return maxdisp;
+  }
 
-    //MPI_Barrier(MPI_COMM_WORLD);
+  cpot_twin = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+  ASSERT_ALLOC(cpot_twin);
 
-    int partner = nprocs - 1 - ThisTask;
-    MPI_Sendrecv(cpot, local_size, MPI_C_DOUBLE_COMPLEX, partner, 0,
-                 cpot_received, local_size, MPI_C_DOUBLE_COMPLEX, partner, 0,
-                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-           
-    printf("Task %d received cpot from task %d\n", ThisTask, partner);
-    if (ThisTask == 0) printf("-> Gathered cpot from all processes\n");
+  #pragma omp parallel for
+  for (i = 0; i < Kspace_n0 * Kspace_n1 * (Nmesh / 2 + 1); i++)
+  {
+    cpot_twin[i].re = cpot[i].re - 2 * cpot_gauss[i].re;
+    cpot_twin[i].im = cpot[i].im - 2 * cpot_gauss[i].im;
+  }
 
-    // Construct full FFT for k^(Delta+/-i*nu)phi(k) 
-    for (ii = 0; ii < Local_nx; ii++) {
-      for (j = 0; j < Nmesh; j++) {
-        for (k = 0; k < Nmesh; k++) { // Full k range
-          coord = (ii * Nmesh + j) * Nmesh + k; // 3D flattened index
-          i = ii + Local_x_start;
+  maxdisp = png_displacements(cpot, Beta);
+  snprintf(name, sizeof(name), "%s_pf%d", suffix, PhaseFlip);
+  write_snapshot(name);
 
-          // Get kvec components
-          if (i < Nmesh / 2)
-              kvec[0] = i * 2 * PI / Box;
-          else
-              kvec[0] = -(Nmesh - i) * 2 * PI / Box;
+  if (ThisTask == 0)
+  {
+    printf("Phase-flipped twin:\n");
+    fflush(stdout);
+  };
 
-          if (j < Nmesh / 2)
-              kvec[1] = j * 2 * PI / Box;
-          else
-              kvec[1] = -(Nmesh - j) * 2 * M_PI / Box;
+  for (n = 0; n < NumPart; n++)
+    for (axes = 0; axes < 3; axes++)
+      P[n].Pos[axes] = lagrangian_pos[3 * n + axes];
 
-          if (k < Nmesh / 2)
-              kvec[2] = k * 2 * PI / Box;
-          else
-              kvec[2] = -(Nmesh - k) * 2 * PI / Box;
+  dmax = png_displacements(cpot_twin, Beta);
+  if (dmax > maxdisp)
+    maxdisp = dmax;
+  snprintf(name, sizeof(name), "%s_pf%d", suffix, 1 - PhaseFlip);
+  write_snapshot(name);
 
-          // Compute magnitude of k
-          kmag = sqrt(kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2]);
+  return maxdisp;
+}
 
-          // Compute k^{3/2} +/- iNu
+#else
 
-          /* OLD CODE
-          kmag_Delta_plus_inu = cpow(kmag, Delta + I * Nu);
-          kmag_Delta_min_inu  = cpow(kmag, Delta - I * Nu);
-          */
+/* Turns the particle load into its phase-flipped twin. Flipping the phases
+   negates the ZA displacement, while the 2LPT term is even in delta and
+   stays as it is. */
+static void flip_first_order(float *zadisp)
+{
+  double hubble_a, vel_prefac;
+  int n, axes;
 
-         kmag_Delta_plus_inu = cexp(log(kmag) * (Delta + I * Nu)) + 1.e-20;  // Regularize
-         kmag_Delta_min_inu  = cexp(log(kmag) * (Delta - I * Nu)) + 1.e-20;
+  hubble_a = Hubble * sqrt(Omega / pow(InitTime, 3) + (1 - Omega - OmegaLambda) / pow(InitTime, 2) + OmegaLambda);
+  vel_prefac = InitTime * hubble_a * F_Omega(InitTime) / sqrt(InitTime);
 
-          // Store in 3D array
-          if (i == 0 && j == 0 && k == 0){
-            ck_Delta_plus_inu_phi_full[coord].re = 0.0;
-            ck_Delta_plus_inu_phi_full[coord].im = 0.0;
-            ck_Delta_min_inu_phi_full[coord].re = 0.0;
-            ck_Delta_min_inu_phi_full[coord].im = 0.0;
-          }
-          else{
-
-            /*
-            Multiply by phi(k). If k<=Nmesh/2, we can just use the local cpot 
-            array and apply local indexing (i.e use ii). For k>Nmesh/2, things
-            are more subtle because we need to access the Hermitian conjugate
-            from the global_cpot array. We are explicitly using that phi(-k)=
-            phi*(k).
-            */
-            if(k<= Nmesh/2){
-              coord_1d = (ii * Nmesh + j) * (Nmesh / 2 + 1) + k; // Use local index here because we don't need global array
-
-              temp_complex =  (kmag_Delta_plus_inu)*(cpot[coord_1d].re+I*cpot[coord_1d].im);
-              ck_Delta_plus_inu_phi_full[coord].re = creal(temp_complex);
-              ck_Delta_plus_inu_phi_full[coord].im = cimag(temp_complex);
-
-              temp_complex =  (kmag_Delta_min_inu)*(cpot[coord_1d].re+I*cpot[coord_1d].im);
-              ck_Delta_min_inu_phi_full[coord].re  = creal(temp_complex);
-              ck_Delta_min_inu_phi_full[coord].im  = cimag(temp_complex);
-
-            }else{
-
-              // Use fact that phi(-k)=phi*(k) to get phi(k) for k>Nmesh/2
-              i_herm = (Nmesh-i) % Nmesh; // Note we use i instead of ii here bceause we need global index!
-              j_herm = (Nmesh-j) % Nmesh;
-              k_herm = (Nmesh-k) % Nmesh;
-
-              ///* Send and receive code
-              i_herm = i_herm%Local_nx; // (or possibly (Local_nx-i_herm%Local_nx)%Local_nx)
-              coord_1d = (i_herm * Nmesh + j_herm) * (Nmesh / 2 + 1) + k_herm;
-
-              /* OLD CODE
-              if(i_herm==0){
-                // For zero mode we use the local potential array.
-                temp_complex = kmag_Delta_plus_inu*(cpot[coord_1d].re+I*cpot[coord_1d].im);       
-                ck_Delta_plus_inu_phi_full[coord].re = creal(temp_complex);
-                ck_Delta_plus_inu_phi_full[coord].im = -cimag(temp_complex); // Note the minus for complex conjugate
-
-                temp_complex =  kmag_Delta_min_inu*(cpot[coord_1d].re+I*cpot[coord_1d].im);
-                ck_Delta_min_inu_phi_full[coord].re  = creal(temp_complex);
-                ck_Delta_min_inu_phi_full[coord].im  = -cimag(temp_complex); // Note the minus for complex conjugate 
-              } else{
-
-                temp_complex = kmag_Delta_plus_inu*(cpot_received[coord_1d].re+I*cpot_received[coord_1d].im);       
-                ck_Delta_plus_inu_phi_full[coord].re = creal(temp_complex);
-                ck_Delta_plus_inu_phi_full[coord].im = -cimag(temp_complex); // Note the minus for complex conjugate
-
-                temp_complex =  kmag_Delta_min_inu*(cpot_received[coord_1d].re+I*cpot_received[coord_1d].im);
-                ck_Delta_min_inu_phi_full[coord].re  = creal(temp_complex);
-                ck_Delta_min_inu_phi_full[coord].im  = -cimag(temp_complex); // Note the minus for complex conjugate 
-              }*/
-
-              // NEW CODE. TRY ONLY TAKING CC OF CPOT INSTEAD OF FULL ARRAY
-              if(i_herm==0){
-                // For zero mode we use the local potential array.
-                temp_complex = kmag_Delta_plus_inu*(cpot[coord_1d].re-I*cpot[coord_1d].im);       
-                ck_Delta_plus_inu_phi_full[coord].re = creal(temp_complex);
-                ck_Delta_plus_inu_phi_full[coord].im = cimag(temp_complex); 
-
-                temp_complex =  kmag_Delta_min_inu*(cpot[coord_1d].re-I*cpot[coord_1d].im);
-                ck_Delta_min_inu_phi_full[coord].re  = creal(temp_complex);
-                ck_Delta_min_inu_phi_full[coord].im  = cimag(temp_complex); 
-              } else{
-
-                temp_complex = kmag_Delta_plus_inu*(cpot_received[coord_1d].re-I*cpot_received[coord_1d].im);       
-                ck_Delta_plus_inu_phi_full[coord].re = creal(temp_complex);
-                ck_Delta_plus_inu_phi_full[coord].im = cimag(temp_complex); // Note the minus for complex conjugate
-
-                temp_complex =  kmag_Delta_min_inu*(cpot_received[coord_1d].re-I*cpot_received[coord_1d].im);
-                ck_Delta_min_inu_phi_full[coord].re  = creal(temp_complex);
-                ck_Delta_min_inu_phi_full[coord].im  = cimag(temp_complex); // Note the minus for complex conjugate 
-              }
-            }
-          }
-        }
-      }
+  #pragma omp parallel for private(axes)
+  for (n = 0; n < NumPart; n++)
+    for (axes = 0; axes < 3; axes++)
+    {
+      P[n].Pos[axes] = periodic_wrap(P[n].Pos[axes] - 2 * zadisp[3 * n + axes]);
+      P[n].Vel[axes] -= 2 * zadisp[3 * n + axes] * vel_prefac;
     }
+}
+#endif
 
-    // Convert full FFT the outputs of two real FFTs. The following code takes
-    // an NMesh^3 dimensional complex FFT (in Fourier) space, called Input,
-    // and splits it into two Nmesh*Nmesh*(NMesh//2+1) dimensional real FFTs 
-    // (in Fourier space), corresponding to FFT[Re[IFFT[Input]]] and FFT[Im[IFFT[Input]]]
+/* Writes the particle data to <FileBase><suffix> */
+static void write_snapshot(char *suffix)
+{
+  char filebase[100];
 
-    // Gather `ck_Delta_plus_inu_phi_full` and `ck_Delta_min_inu_phi_full` from all processes
-    if (ThisTask == 0){
-      printf("-> Freeing global potential and gathering global phi^Delta_+/- arrays...\n");
-      fflush(stdout);
-    }
+  strcpy(filebase, FileBase);
+  snprintf(FileBase, sizeof(FileBase), "%s%s", filebase, suffix);
 
-    MPI_Barrier(MPI_COMM_WORLD);
-    free(cpot_received);
+  if (ThisTask == 0)
+  {
+    printf("Writing initial conditions snapshot...");
+    fflush(stdout);
+  };
+  write_particle_data();
+  if (ThisTask == 0)
+    print_timed_done(10);
 
-    local_size = Local_nx * Nmesh * Nmesh; // Size for complex FFT
-    MPI_Sendrecv(ck_Delta_plus_inu_phi_full, local_size, MPI_C_DOUBLE_COMPLEX, partner, 0,
-                 ck_Delta_plus_inu_phi_full_received, local_size, MPI_C_DOUBLE_COMPLEX, partner, 0,
-                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-    MPI_Sendrecv(ck_Delta_min_inu_phi_full, local_size, MPI_C_DOUBLE_COMPLEX, partner, 0,
-                 ck_Delta_min_inu_phi_full_received, local_size, MPI_C_DOUBLE_COMPLEX, partner, 0,
-                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  strcpy(FileBase, filebase);
+}
 
+/* Appends the ghost cells the CIC readout needs to real-space fields: a row
+   y = Local_y_start + Local_ny taken from the neighbour along y, and then a
+   plane x = Local_x_start + Local_nx (ghost row included) taken from the
+   neighbour along x. The planes are restrided in place to Local_ny + 1 rows,
+   which is what TotalSizePlusAdditional makes room for.
+
+   The ghost rows are in place on return, the ghost planes are only posted:
+   the fields can be read, and particles whose stencil stays clear of the
+   ghost plane (all but the last local plane, see cell_order()) can be read out, before
+   finish_ghost_exchange() waits for them. Fields posted one after the other
+   into the same ghost_exchange are waited for together.
+
+   With LATTICE_LOAD the particles are read at the nodes, which need no ghost
+   cells: the fields are left as they are. */
+static void post_ghost_exchange(struct ghost_exchange *gx, fftw_real **fields, int n)
+{
+  MPI_Request *request;
+  MPI_Datatype rows;
+  int f, i, rowlen, planelen, sendTask, recvTask;
 
-    
-    if (ThisTask == 0){
-      printf("-> Splitting full FFT into real FFTs...\n");
-      fflush(stdout);
-    }
-    for (ii = 0; ii < Local_nx; ii++) {
-      for (j = 0; j < Nmesh; j++) {
-        for (k = 0; k <= Nmesh / 2; k++) {
-          /*
-          Some notes:
-            * Need to use the full index for the ck_Delta_plus_inu_full array
-            * Will need a different index when assigning ck_Delta_plus_inu_phi_real
-            * i = ii + Local_x_start; Don't need this for now. ii is the relevant one for indexing?
-            * Parallelization could be an issue here because the indices are split over multiple threads.
-            * Understand why cimag(temp_real) and cimag(temp_imag) are zero.
-          */
-          
-          // Coord_1d is for assignemnt to ck_Delta_+/-_inu_phi_real and ck_Delta_+/-_inu_phi_imag
-          coord_1d = (ii * Nmesh + j) * (Nmesh / 2 + 1) + k;
-
-          // Get 1D index for hermitian conjugate
-          i = ii + Local_x_start;
-          i_herm = (Nmesh-i) % Nmesh;
-          j_herm = (Nmesh-j) % Nmesh;
-          k_herm = (Nmesh-k) % Nmesh;
-
-          coord = (ii * Nmesh + j) * Nmesh+k; // Use local index when accessing ck_..._full
-          
-
-          
-          /*
-          * Split k^(Delta+iNu)phi(k)
-          */
-          temp_ck_coord = ck_Delta_plus_inu_phi_full[coord].re+I*ck_Delta_plus_inu_phi_full[coord].im;
-
-          i_herm = i_herm%Local_nx; 
-          coord_herm = (i_herm * Nmesh + j_herm) * Nmesh + k_herm;
-
-          if(i_herm==0){
-            temp_ck_herm  = ck_Delta_plus_inu_phi_full[coord_herm].re-I*ck_Delta_plus_inu_phi_full[coord_herm].im;
-          } else{
-            temp_ck_herm  = ck_Delta_plus_inu_phi_full_received[coord_herm].re-I*ck_Delta_plus_inu_phi_full_received[coord_herm].im; // Conjugate transpose
-          }
+#ifdef LATTICE_LOAD
+  return;
+#endif
 
-          temp_real = 0.5*(temp_ck_coord+temp_ck_herm);
-          temp_imag = -0.5*I*(temp_ck_coord-temp_ck_herm);
+  rowlen = 2 * (Nmesh / 2 + 1);
+  planelen = (Local_ny + 1) * rowlen;
 
-          // Compute RFFT index and assign values
-          ck_Delta_plus_inu_phi_real[coord_1d].re = creal(temp_real);
-          ck_Delta_plus_inu_phi_real[coord_1d].im = cimag(temp_real);
-          ck_Delta_plus_inu_phi_imag[coord_1d].re = creal(temp_imag);
-          ck_Delta_plus_inu_phi_imag[coord_1d].im = cimag(temp_imag); 
+  for (f = 0; f < n; f++)
+    for (i = Local_nx - 1; i > 0; i--)
+      memmove(&fields[f][i * planelen], &fields[f][i * Local_ny * rowlen], sizeof(fftw_real) * Local_ny * rowlen);
 
-          /*
-          * Split k^(Delta-iNu)phi(k)
-          */ 
+  if (NTaskY == 1)
+  {
+    for (f = 0; f < n; f++)
+      for (i = 0; i < Local_nx; i++)
+        memcpy(&fields[f][i * planelen + Local_ny * rowlen], &fields[f][i * planelen], sizeof(fftw_real) * rowlen);
+  }
+  else
+  {
+    /* send our first row of every plane down, receive the ghost rows from above;
+       the ghost planes carry them on, so these have to be in before */
+    sendTask = ThisTask - ThisTask % NTaskY + (ThisTask % NTaskY + NTaskY - 1) % NTaskY;
+    recvTask = ThisTask - ThisTask % NTaskY + (ThisTask % NTaskY + 1) % NTaskY;
 
-          temp_ck_coord = ck_Delta_min_inu_phi_full[coord].re+I*ck_Delta_min_inu_phi_full[coord].im;
+    MPI_Type_vector(Local_nx, sizeof(fftw_real) * rowlen, sizeof(fftw_real) * planelen, MPI_BYTE, &rows);
+    MPI_Type_commit(&rows);
 
-          if(i_herm==0){
-            // For zero mode we use the local ck_Delta_plus_inu_phi_full array.
-            temp_ck_herm  = ck_Delta_min_inu_phi_full[coord_herm].re-I*ck_Delta_min_inu_phi_full[coord_herm].im; // Conjugate transpose
-          } else{
-            temp_ck_herm  = ck_Delta_min_inu_phi_full_received[coord_herm].re-I*ck_Delta_min_inu_phi_full_received[coord_herm].im; // Conjugate transpose
-          }
+    request = malloc(sizeof(MPI_Request) * 2 * n);
+    for (f = 0; f < n; f++)
+    {
+      MPI_Irecv(&fields[f][Local_ny * rowlen], 1, rows, recvTask, 11, MPI_COMM_WORLD, &request[2 * f]);
+      MPI_Isend(&fields[f][0], 1, rows, sendTask, 11, MPI_COMM_WORLD, &request[2 * f + 1]);
+    }
+    MPI_Waitall(2 * n, request, MPI_STATUSES_IGNORE);
+    free(request);
 
-          temp_real = 0.5*(temp_ck_coord+temp_ck_herm);
-          temp_imag = -0.5*I*(temp_ck_coord-temp_ck_herm);
+    MPI_Type_free(&rows);
+  }
 
-          // Compute RFFT index and assign values
-          ck_Delta_min_inu_phi_real[coord_1d].re = creal(temp_real);
-          ck_Delta_min_inu_phi_real[coord_1d].im = cimag(temp_real);
-          ck_Delta_min_inu_phi_imag[coord_1d].re = creal(temp_imag);
-          ck_Delta_min_inu_phi_imag[coord_1d].im = cimag(temp_imag); 
-        }
+  /* now get the plane on the right side from the neighbour on the right,
+     and send the left plane */
+  if (Local_nx > 0)
+    for (f = 0; f < n; f++)
+    {
+      if (gx->nreq + 2 > 2 * MAXGHOSTFIELDS)
+      {
+        printf("more than %d fields in one ghost exchange\n", MAXGHOSTFIELDS);
+        FatalError(12);
       }
+      MPI_Irecv(&fields[f][Local_nx * planelen], sizeof(fftw_real) * planelen, MPI_BYTE, Right_task, 10,
+                MPI_COMM_WORLD, &gx->request[gx->nreq++]);
+      MPI_Isend(&fields[f][0], sizeof(fftw_real) * planelen, MPI_BYTE, Left_task, 10, MPI_COMM_WORLD,
+                &gx->request[gx->nreq++]);
     }
+}
 
-    if (ThisTask == 0){
-      printf("-> Freeing global phi^Delta_+/- arrays and computing FFTS...\n");
-      fflush(stdout);
-    }
-
-    // Go back to real space
-    MPI_Barrier(MPI_COMM_WORLD);
-
-    if (ThisTask == 0){
-      printf("-> Local freed...\n");
-      fflush(stdout);
-    }
+static void finish_ghost_exchange(struct ghost_exchange *gx)
+{
+  MPI_Waitall(gx->nreq, gx->request, MPI_STATUSES_IGNORE);
+  gx->nreq = 0;
+}
 
-    free(ck_Delta_plus_inu_phi_full);
-    ck_Delta_plus_inu_phi_full = NULL;
+#ifdef OUTPUT_PK
+/* Writes the binned power spectrum of the ZA density contrast -div(disp) of
+   the realization about to be displaced, to measuredspec_<FileBase>_<n>.txt,
+   n counting the realizations of the run. Bins are one fundamental mode
+   wide; the sums are in double whatever the grid precision, so the files of
+   a SINGLE_PRECISION and a double build of the same run can be compared
+   directly. */
+static void measure_spectrum(fftw_complex *cdisp[3])
+{
+  static int count = 0;
+  int i, j, k, b, nbins, coord;
+  double kf, kmag, delta_re, delta_im, w;
+  double *sum, *ksum, *modes;
+  struct kcolumn col;
+  char buf[1000];
+  FILE *fd;
 
-    free(ck_Delta_min_inu_phi_full);
-    ck_Delta_min_inu_phi_full = NULL; 
+  kf = 2 * PI / Box;
+  nbins = (int)(sqrt(3.0) * Nmesh / 2) + 2;
 
-    free(ck_Delta_plus_inu_phi_full_received);
-    ck_Delta_plus_inu_phi_full_received = NULL;
+  sum = calloc(3 * nbins, sizeof(double));
+  ksum = sum + nbins;
+  modes = sum + 2 * nbins;
 
-    free(ck_Delta_min_inu_phi_full_received);
-    ck_Delta_min_inu_phi_full_received = NULL;
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
+    {
+      kspace_column(i, j, &col);
 
-    
-    if (ThisTask == 0){
-      printf("-> Global freed...\n");
-      fflush(stdout);
-    }
+      for (k = 0; k <= Nmesh / 2; k++)
+      {
+        coord = col.coord + k;
+        kmag = sqrt(col.kxy2 + Kgrid2[k]);
+        if (kmag == 0)
+          continue;
 
-    MPI_Barrier(MPI_COMM_WORLD);
-    rfftwnd_mpi(Inverse_plan, 1, pot, Workspace, FFTW_NORMAL_ORDER);
-    rfftwnd_mpi(Inverse_plan, 1, k_Delta_plus_inu_phi_real, Workspace, FFTW_NORMAL_ORDER);
-    rfftwnd_mpi(Inverse_plan, 1, k_Delta_plus_inu_phi_imag, Workspace, FFTW_NORMAL_ORDER);
-    rfftwnd_mpi(Inverse_plan, 1, k_Delta_min_inu_phi_real, Workspace, FFTW_NORMAL_ORDER);
-    rfftwnd_mpi(Inverse_plan, 1, k_Delta_min_inu_phi_imag, Workspace, FFTW_NORMAL_ORDER);
+        delta_re = -(cdisp[0][coord].im * col.kx + cdisp[1][coord].im * col.ky + cdisp[2][coord].im * Kgrid[k]);
+        delta_im = cdisp[0][coord].re * col.kx + cdisp[1][coord].re * col.ky + cdisp[2][coord].re * Kgrid[k];
 
+        /* the modes with 0 < k < Nmesh/2 stand for their conjugates as well */
+        w = (k > 0 && k < Nmesh / 2) ? 2 : 1;
 
-    if (ThisTask == 0){
-      printf("-> Constructing Phi(x) field..\n");
-      fflush(stdout);
+        b = (int)(kmag / kf + 0.5);
+        sum[b] += w * (delta_re * delta_re + delta_im * delta_im);
+        ksum[b] += w * kmag;
+        modes[b] += w;
+      }
     }
 
+  MPI_Allreduce(MPI_IN_PLACE, sum, 3 * nbins, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
 
-    // Multiply fields by phi(x) in real space. Should probably introduce a 
-    // different variable name here, but saving memory by just replacing entries
-    MPI_Barrier(MPI_COMM_WORLD);
-
-    /* Compute real space product for psi */
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k < Nmesh; k++)
-        {
-          coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k;
-          /* 
-          Following line computes psi(x)=phi_g(x)*F(k^(Delta+/-inu)Phi_g)[x]
-          */
-  
-          k_Delta_plus_inu_phi_real[coord] *= pot[coord];
-          k_Delta_plus_inu_phi_imag[coord] *= pot[coord];
-          k_Delta_min_inu_phi_real[coord]  *= pot[coord];
-          k_Delta_min_inu_phi_imag[coord]  *= pot[coord];
-          pot_sq[coord] = pot[coord]*pot[coord]; 
-        }
-
-    if (ThisTask == 0){
-      printf("-> Going back to Fourier space..\n");
-      fflush(stdout);
-    }
+  if (ThisTask == 0)
+  {
+    sprintf(buf, "%s/measuredspec_%s_%d.txt", OutputDir, FileBase, count);
 
-    // Fourier transform back to Fourier space
-    MPI_Barrier(MPI_COMM_WORLD);
-    rfftwnd_mpi(Forward_plan, 1, k_Delta_plus_inu_phi_real, Workspace, FFTW_NORMAL_ORDER);
-    rfftwnd_mpi(Forward_plan, 1, k_Delta_plus_inu_phi_imag, Workspace, FFTW_NORMAL_ORDER);
-    rfftwnd_mpi(Forward_plan, 1, k_Delta_min_inu_phi_real, Workspace, FFTW_NORMAL_ORDER);
-    rfftwnd_mpi(Forward_plan, 1, k_Delta_min_inu_phi_imag, Workspace, FFTW_NORMAL_ORDER);
-    rfftwnd_mpi(Forward_plan, 1, pot_sq, Workspace, FFTW_NORMAL_ORDER);
-
-    if (ThisTask == 0){
-      printf("-> Constructing Psi(x) field..\n");
-      fflush(stdout);
+    if (!(fd = fopen(buf, "w")))
+    {
+      printf("can't open file `%s`\n", buf);
+      FatalError(25);
     }
 
+    for (b = 1; b < nbins; b++)
+      if (modes[b] > 0)
+        fprintf(fd, "%12.6g %14.8g %10.0f\n", ksum[b] / modes[b], pow(Box, 3) * sum[b] / modes[b], modes[b]);
 
-    /*
-    Construct psi fields
-    */
-    nmesh3 = ((unsigned int)Nmesh) * ((unsigned int)Nmesh) * ((unsigned int)Nmesh);
-    for (ii = 0; ii < Local_nx; ii++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k <= Nmesh / 2; k++)
-        {
-          coord = (ii * Nmesh + j) * (Nmesh / 2 + 1) + k;
-          i = ii + Local_x_start;
-
-          // Get knorm
-          if (i < Nmesh / 2)
-            kvec[0] = i * 2 * PI / Box;
-          else
-            kvec[0] = -(Nmesh - i) * 2 * PI / Box;
+    fclose(fd);
+  }
 
-          if (j < Nmesh / 2)
-            kvec[1] = j * 2 * PI / Box;
-          else
-            kvec[1] = -(Nmesh - j) * 2 * PI / Box;
+  count++;
+  free(sum);
+}
+#endif
 
-          if (k < Nmesh / 2)
-            kvec[2] = k * 2 * PI / Box;
-          else
-            kvec[2] = -(Nmesh - k) * 2 * PI / Box;
-
-          kmag = sqrt(kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2]);
-
-          // Compute k^{3/2} +/- iNu
-          /* OLD CODE
-          kmag_Delta_plus_inu = cpow(kmag, Delta + I * Nu);
-          kmag_Delta_min_inu  = cpow(kmag, Delta - I * Nu);
-          */
-
-         kmag_Delta_plus_inu = cexp(log(kmag) * (Delta + I * Nu)) + 1.e-20;  // Regularize
-         kmag_Delta_min_inu  = cexp(log(kmag) * (Delta - I * Nu)) + 1.e-20;
-
-
-          // Compute exp(+\- phase)
-          exp_plus_iphase = cexp(I * Phase);
-          exp_min_iphase = cexp(-I * Phase);
-          
-          // Check this. It is just supposed to be the sum of the two FFTs (accounting for I) divided by k^plus
-          temp_cpsi_plus = (ck_Delta_plus_inu_phi_real[coord].re+I*ck_Delta_plus_inu_phi_real[coord].im+
-                                           I * (ck_Delta_plus_inu_phi_imag[coord].re+I*ck_Delta_plus_inu_phi_imag[coord].im))/kmag_Delta_plus_inu;
-
-          temp_cpsi_min = (ck_Delta_min_inu_phi_real[coord].re+I*ck_Delta_min_inu_phi_real[coord].im+
-                                           I * (ck_Delta_min_inu_phi_imag[coord].re+I*ck_Delta_min_inu_phi_imag[coord].im))/kmag_Delta_min_inu;
-          
-          // Subtract off 0.5 phi^2(x) and multiply by phase
-          temp_cpsi_plus -= 0.5*(cpot_sq[coord].re+I*cpot_sq[coord].im);
-          temp_cpsi_min  -= 0.5*(cpot_sq[coord].re+I*cpot_sq[coord].im);
-          temp_cpsi_plus *= exp_plus_iphase;
-          temp_cpsi_min  *= exp_min_iphase;
-
-          // Set final psi array
-          cpsi[coord].re = creal(temp_cpsi_plus)+creal(temp_cpsi_min);
-          cpsi[coord].im = cimag(temp_cpsi_plus)+cimag(temp_cpsi_min);
-
-
-          // // Set minimum |k| for numerical stability. 1e-12 should be sufficiently
-          // // small since this corresponds to kF for a ____ Gpc box (in units of h/kpc)
-          // if (kmag_Delta_QSFI < 1e-12){
-          //   kmag_Delta_QSFI = 1e-12;
-          // }
-
-          // // Apply high-pass filter (in h/Mpc)
-          // if((kmag * 1000) < Klong_max){
-          //   // Print filtering
-          //   // if (ThisTask == 0){
-          //   //   printf("Filtering k=(%d, %d, %d) with kmag=%.2e\n", i, j, k, kmag*1000);
-          //   //   fflush(stdout);  
-          //   // }
-          //   cpsi[coord].re = 0.;
-          //   cpsi[coord].im = 0.;
-          // }
-
-
-          cpsi[coord].re *= 0.5*(1 + tanh((kmag*1000 - 0.08) /(0.01) - 1 ));
-          cpsi[coord].im *= 0.5*(1 + tanh((kmag*1000 - 0.08) /(0.01) - 1 ));
-
-          // Normalize from FFT and set zero mode to zero
-          cpsi[coord].re /= (double) nmesh3; 
-          cpsi[coord].im /= (double) nmesh3;
-          if(i == 0 && j == 0 && k == 0){
-            cpsi[0].re=0.;
-            cpsi[0].im=0.;
-            continue;
-          }
+#ifdef LATTICE_LOAD
+#define CIC_CORNERS 1
 
-        }
+/* a lattice particle sits on a node (see read_lattice()): the offset of that
+   node in a field without ghost cells, whose value is read as it is */
+static void cic_stencil(int n, int cell[8], double f[8])
+{
+  int i, j, k;
 
-    if (ThisTask == 0){
-      printf("-> Constructing Phi_NG(x)=Phi_g(x)+fNL*Psi(x)..\n");
-      fflush(stdout);
-    }
+  i = (int)floor(P[n].Pos[0] / Box * Nmesh + 0.5) - Local_x_start;
+  j = (int)floor(P[n].Pos[1] / Box * Nmesh + 0.5) - Local_y_start;
+  k = (int)floor(P[n].Pos[2] / Box * Nmesh + 0.5);
 
-    // Go back to real space and add psi to phi
-    MPI_Barrier(MPI_COMM_WORLD);
-    rfftwnd_mpi(Inverse_plan, 1, psi, Workspace, FFTW_NORMAL_ORDER);
-    
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k < Nmesh; k++){
-          coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k; 
-          pot[coord] = pot[coord] + Fnl * (psi[coord]); 
+  cell[0] = (i * Local_ny + j) * (2 * (Nmesh / 2 + 1)) + k;
+  f[0] = 1;
+}
 
-    }
+/* read_lattice() lays the particles out node by node, the order to read them
+   in, and no node is in a ghost plane: all of them can be read at once */
+static int *cell_order(int *ninner, int *nread)
+{
+  int *order, n;
+  size_t bytes;
 
-    if (ThisTask == 0){
-      printf("-> Freeing arrays..\n");
-      fflush(stdout);
-    }
+  order = malloc(bytes = sizeof(int) * NumPart + 1);
+  ASSERT_ALLOC(order);
 
-    free(ck_Delta_plus_inu_phi_real);
-    free(ck_Delta_plus_inu_phi_imag);
-    free(ck_Delta_min_inu_phi_real);
-    free(ck_Delta_min_inu_phi_imag);
-    
+  for (n = 0; n < NumPart; n++)
+    order[n] = n;
 
-    /* Code to save the linear field */
-    #ifdef OUTPUT_DF
-      if (ThisTask == 0) printf("\nWriting linear field.");
-
-      // Define global potential for I/O. Note that it is Nmesh*Nmesh*(Nmesh+2) because of zero padding!
-      int local_size_pot = Local_nx * Nmesh * (2 * (Nmesh / 2 + 1)); 
-      pot_global = (fftw_real *)malloc(bytes = nprocs * sizeof(fftw_real) * TotalSizePlusAdditional);
-
-      MPI_Barrier(MPI_COMM_WORLD);
-      MPI_Allgather(pot, local_size_pot, MPI_DOUBLE, pot_global, local_size_pot, MPI_DOUBLE, MPI_COMM_WORLD);
-      if(ThisTask == 0){
-        // Open the file for writing
-        FILE *file = fopen("output_potential.txt", "w");
-        if (file == NULL) {
-            fprintf(stderr, "Error: Could not open output_potential.txt for writing.\n");
-            MPI_Abort(MPI_COMM_WORLD, 1);
-        }
-        for (i = 0; i < Nmesh; i++)
-          for (j = 0; j < Nmesh; j++)
-            for (k = 0; k < Nmesh; k++){
-              coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k;
-              fprintf(file, "i= %d, j= %d, k= %d, pot= %.5e\n", i, j, k, pot_global[coord]); 
-            }
-        fclose(file);
-      }
-      free(pot_global);
-    #endif
+  *ninner = *nread = NumPart;
 
-    if (ThisTask == 0){
-      printf("-> Going back to Fourier space and finalizing output..\n");
-      fflush(stdout);
-    }
+  return order;
+}
 
-    // Go back to Fourier space, remove 1/N^3 factor, and set zero mode to zero
-    MPI_Barrier(MPI_COMM_WORLD);
-    rfftwnd_mpi(Forward_plan, 1, pot, Workspace, FFTW_NORMAL_ORDER);
+#else
+#define CIC_CORNERS 8
 
-    /* remove the N^3 I got by forwardfurier and put zero to zero mode */
+/* CIC cell of particle n, local in x and y, and the offsets of the particle in it */
+static void cell_column(int n, int *i, int *j, int *k, double *u, double *v, double *w)
+{
+  *u = P[n].Pos[0] / Box * Nmesh;
+  *v = P[n].Pos[1] / Box * Nmesh;
+  *w = P[n].Pos[2] / Box * Nmesh;
+
+  *i = (int)*u;
+  *j = (int)*v;
+  *k = (int)*w;
+
+  if (*i == (Local_x_start + Local_nx))
+    *i = (Local_x_start + Local_nx) - 1;
+  if (*i < Local_x_start)
+    *i = Local_x_start;
+  if (*j == (Local_y_start + Local_ny))
+    *j = (Local_y_start + Local_ny) - 1;
+  if (*j < Local_y_start)
+    *j = Local_y_start;
+  if (*k == Nmesh)
+    *k = Nmesh - 1;
+
+  *u -= *i;
+  *v -= *j;
+  *w -= *k;
+
+  *i -= Local_x_start;
+  *j -= Local_y_start;
+}
 
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k <= Nmesh / 2; k++)
-        {
-          coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
-          // ****************************** DSJ *************************
-          if (SphereMode == 1)
-          {
-            ii = i + Local_x_start;
+/* offsets of the eight CIC corners of particle n in a field with ghost cells
+   (see post_ghost_exchange), and their weights */
+static void cic_stencil(int n, int cell[8], double f[8])
+{
+  int i, j, k, ii, jj, kk, m, rowlen, planelen;
+  double u, v, w, wx[2], wy[2], wz[2];
+
+  cell_column(n, &i, &j, &k, &u, &v, &w);
+
+  ii = i + 1;
+  jj = j + 1; /* the ghost row, so no wrapping */
+  kk = k + 1;
+
+  if (kk >= Nmesh)
+    kk -= Nmesh;
+
+  rowlen = 2 * (Nmesh / 2 + 1);
+  planelen = (Local_ny + 1) * rowlen;
+
+  cell[0] = i * planelen + j * rowlen + k;
+  cell[1] = i * planelen + j * rowlen + kk;
+  cell[2] = i * planelen + jj * rowlen + k;
+  cell[3] = i * planelen + jj * rowlen + kk;
+  cell[4] = ii * planelen + j * rowlen + k;
+  cell[5] = ii * planelen + j * rowlen + kk;
+  cell[6] = ii * planelen + jj * rowlen + k;
+  cell[7] = ii * planelen + jj * rowlen + kk;
+
+  /* f[m] = wx * wy * wz over the corners, a branch-free loop the compiler can vectorize */
+  wx[0] = 1 - u;
+  wx[1] = u;
+  wy[0] = 1 - v;
+  wy[1] = v;
+  wz[0] = 1 - w;
+  wz[1] = w;
+  for (m = 0; m < 8; m++)
+    f[m] = wx[m >> 2] * wy[(m >> 1) & 1] * wz[m & 1];
+}
 
-            if (ii < Nmesh / 2)
-              kvec[0] = ii * 2 * PI / Box;
-            else
-              kvec[0] = -(Nmesh - ii) * 2 * PI / Box;
+/* The particles to read out, in the order of the blocks of READOUT_BLOCK^3
+   cells their CIC cells fall in (a stable counting sort, so glass order
+   within a block), for the readout to work through the fields block by block.
+   P itself keeps its order for the output. A glass tile that spans no more
+   than READOUT_TILE cells is already compact enough that glass order reads
+   the fields from cache, and the indirection would cost more than it saves;
+   the particles are then left in glass order. Either way, the particles of
+   the last plane, whose stencils reach into the ghost plane, come last:
+   order[0..*ninner-1] can be read before the ghost exchange is finished,
+   order[*ninner..*nread-1] only after. */
+static int *cell_order(int *ninner, int *nread)
+{
+  int *order, *start, n, c, b, nbx, nby, nbz, nblock, i, j, k;
+  double u, v, w;
+  size_t bytes;
 
-            if (j < Nmesh / 2)
-              kvec[1] = j * 2 * PI / Box;
-            else
-              kvec[1] = -(Nmesh - j) * 2 * PI / Box;
+  b = (Nmesh / GlassTileFac > READOUT_TILE) ? READOUT_BLOCK : Nmesh;
 
-            if (k < Nmesh / 2)
-              kvec[2] = k * 2 * PI / Box;
-            else
-              kvec[2] = -(Nmesh - k) * 2 * PI / Box;
+  nbx = (Local_nx - 1 + b - 1) / b; /* the last plane is a block row of its own */
+  nby = (Local_ny + b - 1) / b;
+  nbz = (Nmesh + b - 1) / b;
+  nblock = (nbx + 1) * nby * nbz;
 
-            kmag = sqrt(kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2]);
+  start = malloc(bytes = sizeof(int) * (nblock + 1));
+  ASSERT_ALLOC(start);
+  memset(start, 0, bytes);
 
-            if (kmag * Box / (2 * PI) > Nsample / 2)
-            { /* select a sphere in k-space */
-              cpot[coord].re = 0.;
-              cpot[coord].im = 0.;
-              continue;
-            }
-          }
-          // ****************************** DSJ *************************
-          cpot[coord].re /= (double)nmesh3;
-          cpot[coord].im /= (double)nmesh3;
-        }
-    
+  order = malloc(bytes = sizeof(int) * NumPart + 1);
+  ASSERT_ALLOC(order);
 
-    if (ThisTask == 0)
+  for (n = 0; n < NumPart; n++)
+  {
+#if defined(MULTICOMPONENTGLASSFILE) && defined(DIFFERENT_TRANSFER_FUNC)
+    if (P[n].Type == Type)
+#endif
     {
-      cpot[0].re = 0.;
-      cpot[0].im = 0.;
+      cell_column(n, &i, &j, &k, &u, &v, &w);
+      i = (i == Local_nx - 1) ? nbx : i / b;
+      start[(i * nby + j / b) * nbz + k / b + 1]++;
     }
+  }
 
-    if (ThisTask == 0 ) print_timed_done(1);
-
-
-
-
+  for (c = 0; c < nblock; c++)
+    start[c + 1] += start[c];
 
-#else
-// ********************** Collider Addition (End) ****************************
-#ifdef EQUIL_FNL
-  if (ThisTask == 0)
-  {
-    printf("Computing equilateral non-Gaussian potential...");
-    fflush(stdout);
-  };
-#endif
-#ifdef ORTOG_FNL
-  if (ThisTask == 0)
-  {
-    printf("Computing orthogonal non-Gaussian potential... ");
-    fflush(stdout);
-  };
-#endif
+  *ninner = start[nbx * nby * nbz];
+  *nread = start[nblock];
 
-// ****  wrc ****
-#ifdef ORTOG_LSS_FNL
-  if (ThisTask == 0)
+  for (n = 0; n < NumPart; n++)
   {
-    printf("Computing orthogonal-LSS non-Gaussian potential... ");
-    fflush(stdout);
-  };
+#if defined(MULTICOMPONENTGLASSFILE) && defined(DIFFERENT_TRANSFER_FUNC)
+    if (P[n].Type == Type)
 #endif
+    {
+      cell_column(n, &i, &j, &k, &u, &v, &w);
+      i = (i == Local_nx - 1) ? nbx : i / b;
+      order[start[(i * nby + j / b) * nbz + k / b]++] = n;
+    }
+  }
 
-  // ****  wrc ****
-  /**** NON-LOCAL PRIMORDIAL POTENTIAL **************/
-
-  /* allocate partpotential */
-
-  cpartpot = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-  partpot = (fftw_real *)cpartpot;
-  ASSERT_ALLOC(cpartpot);
-
-  cp1p2p3sym = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-  p1p2p3sym = (fftw_real *)cp1p2p3sym;
-  ASSERT_ALLOC(cp1p2p3sym);
-
-  cp1p2p3sca = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-  p1p2p3sca = (fftw_real *)cp1p2p3sca;
-  ASSERT_ALLOC(cp1p2p3sca);
+  free(start);
 
-  cp1p2p3nab = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-  p1p2p3nab = (fftw_real *)cp1p2p3nab;
-  ASSERT_ALLOC(cp1p2p3nab);
+  return order;
+}
+#endif
 
-  cp1p2p3tre = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-  p1p2p3tre = (fftw_real *)cp1p2p3tre;
-  ASSERT_ALLOC(cp1p2p3tre);
+static double cic_sum(fftw_real *field, int cell[8], double f[8])
+{
+  double sum = 0;
+  int m;
 
-// ****  wrc ****
-#ifdef ORTOG_LSS_FNL
-  cp1p2p3inv = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-  p1p2p3inv = (fftw_real *)cp1p2p3inv;
-  ASSERT_ALLOC(cp1p2p3inv);
-  cp1p2p3_K12D = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-  p1p2p3_K12D = (fftw_real *)cp1p2p3_K12D;
-  ASSERT_ALLOC(cp1p2p3_K12D);
-  cp1p2p3_K12E = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-  p1p2p3_K12E = (fftw_real *)cp1p2p3_K12E;
-  ASSERT_ALLOC(cp1p2p3_K12E);
-  cp1p2p3_K12F = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-  p1p2p3_K12F = (fftw_real *)cp1p2p3_K12F;
-  ASSERT_ALLOC(cp1p2p3_K12F);
-  cp1p2p3_K12G = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-  p1p2p3_K12G = (fftw_real *)cp1p2p3_K12G;
-  ASSERT_ALLOC(cp1p2p3_K12G);
-#endif
-  // ****  wrc ****
-  // ******************* DSJ ***********************
-  exp_1_over_3 = (4. - PrimordialIndex) / 3.; // n_s modified exponent for generalized laplacian/inverse laplacian, exponent for k^2
-  exp_1_over_6 = (4. - PrimordialIndex) / 6.; // n_s modified exponent for generalized conjugate gradient magnitude and its inverse, exponent for k^2
-                                              // ******************* DSJ ***********************
+  for (m = 0; m < CIC_CORNERS; m++)
+    sum += field[cell[m]] * f[m];
 
-  /* first, clean the array */
-  for (i = 0; i < Local_nx; i++)
-    for (j = 0; j < Nmesh; j++)
-      for (k = 0; k <= Nmesh / 2; k++)
-      {
-        coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
-        cp1p2p3sym[coord].re = 0;
-        cp1p2p3sym[coord].im = 0;
-        cp1p2p3sca[coord].re = 0;
-        cp1p2p3sca[coord].im = 0;
-        cp1p2p3nab[coord].re = 0;
-        cp1p2p3nab[coord].im = 0;
-        cp1p2p3tre[coord].re = 0;
-        cp1p2p3tre[coord].im = 0;
-
-// ****  wrc ****
-#ifdef ORTOG_LSS_FNL
-        cp1p2p3inv[coord].re = 0;
-        cp1p2p3inv[coord].im = 0;
-#endif
-        // ****  wrc ****
-        cpartpot[coord].re = 0;
-        cpartpot[coord].im = 0;
-      }
+  return sum;
+}
 
-  /* multiply by k */
+/* Computes the 2LPT displacements from the ZA displacement field cdisp and
+   moves the particles. cdisp is overwritten. If zadisp is not NULL, the ZA
+   displacement of every particle is stored there. Returns the maximum 1D
+   displacement on this task. */
+#ifdef LOWMEM_2LPT
+
+/* Low-memory variant: the second-order source
+     S = sum_{a<b} (d_aa d_bb - d_ab^2) = (div^2 - sum_a d_aa^2) / 2 - sum_{a<b} d_ab^2,
+   with d_ab = d(disp_a)/d(q_b), is accumulated one squared gradient at a time,
+   and the displacements are read out one axis at a time, combined with their
+   velocity and position prefactors already in k-space. Besides cdisp only the
+   source and one scratch grid are allocated (5 grids instead of 9), for one
+   FFT more than the default (three more with zadisp). */
+
+/* adds fac * d_ab^2 to the real-space source, with a < 0 for the divergence */
+static void add_gradient_square(fftw_complex *cdisp[3], int a, int b, double fac, fftw_real *source,
+                                fftw_complex *cscratch)
+{
+  int i, j, k, coord;
+  double kvec[3];
+  struct kcolumn col;
+  fftw_real *scratch = (fftw_real *)cscratch;
+
+  #pragma omp parallel for collapse(2) private(k, col, coord, kvec)
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
+    {
+      kspace_column(i, j, &col);
+      kvec[0] = col.kx;
+      kvec[1] = col.ky;
 
-  for (ii = 0; ii < Local_nx; ii++)
-    for (j = 0; j < Nmesh; j++)
       for (k = 0; k <= Nmesh / 2; k++)
       {
+        coord = col.coord + k;
+        kvec[2] = Kgrid[k];
 
-        coord = (ii * Nmesh + j) * (Nmesh / 2 + 1) + k;
-        i = ii + Local_x_start;
-
-        /* already are zero */
-        /*  if(i == 0 && j == 0 && k == 0); continue */
-
-        if (i < Nmesh / 2)
-          kvec[0] = i * 2 * PI / Box;
-        else
-          kvec[0] = -(Nmesh - i) * 2 * PI / Box;
-
-        if (j < Nmesh / 2)
-          kvec[1] = j * 2 * PI / Box;
-        else
-          kvec[1] = -(Nmesh - j) * 2 * PI / Box;
-
-        if (k < Nmesh / 2)
-          kvec[2] = k * 2 * PI / Box;
+        /* d(dis_a)/d(q_b)  -> sqrt(-1) k_b dis_a */
+        if (a < 0)
+        {
+          cscratch[coord].re = -(cdisp[0][coord].im * kvec[0] + cdisp[1][coord].im * kvec[1] +
+                                 cdisp[2][coord].im * kvec[2]);
+          cscratch[coord].im = cdisp[0][coord].re * kvec[0] + cdisp[1][coord].re * kvec[1] +
+                               cdisp[2][coord].re * kvec[2];
+        }
         else
-          kvec[2] = -(Nmesh - k) * 2 * PI / Box;
-
-        kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
-        // ************************************ DSJ ********************************
-        kmag_2_over_3 = pow(kmag2, exp_1_over_3);
-        kmag_1_over_3 = pow(kmag2, exp_1_over_6);
-
-        cpartpot[coord].re = kmag_1_over_3 * cpot[coord].re;
-        cpartpot[coord].im = kmag_1_over_3 * cpot[coord].im;
-
-        cp1p2p3nab[coord].re = kmag_2_over_3 * cpot[coord].re;
-        cp1p2p3nab[coord].im = kmag_2_over_3 * cpot[coord].im;
-
-// ****  wrc ****
-#ifdef ORTOG_LSS_FNL
-        if (i == 0 && j == 0 && k == 0)
         {
-          continue;
+          cscratch[coord].re = -cdisp[a][coord].im * kvec[b];
+          cscratch[coord].im = cdisp[a][coord].re * kvec[b];
         }
-        cp1p2p3inv[coord].re = cpot[coord].re / kmag_1_over_3;
-        cp1p2p3inv[coord].im = cpot[coord].im / kmag_1_over_3;
-#endif
-        // ****  wrc ****
-        // ************************************ DSJ ********************************
       }
+    }
 
-  MPI_Barrier(MPI_COMM_WORLD);
-
-  /* Fourier back to real */
-  rfftwnd_mpi(Inverse_plan, 1, pot, Workspace, FFTW_NORMAL_ORDER);
-  rfftwnd_mpi(Inverse_plan, 1, partpot, Workspace, FFTW_NORMAL_ORDER);
-  rfftwnd_mpi(Inverse_plan, 1, p1p2p3nab, Workspace, FFTW_NORMAL_ORDER);
-
-// ****  wrc ****
-#ifdef ORTOG_LSS_FNL
-  rfftwnd_mpi(Inverse_plan, 1, p1p2p3inv, Workspace, FFTW_NORMAL_ORDER);
-#endif
-  // ****  wrc ****
-  MPI_Barrier(MPI_COMM_WORLD);
-
-  /* multiplying terms in real space  */
+  fft_inverse(scratch);
 
+  #pragma omp parallel for collapse(2) private(k, coord)
   for (i = 0; i < Local_nx; i++)
-    for (j = 0; j < Nmesh; j++)
+    for (j = 0; j < Local_ny; j++)
       for (k = 0; k < Nmesh; k++)
       {
-        coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k;
-
-// ****  wrc ****
-#ifdef ORTOG_LSS_FNL
-        p1p2p3_K12D[coord] = p1p2p3inv[coord] * p1p2p3inv[coord]; // 1/k phi 1/k phi
-        p1p2p3_K12E[coord] = p1p2p3nab[coord] * p1p2p3inv[coord]; // k^2 phi 1/k phi
-        p1p2p3_K12F[coord] = pot[coord] * p1p2p3inv[coord];       // phi 1/k phi
-        p1p2p3_K12G[coord] = partpot[coord] * p1p2p3inv[coord];   // k phi 1/k phk
-#endif
-        // ****  wrc ****
-        p1p2p3sym[coord] = partpot[coord] * partpot[coord];
-        p1p2p3sca[coord] = pot[coord] * partpot[coord];
-        p1p2p3nab[coord] = pot[coord] * p1p2p3nab[coord];
-        p1p2p3tre[coord] = p1p2p3nab[coord] * partpot[coord];
-        partpot[coord] = pot[coord] * pot[coord]; /** NOTE: now partpot is potential squared **/
+        coord = (i * Local_ny + j) * (2 * (Nmesh / 2 + 1)) + k;
+        source[coord] += fac * scratch[coord] * scratch[coord];
       }
+}
 
-  MPI_Barrier(MPI_COMM_WORLD);
-  rfftwnd_mpi(Forward_plan, 1, pot, Workspace, FFTW_NORMAL_ORDER);
-  rfftwnd_mpi(Forward_plan, 1, partpot, Workspace, FFTW_NORMAL_ORDER);
-  rfftwnd_mpi(Forward_plan, 1, p1p2p3sym, Workspace, FFTW_NORMAL_ORDER);
-  rfftwnd_mpi(Forward_plan, 1, p1p2p3sca, Workspace, FFTW_NORMAL_ORDER);
-  rfftwnd_mpi(Forward_plan, 1, p1p2p3nab, Workspace, FFTW_NORMAL_ORDER);
-  rfftwnd_mpi(Forward_plan, 1, p1p2p3tre, Workspace, FFTW_NORMAL_ORDER);
-
-// ****  wrc ****
-#ifdef ORTOG_LSS_FNL
-  rfftwnd_mpi(Forward_plan, 1, p1p2p3_K12D, Workspace, FFTW_NORMAL_ORDER);
-  rfftwnd_mpi(Forward_plan, 1, p1p2p3_K12E, Workspace, FFTW_NORMAL_ORDER);
-  rfftwnd_mpi(Forward_plan, 1, p1p2p3_K12F, Workspace, FFTW_NORMAL_ORDER);
-  rfftwnd_mpi(Forward_plan, 1, p1p2p3_K12G, Workspace, FFTW_NORMAL_ORDER);
-#endif
-
-  // ****  wrc ****
-  MPI_Barrier(MPI_COMM_WORLD);
-
-  /* divide by appropiate k's, sum terms according to non-local model */
-  /* remove the N^3 I got by forwardfurier and put zero to zero mode */
-
-  nmesh3 = ((unsigned int)Nmesh) * ((unsigned int)Nmesh) * ((unsigned int)Nmesh);
-
-  for (ii = 0; ii < Local_nx; ii++)
-    for (j = 0; j < Nmesh; j++)
-      for (k = 0; k <= Nmesh / 2; k++)
-      {
-
-        coord = (ii * Nmesh + j) * (Nmesh / 2 + 1) + k;
-        i = ii + Local_x_start;
-
-        /* if(i == 0 && j == 0 && k == 0); continue; */
-
-        if (i < Nmesh / 2)
-          kvec[0] = i * 2 * PI / Box;
-        else
-          kvec[0] = -(Nmesh - i) * 2 * PI / Box;
-
-        if (j < Nmesh / 2)
-          kvec[1] = j * 2 * PI / Box;
-        else
-          kvec[1] = -(Nmesh - j) * 2 * PI / Box;
-
-        if (k < Nmesh / 2)
-          kvec[2] = k * 2 * PI / Box;
-        else
-          kvec[2] = -(Nmesh - k) * 2 * PI / Box;
-
-        kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
-        // ****************************** DSJ *************************
-        kmag_2_over_3 = pow(kmag2, exp_1_over_3);
-        kmag_1_over_3 = pow(kmag2, exp_1_over_6);
-        // ****************************** DSJ *************************
-
-        if (i == 0 && j == 0 && k == 0)
-        {
-          cpot[0].re = 0.;
-          cpot[0].im = 0.;
-          continue;
-        }
+static double lpt_displacements(fftw_complex *cdisp[3], float *zadisp)
+{
+  int i, j, k, a, b, n, coord, axes, pass;
+  int cell[8];
+  double f[8];
+  double vel_prefac, vel_prefac2, hubble_a, c2;
+  double kvec[3], kmag2, dis, maxdisp, nmesh3;
+  unsigned int bytes;
+  struct kcolumn col;
+  fftw_complex *csource, *cscratch;
+  fftw_real *(disp[3]), *source, *scratch;
+  struct ghost_exchange gx = {0};
+  int *order, ninner, nread, m;
 
-        // ****************************** DSJ *************************
-        if (SphereMode == 1)
-        {
-          kmag = sqrt(kmag2);
-          if (kmag * Box / (2 * PI) > Nsample / 2)
-          { /* select a sphere in k-space */
-            cpot[coord].re = 0.;
-            cpot[coord].im = 0.;
-            continue;
-          }
-        }
-        // ****************************** DSJ *************************
+  hubble_a = Hubble * sqrt(Omega / pow(InitTime, 3) + (1 - Omega - OmegaLambda) / pow(InitTime, 2) + OmegaLambda);
+  vel_prefac = InitTime * hubble_a * F_Omega(InitTime) / sqrt(InitTime);
+  vel_prefac2 = InitTime * hubble_a * F2_Omega(InitTime) / sqrt(InitTime);
 
-#ifdef EQUIL_FNL
-        /* fnl equilateral */
-        // ****************************************************************************************** DSJ ********************************************************************************************************
-        cpot[coord].re += Fnl * (-3.0 * cpartpot[coord].re - 2.0 * cp1p2p3sym[coord].re / kmag_2_over_3 + 4.0 * cp1p2p3sca[coord].re / kmag_1_over_3 + 2.0 * cp1p2p3nab[coord].re / kmag_2_over_3);
-        cpot[coord].im += Fnl * (-3.0 * cpartpot[coord].im - 2.0 * cp1p2p3sym[coord].im / kmag_2_over_3 + 4.0 * cp1p2p3sca[coord].im / kmag_1_over_3 + 2.0 * cp1p2p3nab[coord].im / kmag_2_over_3);
-// ****************************************************************************************** DSJ ********************************************************************************************************
+#ifdef ONLY_ZA
+  c2 = 0;
+#else
+  c2 = -3. / 7.;
 #endif
 
-#ifdef ORTOG_FNL
-        // ****************************************************************************************** DSJ ********************************************************************************************************
-        cpot[coord].re += Fnl * (-9.0 * cpartpot[coord].re - 8.0 * cp1p2p3sym[coord].re / kmag_2_over_3 + 10.0 * cp1p2p3sca[coord].re / kmag_1_over_3 + 8.0 * cp1p2p3nab[coord].re / kmag_2_over_3);
-        cpot[coord].im += Fnl * (-9.0 * cpartpot[coord].im - 8.0 * cp1p2p3sym[coord].im / kmag_2_over_3 + 10.0 * cp1p2p3sca[coord].im / kmag_1_over_3 + 8.0 * cp1p2p3nab[coord].im / kmag_2_over_3);
-// ****************************************************************************************** DSJ ********************************************************************************************************
-#endif
+  for (axes = 0; axes < 3; axes++)
+    disp[axes] = (fftw_real *)cdisp[axes];
 
-// ****  wrc ****
-#ifdef ORTOG_LSS_FNL
-        cpot[coord].re += 3 * Fnl * (-(1.0 + 1.0 / 3.0 * orth_p) * cpartpot[coord].re - 1.0 / 3.0 * (2.0 + 20. / 9. * orth_p) * cp1p2p3sym[coord].re / kmag_2_over_3 + 2.0 * (1.0 + 5.0 / 9.0 * orth_p) * (1.0 - orth_t) * cp1p2p3sca[coord].re / kmag_1_over_3 + 2.0 * (1.0 + 5.0 / 9.0 * orth_p) * orth_t * cp1p2p3nab[coord].re / kmag_2_over_3);
-        cpot[coord].re += 3 * Fnl * (orth_p / 27.0 * cp1p2p3_K12D[coord].re * kmag_2_over_3 - 20.0 * orth_p / 27.0 * cp1p2p3_K12E[coord].re / kmag_1_over_3 - 4.0 * orth_p / 9.0 * cp1p2p3_K12F[coord].re * kmag_1_over_3 + 10.0 / 9.0 * orth_p * cp1p2p3_K12G[coord].re);
-        cpot[coord].im += 3 * Fnl * (-(1.0 + 1.0 / 3.0 * orth_p) * cpartpot[coord].im - 1.0 / 3.0 * (2.0 + 20. / 9. * orth_p) * cp1p2p3sym[coord].im / kmag_2_over_3 + 2.0 * (1.0 + 5.0 / 9.0 * orth_p) * (1.0 - orth_t) * cp1p2p3sca[coord].im / kmag_1_over_3 + 2.0 * (1.0 + 5.0 / 9.0 * orth_p) * orth_t * cp1p2p3nab[coord].im / kmag_2_over_3);
-        cpot[coord].im += 3 * Fnl * (orth_p / 27.0 * cp1p2p3_K12D[coord].im * kmag_2_over_3 - 20.0 * orth_p / 27.0 * cp1p2p3_K12E[coord].im / kmag_1_over_3 - 4.0 * orth_p / 9.0 * cp1p2p3_K12F[coord].im * kmag_1_over_3 + 10.0 / 9.0 * orth_p * cp1p2p3_K12G[coord].im);
+#ifdef OUTPUT_PK
+  measure_spectrum(cdisp);
 #endif
-        // ****  wrc ****
-        cpot[coord].re /= (double)nmesh3;
-        cpot[coord].im /= (double)nmesh3;
-      }
 
-  free(cpartpot);
-  free(cp1p2p3sym);
-  free(cp1p2p3sca);
-  free(cp1p2p3nab);
-  free(cp1p2p3tre);
-// ****  wrc ****p
-#ifdef ORTOG_LSS_FNL
-  free(cp1p2p3inv);
-  free(cp1p2p3_K12D);
-  free(cp1p2p3_K12E);
-  free(cp1p2p3_K12F);
-  free(cp1p2p3_K12G);
-#endif
-  // ****  wrc ****
+  nmesh3 = (double)Nmesh * Nmesh * Nmesh;
+  maxdisp = 0;
 
-  if (ThisTask == 0)
-    print_timed_done(1);
-#endif
-#endif
-#endif
+  MPI_Barrier(MPI_COMM_WORLD);
 
   if (ThisTask == 0)
   {
-    printf("Computing gradient of non-Gaussian potential...");
+    printf("Computing 2LPT potential (low memory)...");
     fflush(stdout);
   };
 
-  /****** FINISHED NON LOCAL POTENTIAL OR LOCAL FNL, STILL IN NONGAUSSIAN SECTION ****/
-  /*****  Now 2LPT ****/
-  // ARE WE ALIVE?
-  for (axes = 0, bytes = 0; axes < 3; axes++)
+  csource = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+  source = (fftw_real *)csource;
+  ASSERT_ALLOC(csource);
+
+  cscratch = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+  scratch = (fftw_real *)cscratch;
+  ASSERT_ALLOC(cscratch);
+
+  memset(source, 0, sizeof(fftw_real) * TotalSizePlusAdditional);
+
+  add_gradient_square(cdisp, -1, 0, 0.5, source, cscratch);
+  for (a = 0; a < 3; a++)
+    add_gradient_square(cdisp, a, a, -0.5, source, cscratch);
+  for (a = 0; a < 3; a++)
+    for (b = a + 1; b < 3; b++)
+      add_gradient_square(cdisp, a, b, -1.0, source, cscratch);
+
+  fft_forward(source);
+
+  if (ThisTask == 0)
+    print_timed_done(21);
+  if (ThisTask == 0)
   {
-    cdisp[axes] = (fftw_complex *)malloc(bytes += sizeof(fftw_real) * TotalSizePlusAdditional);
-    disp[axes] = (fftw_real *)cdisp[axes];
-  }
+    printf("Computing displacements and velocitites...");
+    fflush(stdout);
+  };
 
-  ASSERT_ALLOC(cdisp[0] && cdisp[1] && cdisp[2]);
+  /* the particles only move at the very end, so one order serves all readouts */
+  order = cell_order(&ninner, &nread);
 
-#if defined(MULTICOMPONENTGLASSFILE) && defined(DIFFERENT_TRANSFER_FUNC)
-  for (Type = MinType; Type <= MaxType; Type++)
-#endif
+  /* one axis at a time: the velocities (and ZA displacements) are read out
+     right away, the position shift is kept in cdisp[axes] until all three are done */
+  for (axes = 0; axes < 3; axes++)
   {
+    if (zadisp)
+    {
+      #pragma omp parallel for collapse(2) private(k, col, coord)
+      for (i = 0; i < Kspace_n0; i++)
+        for (j = 0; j < Kspace_n1; j++)
+        {
+          kspace_column(i, j, &col);
 
-    /* first, clean the array */
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k <= Nmesh / 2; k++)
-          for (axes = 0; axes < 3; axes++)
+          for (k = 0; k <= Nmesh / 2; k++)
           {
-            cdisp[axes][(i * Nmesh + j) * (Nmesh / 2 + 1) + k].re = 0;
-            cdisp[axes][(i * Nmesh + j) * (Nmesh / 2 + 1) + k].im = 0;
+            double smth = 1;
+#ifdef CORRECT_CIC
+            double ff = 1 / (col.wxy * CicWindow[k]);
+
+            smth = ff * ff;
+#endif
+            coord = col.coord + k;
+            cscratch[coord].re = cdisp[axes][coord].re * smth;
+            cscratch[coord].im = cdisp[axes][coord].im * smth;
           }
+        }
 
-    for (ii = 0; ii < Local_nx; ii++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k <= Nmesh / 2; k++)
+      fft_inverse(scratch);
+      post_ghost_exchange(&gx, &scratch, 1);
+
+      for (pass = 0; pass < 2; pass++)
+      {
+        if (pass == 1)
+          finish_ghost_exchange(&gx);
+
+        #pragma omp parallel for private(n, cell, f)
+        for (m = pass ? ninner : 0; m < (pass ? nread : ninner); m++)
         {
+          n = order[m];
+          cic_stencil(n, cell, f);
+          zadisp[3 * n + axes] = cic_sum(scratch, cell, f);
+        }
+      }
+    }
 
-          coord = (ii * Nmesh + j) * (Nmesh / 2 + 1) + k;
-          i = ii + Local_x_start;
+    #pragma omp parallel for collapse(2) private(k, col, coord, kvec, kmag2)
+    for (i = 0; i < Kspace_n0; i++)
+      for (j = 0; j < Kspace_n1; j++)
+      {
+        kspace_column(i, j, &col);
+        kvec[0] = col.kx;
+        kvec[1] = col.ky;
 
-          /*   if(i == 0 && j == 0 && k == 0); continue; */
+        for (k = 0; k <= Nmesh / 2; k++)
+        {
+          double d_re, d_im, d2_re, d2_im, smth = 1;
+#ifdef CORRECT_CIC
+          double ff = 1 / (col.wxy * CicWindow[k]);
 
-          if (i < Nmesh / 2)
-            kvec[0] = i * 2 * PI / Box;
-          else
-            kvec[0] = -(Nmesh - i) * 2 * PI / Box;
+          /* smooth factor for deconvolution of CIC interpolation */
+          smth = ff * ff;
+#endif
+          coord = col.coord + k;
+          kvec[2] = Kgrid[k];
 
-          if (j < Nmesh / 2)
-            kvec[1] = j * 2 * PI / Box;
-          else
-            kvec[1] = -(Nmesh - j) * 2 * PI / Box;
+          kmag2 = col.kxy2 + Kgrid2[k];
 
-          if (k < Nmesh / 2)
-            kvec[2] = k * 2 * PI / Box;
+          /* disp2 = source * k / (sqrt(-1) k^2), the source still carries the N^3 of the forward transform */
+          if (kmag2 > 0.0)
+          {
+            d2_re = csource[coord].im * kvec[axes] / kmag2 * smth / nmesh3;
+            d2_im = -csource[coord].re * kvec[axes] / kmag2 * smth / nmesh3;
+          }
           else
-            kvec[2] = -(Nmesh - k) * 2 * PI / Box;
-
-          kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
-          kmag = sqrt(kmag2);
+            d2_re = d2_im = 0.0;
 
-          t_of_k = TransferFunc(kmag);
+          d_re = cdisp[axes][coord].re * smth;
+          d_im = cdisp[axes][coord].im * smth;
 
-          twb = t_of_k / Dplus / Beta;
+          cscratch[coord].re = d_re * vel_prefac + c2 * d2_re * vel_prefac2;
+          cscratch[coord].im = d_im * vel_prefac + c2 * d2_im * vel_prefac2;
 
-          for (axes = 0; axes < 3; axes++)
-          {
-            cdisp[axes][coord].im = kvec[axes] * twb * cpot[coord].re;
-            cdisp[axes][coord].re = -kvec[axes] * twb * cpot[coord].im;
-          }
+          cdisp[axes][coord].re = d_re + c2 * d2_re;
+          cdisp[axes][coord].im = d_im + c2 * d2_im;
         }
+      }
 
-    free(cpot);
+    fft_inverse(scratch);
+    post_ghost_exchange(&gx, &scratch, 1);
 
-    if (ThisTask == 0)
-      print_timed_done(1);
+    for (pass = 0; pass < 2; pass++)
+    {
+      if (pass == 1)
+        finish_ghost_exchange(&gx);
 
-#endif
+      #pragma omp parallel for private(n, cell, f)
+      for (m = pass ? ninner : 0; m < (pass ? nread : ninner); m++)
+      {
+        n = order[m];
+        cic_stencil(n, cell, f);
+        P[n].Vel[axes] = cic_sum(scratch, cell, f);
+      }
+    }
+  }
 
-    MPI_Barrier(MPI_COMM_WORLD);
+  fft_free(cscratch);
+  fft_free(csource);
 
-    /* Compute displacement gradient */
+  MPI_Barrier(MPI_COMM_WORLD);
 
-    if (ThisTask == 0)
-    {
-      printf("Computing 2LPT potential...");
-      fflush(stdout);
-    };
+  fft_inverse_many(disp, 3);
+  post_ghost_exchange(&gx, disp, 3);
+
+  for (pass = 0; pass < 2; pass++)
+  {
+    if (pass == 1)
+      finish_ghost_exchange(&gx);
 
-    for (i = 0; i < 6; i++)
+    #pragma omp parallel for private(n, cell, f, dis, axes) reduction(max:maxdisp)
+    for (m = pass ? ninner : 0; m < (pass ? nread : ninner); m++)
     {
-      cdigrad[i] = (fftw_complex *)malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
-      digrad[i] = (fftw_real *)cdigrad[i];
-      ASSERT_ALLOC(cdigrad[i]);
-    }
+      n = order[m];
+      cic_stencil(n, cell, f);
 
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k <= Nmesh / 2; k++)
-        {
-          coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
-          if ((i + Local_x_start) < Nmesh / 2)
-            kvec[0] = (i + Local_x_start) * 2 * PI / Box;
-          else
-            kvec[0] = -(Nmesh - (i + Local_x_start)) * 2 * PI / Box;
+      for (axes = 0; axes < 3; axes++)
+      {
+        dis = cic_sum(disp[axes], cell, f);
 
-          if (j < Nmesh / 2)
-            kvec[1] = j * 2 * PI / Box;
-          else
-            kvec[1] = -(Nmesh - j) * 2 * PI / Box;
+        P[n].Pos[axes] += dis;
+        P[n].Pos[axes] = periodic_wrap(P[n].Pos[axes]);
 
-          if (k < Nmesh / 2)
-            kvec[2] = k * 2 * PI / Box;
-          else
-            kvec[2] = -(Nmesh - k) * 2 * PI / Box;
+        if (fabs(dis) > maxdisp)
+          maxdisp = fabs(dis);
+      }
+    }
+  }
 
-          /* Derivatives of ZA displacement  */
-          /* d(dis_i)/d(q_j)  -> sqrt(-1) k_j dis_i */
-          cdigrad[0][coord].re = -cdisp[0][coord].im * kvec[0]; /* disp0,0 */
-          cdigrad[0][coord].im = cdisp[0][coord].re * kvec[0];
+  free(order);
 
-          cdigrad[1][coord].re = -cdisp[0][coord].im * kvec[1]; /* disp0,1 */
-          cdigrad[1][coord].im = cdisp[0][coord].re * kvec[1];
+  if (ThisTask == 0)
+    print_timed_done(6);
 
-          cdigrad[2][coord].re = -cdisp[0][coord].im * kvec[2]; /* disp0,2 */
-          cdigrad[2][coord].im = cdisp[0][coord].re * kvec[2];
+  return maxdisp;
+}
 
-          cdigrad[3][coord].re = -cdisp[1][coord].im * kvec[1]; /* disp1,1 */
-          cdigrad[3][coord].im = cdisp[1][coord].re * kvec[1];
+#else
 
-          cdigrad[4][coord].re = -cdisp[1][coord].im * kvec[2]; /* disp1,2 */
-          cdigrad[4][coord].im = cdisp[1][coord].re * kvec[2];
+static double lpt_displacements(fftw_complex *cdisp[3], float *zadisp)
+{
+  int i, j, k, axes;
+  int n, m, pass, ninner, nread, *order;
+  int cell[8];
+  double f[8];
+  double vel_prefac, vel_prefac2, hubble_a;
+  double kvec[3], kmag2;
+  struct kcolumn col;
+  double dis, dis2, maxdisp;
+  unsigned int bytes;
+  double nmesh3;
+  int coord;
+  fftw_complex *(cdisp2[3]); /* 2nd order displacements */
+  fftw_real *(disp[3]), *(disp2[3]);
 
-          cdigrad[5][coord].re = -cdisp[2][coord].im * kvec[2]; /* disp2,2 */
-          cdigrad[5][coord].im = cdisp[2][coord].re * kvec[2];
-        }
+  fftw_complex *(cdigrad[6]);
+  fftw_real *(digrad[6]);
+  struct ghost_exchange gx = {0};
 
-    for (i = 0; i < 6; i++)
-      rfftwnd_mpi(Inverse_plan, 1, digrad[i], Workspace, FFTW_NORMAL_ORDER);
+  hubble_a = Hubble * sqrt(Omega / pow(InitTime, 3) + (1 - Omega - OmegaLambda) / pow(InitTime, 2) + OmegaLambda);
+  vel_prefac = InitTime * hubble_a * F_Omega(InitTime) / sqrt(InitTime);
+  vel_prefac2 = InitTime * hubble_a * F2_Omega(InitTime) / sqrt(InitTime);
 
-    /* Compute second order source and store it in digrad[3]*/
+  for (axes = 0; axes < 3; axes++)
+    disp[axes] = (fftw_real *)cdisp[axes];
 
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k < Nmesh; k++)
-        {
-          coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k;
+#ifdef OUTPUT_PK
+  measure_spectrum(cdisp);
+#endif
 
-          digrad[3][coord] =
+  maxdisp = 0;
 
-              digrad[0][coord] * (digrad[3][coord] + digrad[5][coord]) + digrad[3][coord] * digrad[5][coord] - digrad[1][coord] * digrad[1][coord] - digrad[2][coord] * digrad[2][coord] - digrad[4][coord] * digrad[4][coord];
-        }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  /* Compute displacement gradient */
 
-    rfftwnd_mpi(Forward_plan, 1, digrad[3], Workspace, FFTW_NORMAL_ORDER);
+  if (ThisTask == 0)
+  {
+    printf("Computing 2LPT potential...");
+    fflush(stdout);
+  };
 
-    /* The memory allocated for cdigrad[0], [1], and [2] will be used for 2nd order displacements */
-    /* Freeing the rest. cdigrad[3] still has 2nd order displacement source, free later */
+  for (i = 0; i < 6; i++)
+  {
+    cdigrad[i] = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+    digrad[i] = (fftw_real *)cdigrad[i];
+    ASSERT_ALLOC(cdigrad[i]);
+  }
 
-    for (axes = 0; axes < 3; axes++)
+  #pragma omp parallel for collapse(2) private(k, col, coord, kvec)
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
     {
-      cdisp2[axes] = cdigrad[axes];
-      disp2[axes] = (fftw_real *)cdisp2[axes];
-    }
+      kspace_column(i, j, &col);
+      kvec[0] = col.kx;
+      kvec[1] = col.ky;
+
+      for (k = 0; k <= Nmesh / 2; k++)
+      {
+        coord = col.coord + k;
+        kvec[2] = Kgrid[k];
 
-    free(cdigrad[4]);
-    free(cdigrad[5]);
+        /* Derivatives of ZA displacement  */
+        /* d(dis_i)/d(q_j)  -> sqrt(-1) k_j dis_i */
+        cdigrad[0][coord].re = -cdisp[0][coord].im * kvec[0]; /* disp0,0 */
+        cdigrad[0][coord].im = cdisp[0][coord].re * kvec[0];
 
-    /* Solve Poisson eq. and calculate 2nd order displacements */
+        cdigrad[1][coord].re = -cdisp[0][coord].im * kvec[1]; /* disp0,1 */
+        cdigrad[1][coord].im = cdisp[0][coord].re * kvec[1];
 
-    for (i = 0; i < Local_nx; i++)
-      for (j = 0; j < Nmesh; j++)
-        for (k = 0; k <= Nmesh / 2; k++)
-        {
-          coord = (i * Nmesh + j) * (Nmesh / 2 + 1) + k;
-          if ((i + Local_x_start) < Nmesh / 2)
-            kvec[0] = (i + Local_x_start) * 2 * PI / Box;
-          else
-            kvec[0] = -(Nmesh - (i + Local_x_start)) * 2 * PI / Box;
+        cdigrad[2][coord].re = -cdisp[0][coord].im * kvec[2]; /* disp0,2 */
+        cdigrad[2][coord].im = cdisp[0][coord].re * kvec[2];
 
-          if (j < Nmesh / 2)
-            kvec[1] = j * 2 * PI / Box;
-          else
-            kvec[1] = -(Nmesh - j) * 2 * PI / Box;
+        cdigrad[3][coord].re = -cdisp[1][coord].im * kvec[1]; /* disp1,1 */
+        cdigrad[3][coord].im = cdisp[1][coord].re * kvec[1];
 
-          if (k < Nmesh / 2)
-            kvec[2] = k * 2 * PI / Box;
-          else
-            kvec[2] = -(Nmesh - k) * 2 * PI / Box;
+        cdigrad[4][coord].re = -cdisp[1][coord].im * kvec[2]; /* disp1,2 */
+        cdigrad[4][coord].im = cdisp[1][coord].re * kvec[2];
 
-          kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
-#ifdef CORRECT_CIC
-          /* calculate smooth factor for deconvolution of CIC interpolation */
-          fx = fy = fz = 1;
-          if (kvec[0] != 0)
-          {
-            fx = (kvec[0] * Box / 2) / Nmesh;
-            fx = sin(fx) / fx;
-          }
-          if (kvec[1] != 0)
-          {
-            fy = (kvec[1] * Box / 2) / Nmesh;
-            fy = sin(fy) / fy;
-          }
-          if (kvec[2] != 0)
-          {
-            fz = (kvec[2] * Box / 2) / Nmesh;
-            fz = sin(fz) / fz;
-          }
-          ff = 1 / (fx * fy * fz);
-          smth = ff * ff;
-          /*  */
-#endif
+        cdigrad[5][coord].re = -cdisp[2][coord].im * kvec[2]; /* disp2,2 */
+        cdigrad[5][coord].im = cdisp[2][coord].re * kvec[2];
+      }
+    }
 
-          /* cdisp2 = source * k / (sqrt(-1) k^2) */
-          for (axes = 0; axes < 3; axes++)
-          {
-            if (kmag2 > 0.0)
-            {
-              cdisp2[axes][coord].re = cdigrad[3][coord].im * kvec[axes] / kmag2;
-              cdisp2[axes][coord].im = -cdigrad[3][coord].re * kvec[axes] / kmag2;
-            }
-            else
-              cdisp2[axes][coord].re = cdisp2[axes][coord].im = 0.0;
-#ifdef CORRECT_CIC
-            cdisp[axes][coord].re *= smth;
-            cdisp[axes][coord].im *= smth;
-            cdisp2[axes][coord].re *= smth;
-            cdisp2[axes][coord].im *= smth;
-#endif
-          }
-        }
+  fft_inverse_many(digrad, 6);
 
-    /* Free cdigrad[3] */
-    free(cdigrad[3]);
+  /* Compute second order source and store it in digrad[3]*/
 
-    MPI_Barrier(MPI_COMM_WORLD);
+  #pragma omp parallel for collapse(2) private(k, coord)
+  for (i = 0; i < Local_nx; i++)
+    for (j = 0; j < Local_ny; j++)
+      for (k = 0; k < Nmesh; k++)
+      {
+        coord = (i * Local_ny + j) * (2 * (Nmesh / 2 + 1)) + k;
 
-    /* Now, both cdisp, and cdisp2 have the ZA and 2nd order displacements */
+        digrad[3][coord] =
 
-    for (axes = 0; axes < 3; axes++)
-    {
-      rfftwnd_mpi(Inverse_plan, 1, disp[axes], Workspace, FFTW_NORMAL_ORDER);
-      rfftwnd_mpi(Inverse_plan, 1, disp2[axes], Workspace, FFTW_NORMAL_ORDER);
+            digrad[0][coord] * (digrad[3][coord] + digrad[5][coord]) + digrad[3][coord] * digrad[5][coord] - digrad[1][coord] * digrad[1][coord] - digrad[2][coord] * digrad[2][coord] - digrad[4][coord] * digrad[4][coord];
+      }
 
-      /* now get the plane on the right side from neighbour on the right,
-         and send the left plane */
+  fft_forward(digrad[3]);
 
-      recvTask = ThisTask;
-      do
-      {
-        recvTask--;
-        if (recvTask < 0)
-          recvTask = NTask - 1;
-      } while (Local_nx_table[recvTask] == 0);
+  /* The memory allocated for cdigrad[0], [1], and [2] will be used for 2nd order displacements */
+  /* Freeing the rest. cdigrad[3] still has 2nd order displacement source, free later */
 
-      sendTask = ThisTask;
-      do
-      {
-        sendTask++;
-        if (sendTask >= NTask)
-          sendTask = 0;
-      } while (Local_nx_table[sendTask] == 0);
+  for (axes = 0; axes < 3; axes++)
+  {
+    cdisp2[axes] = cdigrad[axes];
+    disp2[axes] = (fftw_real *)cdisp2[axes];
+  }
 
-      /* use non-blocking send */
+  fft_free(cdigrad[4]);
+  fft_free(cdigrad[5]);
 
-      if (Local_nx > 0)
-      {
-        /* send ZA disp */
-        MPI_Isend(&(disp[axes][0]),
-                  sizeof(fftw_real) * Nmesh * (2 * (Nmesh / 2 + 1)),
-                  MPI_BYTE, recvTask, 10, MPI_COMM_WORLD, &request);
+  /* Solve Poisson eq. and calculate 2nd order displacements */
 
-        MPI_Recv(&(disp[axes][(Local_nx * Nmesh) * (2 * (Nmesh / 2 + 1))]),
-                 sizeof(fftw_real) * Nmesh * (2 * (Nmesh / 2 + 1)),
-                 MPI_BYTE, sendTask, 10, MPI_COMM_WORLD, &status);
+  #pragma omp parallel for collapse(2) private(k, col, coord, kvec, kmag2, axes)
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
+    {
+      kspace_column(i, j, &col);
+      kvec[0] = col.kx;
+      kvec[1] = col.ky;
 
-        MPI_Wait(&request, &status);
+      for (k = 0; k <= Nmesh / 2; k++)
+      {
+#ifdef CORRECT_CIC
+        double ff, smth;
+#endif
 
-        /* send 2nd order disp */
-        MPI_Isend(&(disp2[axes][0]),
-                  sizeof(fftw_real) * Nmesh * (2 * (Nmesh / 2 + 1)),
-                  MPI_BYTE, recvTask, 10, MPI_COMM_WORLD, &request);
+        coord = col.coord + k;
+        kvec[2] = Kgrid[k];
 
-        MPI_Recv(&(disp2[axes][(Local_nx * Nmesh) * (2 * (Nmesh / 2 + 1))]),
-                 sizeof(fftw_real) * Nmesh * (2 * (Nmesh / 2 + 1)),
-                 MPI_BYTE, sendTask, 10, MPI_COMM_WORLD, &status);
+        kmag2 = col.kxy2 + Kgrid2[k];
+#ifdef CORRECT_CIC
+        /* smooth factor for deconvolution of CIC interpolation */
+        ff = 1 / (col.wxy * CicWindow[k]);
+        smth = ff * ff;
+#endif
 
-        MPI_Wait(&request, &status);
+        /* cdisp2 = source * k / (sqrt(-1) k^2) */
+        for (axes = 0; axes < 3; axes++)
+        {
+          if (kmag2 > 0.0)
+          {
+            cdisp2[axes][coord].re = cdigrad[3][coord].im * kvec[axes] / kmag2;
+            cdisp2[axes][coord].im = -cdigrad[3][coord].re * kvec[axes] / kmag2;
+          }
+          else
+            cdisp2[axes][coord].re = cdisp2[axes][coord].im = 0.0;
+#ifdef CORRECT_CIC
+          cdisp[axes][coord].re *= smth;
+          cdisp[axes][coord].im *= smth;
+          cdisp2[axes][coord].re *= smth;
+          cdisp2[axes][coord].im *= smth;
+#endif
+        }
       }
     }
 
-    if (ThisTask == 0)
-      print_timed_done(21);
-    if (ThisTask == 0)
-    {
-      printf("Computing displacements and velocitites...");
-      fflush(stdout);
-    };
+  /* Free cdigrad[3] */
+  fft_free(cdigrad[3]);
 
-    /* read-out displacements */
-    nmesh3 = Nmesh * Nmesh * Nmesh;
-    for (n = 0; n < NumPart; n++)
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  /* Now, both cdisp, and cdisp2 have the ZA and 2nd order displacements */
+
+  /* the ghost planes of disp travel while disp2 is transformed */
+  fft_inverse_many(disp, 3);
+  post_ghost_exchange(&gx, disp, 3);
+  fft_inverse_many(disp2, 3);
+  post_ghost_exchange(&gx, disp2, 3);
+
+  if (ThisTask == 0)
+    print_timed_done(21);
+  if (ThisTask == 0)
+  {
+    printf("Computing displacements and velocitites...");
+    fflush(stdout);
+  };
+
+  /* read-out displacements, column by column: first the particles clear of
+     the ghost plane, then, once it is in, the last plane */
+  order = cell_order(&ninner, &nread);
+
+  nmesh3 = (double)Nmesh * Nmesh * Nmesh;
+  for (pass = 0; pass < 2; pass++)
+  {
+    if (pass == 1)
+      finish_ghost_exchange(&gx);
+
+    #pragma omp parallel for private(n, cell, f, dis, dis2, axes) reduction(max:maxdisp)
+    for (m = pass ? ninner : 0; m < (pass ? nread : ninner); m++)
     {
-#if defined(MULTICOMPONENTGLASSFILE) && defined(DIFFERENT_TRANSFER_FUNC)
-      if (P[n].Type == Type)
-#endif
-      {
-        u = P[n].Pos[0] / Box * Nmesh;
-        v = P[n].Pos[1] / Box * Nmesh;
-        w = P[n].Pos[2] / Box * Nmesh;
-
-        i = (int)u;
-        j = (int)v;
-        k = (int)w;
-
-        if (i == (Local_x_start + Local_nx))
-          i = (Local_x_start + Local_nx) - 1;
-        if (i < Local_x_start)
-          i = Local_x_start;
-        if (j == Nmesh)
-          j = Nmesh - 1;
-        if (k == Nmesh)
-          k = Nmesh - 1;
-
-        u -= i;
-        v -= j;
-        w -= k;
-
-        i -= Local_x_start;
-        ii = i + 1;
-        jj = j + 1;
-        kk = k + 1;
-
-        if (jj >= Nmesh)
-          jj -= Nmesh;
-        if (kk >= Nmesh)
-          kk -= Nmesh;
-
-        f1 = (1 - u) * (1 - v) * (1 - w);
-        f2 = (1 - u) * (1 - v) * (w);
-        f3 = (1 - u) * (v) * (1 - w);
-        f4 = (1 - u) * (v) * (w);
-        f5 = (u) * (1 - v) * (1 - w);
-        f6 = (u) * (1 - v) * (w);
-        f7 = (u) * (v) * (1 - w);
-        f8 = (u) * (v) * (w);
+      n = order[m];
+      cic_stencil(n, cell, f);
 
-        for (axes = 0; axes < 3; axes++)
-        {
-          dis = disp[axes][(i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k] * f1 +
-                disp[axes][(i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + kk] * f2 +
-                disp[axes][(i * Nmesh + jj) * (2 * (Nmesh / 2 + 1)) + k] * f3 +
-                disp[axes][(i * Nmesh + jj) * (2 * (Nmesh / 2 + 1)) + kk] * f4 +
-                disp[axes][(ii * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k] * f5 +
-                disp[axes][(ii * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + kk] * f6 +
-                disp[axes][(ii * Nmesh + jj) * (2 * (Nmesh / 2 + 1)) + k] * f7 +
-                disp[axes][(ii * Nmesh + jj) * (2 * (Nmesh / 2 + 1)) + kk] * f8;
-
-          dis2 = disp2[axes][(i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k] * f1 +
-                 disp2[axes][(i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + kk] * f2 +
-                 disp2[axes][(i * Nmesh + jj) * (2 * (Nmesh / 2 + 1)) + k] * f3 +
-                 disp2[axes][(i * Nmesh + jj) * (2 * (Nmesh / 2 + 1)) + kk] * f4 +
-                 disp2[axes][(ii * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k] * f5 +
-                 disp2[axes][(ii * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + kk] * f6 +
-                 disp2[axes][(ii * Nmesh + jj) * (2 * (Nmesh / 2 + 1)) + k] * f7 +
-                 disp2[axes][(ii * Nmesh + jj) * (2 * (Nmesh / 2 + 1)) + kk] * f8;
-          dis2 /= (float)nmesh3;
+      /* all six fields at the same eight corners */
+      for (axes = 0; axes < 3; axes++)
+      {
+        dis = cic_sum(disp[axes], cell, f);
+        dis2 = cic_sum(disp2[axes], cell, f);
+        dis2 /= nmesh3;
 
 #ifdef ONLY_ZA
-          P[n].Pos[axes] += dis;
-          P[n].Vel[axes] = dis * vel_prefac;
+        P[n].Pos[axes] += dis;
+        P[n].Vel[axes] = dis * vel_prefac;
 #else
-          P[n].Pos[axes] += dis - 3. / 7. * dis2;
-          P[n].Vel[axes] = dis * vel_prefac - 3. / 7. * dis2 * vel_prefac2;
+        P[n].Pos[axes] += dis - 3. / 7. * dis2;
+        P[n].Vel[axes] = dis * vel_prefac - 3. / 7. * dis2 * vel_prefac2;
 #endif
 
-          P[n].Pos[axes] = periodic_wrap(P[n].Pos[axes]);
+        P[n].Pos[axes] = periodic_wrap(P[n].Pos[axes]);
 
-          if (fabs(dis - 3. / 7. * dis2 > maxdisp))
-            maxdisp = fabs(dis - 3. / 7. * dis2);
-        }
+        if (zadisp)
+          zadisp[3 * n + axes] = dis;
+
+        if (fabs(dis - 3. / 7. * dis2 > maxdisp))
+          maxdisp = fabs(dis - 3. / 7. * dis2);
       }
     }
   }
 
+  free(order);
+
   if (ThisTask == 0)
     print_timed_done(6);
 
   for (axes = 0; axes < 3; axes++)
-    free(cdisp[axes]);
-  for (axes = 0; axes < 3; axes++)
-    free(cdisp2[axes]);
-
-  gsl_rng_free(random_generator);
+    fft_free(cdisp2[axes]);
 
-  MPI_Reduce(&maxdisp, &max_disp_glob, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
-
-  /*  if(ThisTask == 0)
-      {
-        printf("\nMaximum displacement (1D): %g kpc/h, in units of the part-spacing= %g\n",
-         max_disp_glob, max_disp_glob / (Box / Nmesh));
-      }*/
+  return maxdisp;
 }
+#endif
 
+/* Particles are never more than a box away from it, so one step either way
+   will do, and the comparisons compile to selects rather than branches */
 double periodic_wrap(double x)
 {
-  while (x >= Box)
-    x -= Box;
-
-  while (x < 0)
-    x += Box;
+  x -= (x >= Box) ? Box : 0;
+  x += (x < 0) ? Box : 0;
 
   return x;
 }
@@ -2534,48 +2099,97 @@ void set_units(void) /* ... set some units */
 void initialize_ffts(void)
 {
   int total_size, i, additional;
-  int local_ny_after_transpose, local_y_start_after_transpose;
   int *slab_to_task_local;
-  size_t bytes;
-
-  Inverse_plan = rfftw3d_mpi_create_plan(MPI_COMM_WORLD,
-                                         Nmesh, Nmesh, Nmesh, FFTW_COMPLEX_TO_REAL, FFTW_ESTIMATE);
-
-  Forward_plan = rfftw3d_mpi_create_plan(MPI_COMM_WORLD,
-                                         Nmesh, Nmesh, Nmesh, FFTW_REAL_TO_COMPLEX, FFTW_ESTIMATE);
 
-  rfftwnd_mpi_local_sizes(Forward_plan, &Local_nx, &Local_x_start,
-                          &local_ny_after_transpose, &local_y_start_after_transpose, &total_size);
+  fft_init(&total_size);
 
   Local_nx_table = malloc(sizeof(int) * NTask);
   MPI_Allgather(&Local_nx, 1, MPI_INT, Local_nx_table, 1, MPI_INT, MPI_COMM_WORLD);
 
+  Local_ny_table = malloc(sizeof(int) * NTask);
+  MPI_Allgather(&Local_ny, 1, MPI_INT, Local_ny_table, 1, MPI_INT, MPI_COMM_WORLD);
+
+  /* the ring the ghost planes go round, skipping tasks without planes */
+  Left_task = ThisTask;
+  do
+  {
+    Left_task -= NTaskY;
+    if (Left_task < 0)
+      Left_task += NTask;
+  } while (Local_nx_table[Left_task] == 0);
+
+  Right_task = ThisTask;
+  do
+  {
+    Right_task += NTaskY;
+    if (Right_task >= NTask)
+      Right_task -= NTask;
+  } while (Local_nx_table[Right_task] == 0);
+
+  /* tasks form a (NTask / NTaskY) x NTaskY grid, ThisTask = px * NTaskY + py.
+     Slab_to_task[x] is the first task of the row group owning x, and
+     Slab_to_task_y[y] the offset py within it of the task owning y */
+
   Slab_to_task = malloc(sizeof(int) * Nmesh);
+  Slab_to_task_y = malloc(sizeof(int) * Nmesh);
   slab_to_task_local = malloc(sizeof(int) * Nmesh);
 
   for (i = 0; i < Nmesh; i++)
     slab_to_task_local[i] = 0;
 
-  for (i = 0; i < Local_nx; i++)
-    slab_to_task_local[Local_x_start + i] = ThisTask;
+  if (ThisTask % NTaskY == 0)
+    for (i = 0; i < Local_nx; i++)
+      slab_to_task_local[Local_x_start + i] = ThisTask;
 
   MPI_Allreduce(slab_to_task_local, Slab_to_task, Nmesh, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
 
+  for (i = 0; i < Nmesh; i++)
+    slab_to_task_local[i] = 0;
+
+  if (ThisTask < NTaskY)
+    for (i = 0; i < Local_ny; i++)
+      slab_to_task_local[Local_y_start + i] = ThisTask;
+
+  MPI_Allreduce(slab_to_task_local, Slab_to_task_y, Nmesh, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
   free(slab_to_task_local);
 
-  additional = (Nmesh) * (2 * (Nmesh / 2 + 1)); /* additional plane on the right side */
+  /* wavenumbers along one axis, shared by all k-space loops */
+  Kgrid = malloc(sizeof(double) * Nmesh);
+  Kgrid2 = malloc(sizeof(double) * Nmesh);
+#ifdef CORRECT_CIC
+  CicWindow = malloc(sizeof(double) * Nmesh);
+#endif
 
-  TotalSizePlusAdditional = total_size + additional;
+  for (i = 0; i < Nmesh; i++)
+  {
+    if (i < Nmesh / 2)
+      Kgrid[i] = i * 2 * PI / Box;
+    else
+      Kgrid[i] = -(Nmesh - i) * 2 * PI / Box;
+
+    Kgrid2[i] = Kgrid[i] * Kgrid[i];
+
+#ifdef CORRECT_CIC
+    CicWindow[i] = 1;
+    if (Kgrid[i] != 0)
+    {
+      CicWindow[i] = (Kgrid[i] * Box / 2) / Nmesh;
+      CicWindow[i] = sin(CicWindow[i]) / CicWindow[i];
+    }
+#endif
+  }
 
-  Workspace = (fftw_real *)malloc(bytes = sizeof(fftw_real) * total_size);
+  /* ghost row on each plane plus the additional plane on the right side */
+  additional = (Local_nx + Local_ny + 1) * (2 * (Nmesh / 2 + 1));
 
-  ASSERT_ALLOC(Workspace)
+  TotalSizePlusAdditional = total_size + additional;
 
   #ifdef OUTPUT_DF
     // set the size of the coordinates and density field arrays
-    coord_DF      = malloc(sizeof(long long)*Local_nx*Nmesh*(Nmesh/2 + 1));
-    amplitudes = malloc(sizeof(float)*Local_nx*Nmesh*(Nmesh/2 + 1)); 
-    phases     = malloc(sizeof(float)*Local_nx*Nmesh*(Nmesh/2 + 1)); 
+    coord_DF      = malloc(sizeof(long long)*Local_nx*Local_ny*(Nmesh/2 + 1));
+    amplitudes = malloc(sizeof(float)*Local_nx*Local_ny*(Nmesh/2 + 1)); 
+    phases     = malloc(sizeof(float)*Local_nx*Local_ny*(Nmesh/2 + 1)); 
 
 
     if (coord_DF && amplitudes && phases) 
@@ -2587,10 +2201,14 @@ void initialize_ffts(void)
 
 void free_ffts(void)
 {
-  free(Workspace);
+#ifdef CORRECT_CIC
+  free(CicWindow);
+#endif
+  free(Kgrid2);
+  free(Kgrid);
+  free(Slab_to_task_y);
   free(Slab_to_task);
-  rfftwnd_mpi_destroy_plan(Inverse_plan);
-  rfftwnd_mpi_destroy_plan(Forward_plan);
+  fft_finalize();
 }
 
 int FatalError(int errnum)
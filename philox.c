@@ -0,0 +1,55 @@
+#include <stdint.h>
+#include "allvars.h"
+#include "proto.h"
+
+/* Counter-based random numbers for the Fourier modes (PHILOX_RNG): the
+   Philox4x32-10 bijection of Salmon et al. (2011, "Parallel random numbers:
+   as easy as 1, 2, 3") maps the counter (k, j, i, 0) under the key (Seed, 0)
+   to 128 random bits, so the draws of a mode depend on its grid position and
+   the seed only, not on the decomposition or the order of evaluation. */
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+static void philox4x32_10(uint32_t ctr[4], uint32_t key[2])
+{
+  uint64_t p0, p1;
+  uint32_t k0 = key[0], k1 = key[1];
+  int r;
+
+  for (r = 0; r < 10; r++)
+  {
+    p0 = (uint64_t)PHILOX_M0 * ctr[0];
+    p1 = (uint64_t)PHILOX_M1 * ctr[2];
+
+    ctr[0] = (uint32_t)(p1 >> 32) ^ ctr[1] ^ k0;
+    ctr[1] = (uint32_t)p1;
+    ctr[2] = (uint32_t)(p0 >> 32) ^ ctr[3] ^ k1;
+    ctr[3] = (uint32_t)p0;
+
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+}
+
+/* Two uniform deviates with 53 random bits for mode (i,j,k) of the global
+   grid: *u1 in [0,1) for the phase and *u2 in (0,1] for the amplitude, so
+   that log(*u2) is finite. */
+void philox_mode(int i, int j, int k, double *u1, double *u2)
+{
+  uint32_t ctr[4], key[2];
+
+  ctr[0] = k;
+  ctr[1] = j;
+  ctr[2] = i;
+  ctr[3] = 0;
+  key[0] = Seed;
+  key[1] = 0;
+
+  philox4x32_10(ctr, key);
+
+  *u1 = ((((uint64_t)ctr[0] << 32) | ctr[1]) >> 11) * (1.0 / 9007199254740992.0);
+  *u2 = (((((uint64_t)ctr[2] << 32) | ctr[3]) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
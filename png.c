@@ -0,0 +1,1165 @@
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <mpi.h>
+#include <complex.h>
+#include "allvars.h"
+#include "proto.h"
+
+/* Primordial non-Gaussian templates. Each routine takes the Gaussian
+   potential in k-space (cpot, with pot aliasing the same memory) and replaces
+   it by the non-Gaussian potential Phi_G + fnl * Psi[Phi_G], normalized and
+   with the zero mode removed, ready for the displacement calculation. */
+
+
+#ifdef OUTPUT_DF
+static void write_potential_field(fftw_real *pot)
+{
+  int i, j, k, coord;
+  size_t bytes;
+  fftw_real *(pot_global);
+
+  if (ThisTask == 0) printf("\nWriting linear field.");
+
+  // Define global potential for I/O. Note that it is Nmesh*Nmesh*(Nmesh+2) because of zero padding!
+  int local_size_pot = Local_nx * Nmesh * (2 * (Nmesh / 2 + 1));
+  int nprocs = (Nmesh+1) / Local_nx;  //(Nmesh + Local_nx - 1) / Local_nx;                        // Number of processes
+  pot_global = (fftw_real *)malloc(bytes = nprocs * sizeof(fftw_real) * TotalSizePlusAdditional);
+  ASSERT_ALLOC(pot_global);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  MPI_Allgather(pot, local_size_pot, MPI_FFTW_REAL, pot_global, local_size_pot, MPI_FFTW_REAL, MPI_COMM_WORLD);
+  if(ThisTask == 0){
+    // Open the file for writing
+    FILE *file = fopen("output_potential.txt", "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open output_potential.txt for writing.\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (i = 0; i < Nmesh; i++)
+      for (j = 0; j < Nmesh; j++)
+        for (k = 0; k < Nmesh; k++){
+          coord = (i * Nmesh + j) * (2 * (Nmesh / 2 + 1)) + k;
+          fprintf(file, "i= %d, j= %d, k= %d, pot= %.5e\n", i, j, k, pot_global[coord]);
+        }
+    fclose(file);
+  }
+  free(pot_global);
+}
+#endif
+
+
+/* Go back to Fourier space, remove the N^3 I got by the forward Fourier
+   transform and put zero to zero mode */
+static void finalize_potential(fftw_real *pot, fftw_complex *cpot)
+{
+  int i, j, k, coord;
+  double nmesh3;
+  double kmag;
+  struct kcolumn col;
+
+#ifdef OUTPUT_DF
+  write_potential_field(pot);
+#endif
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  fft_forward(pot);
+
+  nmesh3 = (double)Nmesh * Nmesh * Nmesh;
+  #pragma omp parallel for collapse(2) private(k, col, coord, kmag)
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
+    {
+      kspace_column(i, j, &col);
+
+      for (k = 0; k <= Nmesh / 2; k++)
+      {
+        coord = col.coord + k;
+
+        // ****************************** DSJ *************************
+        if (SphereMode == 1)
+        {
+          kmag = sqrt(col.kxy2 + Kgrid2[k]);
+
+          if (kmag * Box / (2 * PI) > Nsample / 2)
+          { /* select a sphere in k-space */
+            cpot[coord].re = 0.;
+            cpot[coord].im = 0.;
+            continue;
+          }
+        }
+        // ****************************** DSJ *************************
+
+        cpot[coord].re /= nmesh3;
+        cpot[coord].im /= nmesh3;
+      }
+    }
+
+  if (ThisTask == 0)
+  {
+    cpot[0].re = 0.;
+    cpot[0].im = 0.;
+  }
+}
+
+
+/*** For non-local models it is important to keep all factors of SQRT(-1) as done below ***/
+/*** Notice also that there is a minus to convert from Bardeen to gravitational potential ***/
+
+void png_local(fftw_complex *cpot, double fnl)
+{
+  int i, j, k, coord;
+  fftw_real *pot = (fftw_real *)cpot;
+
+
+  if (ThisTask == 0)
+  {
+    printf("Computing local non-Gaussian potential...");
+    fflush(stdout);
+  };
+
+  /******* LOCAL PRIMORDIAL POTENTIAL ************/
+  fft_inverse(pot);
+  fflush(stdout);
+
+  /* square the potential in configuration space */
+  MPI_Barrier(MPI_COMM_WORLD); // Maybe not necessary?
+  #pragma omp parallel for collapse(2) private(k, coord)
+  for (i = 0; i < Local_nx; i++)
+    for (j = 0; j < Local_ny; j++)
+      for (k = 0; k < Nmesh; k++)
+      {
+        coord = (i * Local_ny + j) * (2 * (Nmesh / 2 + 1)) + k;
+        pot[coord] = pot[coord] + fnl * pot[coord] * pot[coord];
+      }
+
+  finalize_potential(pot, cpot);
+
+  if (ThisTask == 0)
+    print_timed_done(7);
+}
+
+
+// *** Collider Addition (Start) ***
+void png_qsfi(fftw_complex *cpot, double fnl)
+{
+  int i, j, k, coord;
+  double nmesh3;
+  size_t bytes;
+  double kmag;
+  struct kcolumn col;
+  fftw_real *pot = (fftw_real *)cpot;
+
+  // |k|^Delta/3*(4-ns)~|k|^Delta for scale invariant
+  double kmag_Delta_QSFI;
+
+  // Define the k^Delta phi_G(k) field and its Fourier transform
+  fftw_complex *(ckdeltaphi);
+  fftw_real *(kdeltaphi);
+
+  // Define the auxiliary field, Psi, which is computed from kdeltaphi
+  fftw_complex *(cpsi);
+  fftw_real *(psi);
+
+  // Define squared Gaussian potential which must be subtracted to construct
+  // psi field. Note that we create a new field for this because we need to
+  // apply the high-pass filter in Fourier space on IFFT[pot^2](k).
+  fftw_complex *(cpot_sq);
+  fftw_real *(pot_sq);
+
+// ********************** Collider Addition (Start) ****************************
+  if (ThisTask == 0)
+  {
+    printf("\nComputing QSFI non-Gaussian potential... ");
+    fflush(stdout);
+  };
+
+  // Initialize FFT's for auxiliary field
+  ckdeltaphi = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+  kdeltaphi = (fftw_real *)ckdeltaphi;
+  ASSERT_ALLOC(ckdeltaphi);
+
+  cpsi = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+  psi = (fftw_real *)cpsi;
+  ASSERT_ALLOC(cpsi);
+
+  cpot_sq = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+  pot_sq = (fftw_real *)cpot_sq;
+  ASSERT_ALLOC(cpot_sq);
+
+  // Construct psi field
+  MPI_Barrier(MPI_COMM_WORLD);
+  // Clean all arrays
+  #pragma omp parallel for collapse(2) private(k, coord)
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
+      for (k = 0; k <= Nmesh / 2; k++)
+      {
+        coord = (i * Kspace_n1 + j) * (Nmesh / 2 + 1) + k;
+        ckdeltaphi[coord].re = 0.0;
+        ckdeltaphi[coord].im = 0.0;
+        cpsi[coord].re = 0.0;
+        cpsi[coord].im = 0.0;
+        cpot_sq[coord].re = 0.0;
+        cpot_sq[coord].im = 0.0;
+      }
+
+  
+  // Multiply by k^Delta
+  MPI_Barrier(MPI_COMM_WORLD);
+  #pragma omp parallel for collapse(2) private(k, col, coord, kmag, kmag_Delta_QSFI)
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
+    {
+      kspace_column(i, j, &col);
+
+      for (k = 0; k <= Nmesh / 2; k++)
+      {
+        coord = col.coord + k;
+
+        // Get knorm
+        kmag = sqrt(col.kxy2 + Kgrid2[k]);
+        kmag_Delta_QSFI = pow(kmag, Delta/3.*(4.-PrimordialIndex)); 
+        ckdeltaphi[coord].re = kmag_Delta_QSFI * cpot[coord].re;
+        ckdeltaphi[coord].im = kmag_Delta_QSFI * cpot[coord].im;
+
+      }
+    }
+
+  // Fourier transform back to real space
+  MPI_Barrier(MPI_COMM_WORLD);
+  fft_inverse_many((fftw_real *[]){pot, kdeltaphi}, 2);
+
+  // Construct psi field
+  MPI_Barrier(MPI_COMM_WORLD);
+  /* Compute real space product for psi */
+  #pragma omp parallel for collapse(2) private(k, coord)
+  for (i = 0; i < Local_nx; i++)
+    for (j = 0; j < Local_ny; j++)
+      for (k = 0; k < Nmesh; k++)
+      {
+        coord = (i * Local_ny + j) * (2 * (Nmesh / 2 + 1)) + k;
+        /* Following line computes psi(x)=phi_g(x)*F(k^DeltaPhi_g)[x]
+            To get the full psi(x) we need to do the following:
+            1) Go back to fourier space and comptue 2/k^Delta*psi(k)
+            2) Go back to real space and subtract off Phi^2(x)
+        */
+        psi[coord] = kdeltaphi[coord] * pot[coord];
+        pot_sq[coord] = pot[coord]*pot[coord]; 
+      }
+
+  // Fourier transform back to Fourier space
+  MPI_Barrier(MPI_COMM_WORLD);
+  fft_forward_many((fftw_real *[]){psi, pot_sq}, 2);
+
+  // Multiply by 2/k^Delta
+  MPI_Barrier(MPI_COMM_WORLD);
+  nmesh3 = (double)Nmesh * Nmesh * Nmesh;
+  #pragma omp parallel for collapse(2) private(k, col, coord, kmag, kmag_Delta_QSFI)
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
+    {
+      kspace_column(i, j, &col);
+
+      for (k = 0; k <= Nmesh / 2; k++)
+      {
+        coord = col.coord + k;
+
+        // Get knorm
+        kmag = sqrt(col.kxy2 + Kgrid2[k]);
+        kmag_Delta_QSFI = pow(kmag, Delta/3.*(4.-PrimordialIndex));
+
+        // Set minimum |k| for numerical stability. 1e-12 should be sufficiently
+        // small since this corresponds to kF for a ____ Gpc box (in units of h/kpc)
+        if (kmag_Delta_QSFI < 1e-12){
+          kmag_Delta_QSFI = 1e-12;
+        }
+        cpsi[coord].re = 2. / kmag_Delta_QSFI * cpsi[coord].re - cpot_sq[coord].re;
+        cpsi[coord].im = 2. / kmag_Delta_QSFI * cpsi[coord].im - cpot_sq[coord].im;
+
+        // Apply high-pass filter
+        // if((kmag * 1000) < Klong_max){
+        //   cpsi[coord].re = 0.;
+        //   cpsi[coord].im = 0.;
+        // }
+
+        cpsi[coord].re *= 0.5*(1 + tanh((kmag*1000 - 0.08) /(0.01) - 1 ));
+        cpsi[coord].im *= 0.5*(1 + tanh((kmag*1000 - 0.08) /(0.01) - 1 ));
+
+        // Normalize from FFT and set zero mode to zero
+        cpsi[coord].re /= nmesh3; 
+        cpsi[coord].im /= nmesh3;
+        if(col.kxy2 == 0 && k == 0){
+          cpsi[0].re=0.;
+          cpsi[0].im=0.;
+          continue;
+        }
+
+      }
+    }
+
+  // Go back to real space and add psi to phi
+  MPI_Barrier(MPI_COMM_WORLD);
+  fft_inverse(psi);
+  
+  MPI_Barrier(MPI_COMM_WORLD);
+  #pragma omp parallel for collapse(2) private(k, coord)
+  for (i = 0; i < Local_nx; i++)
+    for (j = 0; j < Local_ny; j++)
+      for (k = 0; k < Nmesh; k++){
+        coord = (i * Local_ny + j) * (2 * (Nmesh / 2 + 1)) + k; 
+        pot[coord] = pot[coord] + fnl * (psi[coord]); 
+
+  }
+
+  fft_free(cpsi);
+  fft_free(ckdeltaphi);
+  fft_free(cpot_sq);
+
+  finalize_potential(pot, cpot);
+
+  if (ThisTask == 0)
+    print_timed_done(1);
+}
+
+
+/* Oscillatory (collider) template. With K_pm(k) = k^(Delta +- i Nu), the
+   auxiliary field is
+     psi = sum_pm e^(+-i Phase) [ FFT[phi IFFT[K_pm phi]] / K_pm - FFT[phi^2] / 2 ],
+   high-pass filtered. K_- = K_+^* and both are even in k, so for real phi
+   IFFT[K_pm phi] = c +- i s with the real fields c = IFFT[Re(K_+) phi] and
+   s = IFFT[Im(K_+) phi]. Everything therefore follows from the local
+   half-complex grids and the ordinary real transforms, on any decomposition. */
+void png_osc(fftw_complex *cpot, double fnl)
+{
+  int i, j, k, coord;
+  double nmesh3;
+  size_t bytes;
+  double kmag;
+  struct kcolumn col;
+  fftw_real *pot = (fftw_real *)cpot;
+
+  // Define momentum powers |k|^{0.5*(4-ns)+i\nu}~|k|^3/2+i\nu for scale
+  // invariant
+  double complex kmag_Delta_plus_inu;
+  double complex kmag_Delta_min_inu;
+
+  // Define phase coefficients e^{i delta}
+  double complex exp_plus_iphase;
+  double complex exp_min_iphase;
+
+  double complex temp_cpsi_plus, temp_cpsi_min, temp_cos, temp_sin, temp_sq;
+
+  // Re and Im of k^{Delta+i\nu} times phi_G(k); they become phi*c and phi*s
+  fftw_complex *(ck_cos_phi);
+  fftw_real *(k_cos_phi);
+  fftw_complex *(ck_sin_phi);
+  fftw_real *(k_sin_phi);
+
+  // Define the auxiliary field, Psi=Psi_plus+Psi_minus; it reuses ck_cos_phi
+  fftw_complex *(cpsi);
+  fftw_real *(psi);
+
+  // Define squared Gaussian potential which must be subtracted to construct
+  // psi field.
+  fftw_complex *(cpot_sq);
+  fftw_real *(pot_sq);
+
+  if (ThisTask == 0)
+  {
+    printf("Computing oscillatory bispectra non-Gaussian potential... ");
+    fflush(stdout);
+  };
+
+  ck_cos_phi = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+  k_cos_phi = (fftw_real *)ck_cos_phi;
+  ASSERT_ALLOC(ck_cos_phi);
+
+  ck_sin_phi = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+  k_sin_phi = (fftw_real *)ck_sin_phi;
+  ASSERT_ALLOC(ck_sin_phi);
+
+  cpot_sq = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+  pot_sq = (fftw_real *)cpot_sq;
+  ASSERT_ALLOC(cpot_sq);
+
+  // Multiply by the real and imaginary parts of k^(Delta+iNu)
+  MPI_Barrier(MPI_COMM_WORLD);
+  #pragma omp parallel for collapse(2) private(k, col, coord, kmag, kmag_Delta_plus_inu)
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
+    {
+      kspace_column(i, j, &col);
+
+      for (k = 0; k <= Nmesh / 2; k++)
+      {
+        coord = col.coord + k;
+
+        kmag = sqrt(col.kxy2 + Kgrid2[k]);
+
+        if (kmag == 0)
+        {
+          ck_cos_phi[coord].re = ck_cos_phi[coord].im = 0.0;
+          ck_sin_phi[coord].re = ck_sin_phi[coord].im = 0.0;
+          continue;
+        }
+
+        kmag_Delta_plus_inu = cexp(log(kmag) * (Delta + I * Nu)) + 1.e-20; // Regularize
+
+        ck_cos_phi[coord].re = creal(kmag_Delta_plus_inu) * cpot[coord].re;
+        ck_cos_phi[coord].im = creal(kmag_Delta_plus_inu) * cpot[coord].im;
+        ck_sin_phi[coord].re = cimag(kmag_Delta_plus_inu) * cpot[coord].re;
+        ck_sin_phi[coord].im = cimag(kmag_Delta_plus_inu) * cpot[coord].im;
+      }
+    }
+
+  // Go back to real space
+  MPI_Barrier(MPI_COMM_WORLD);
+  fft_inverse_many((fftw_real *[]){pot, k_cos_phi, k_sin_phi}, 3);
+
+  /* Compute real space products: phi*c, phi*s and phi^2 */
+  MPI_Barrier(MPI_COMM_WORLD);
+  #pragma omp parallel for collapse(2) private(k, coord)
+  for (i = 0; i < Local_nx; i++)
+    for (j = 0; j < Local_ny; j++)
+      for (k = 0; k < Nmesh; k++)
+      {
+        coord = (i * Local_ny + j) * (2 * (Nmesh / 2 + 1)) + k;
+
+        k_cos_phi[coord] *= pot[coord];
+        k_sin_phi[coord] *= pot[coord];
+        pot_sq[coord] = pot[coord] * pot[coord];
+      }
+
+  // Fourier transform back to Fourier space
+  MPI_Barrier(MPI_COMM_WORLD);
+  fft_forward_many((fftw_real *[]){k_cos_phi, k_sin_phi, pot_sq}, 3);
+
+  /* Construct psi field: FFT[phi IFFT[K_pm phi]] = FFT[phi c] +- i FFT[phi s] */
+  cpsi = ck_cos_phi;
+  psi = k_cos_phi;
+
+  // Compute exp(+\- phase)
+  exp_plus_iphase = cexp(I * Phase);
+  exp_min_iphase = cexp(-I * Phase);
+
+  nmesh3 = (double)Nmesh * Nmesh * Nmesh;
+  #pragma omp parallel for collapse(2) private(k, col, coord, kmag, kmag_Delta_plus_inu, kmag_Delta_min_inu, \
+                                               temp_cpsi_plus, temp_cpsi_min, temp_cos, temp_sin, temp_sq)
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
+    {
+      kspace_column(i, j, &col);
+
+      for (k = 0; k <= Nmesh / 2; k++)
+      {
+        coord = col.coord + k;
+
+        // Get knorm; the zero mode is set to zero
+        kmag = sqrt(col.kxy2 + Kgrid2[k]);
+
+        if (kmag == 0)
+        {
+          cpsi[coord].re = 0.;
+          cpsi[coord].im = 0.;
+          continue;
+        }
+
+        // Compute k^{3/2} +/- iNu
+        kmag_Delta_plus_inu = cexp(log(kmag) * (Delta + I * Nu)) + 1.e-20; // Regularize
+        kmag_Delta_min_inu = cexp(log(kmag) * (Delta - I * Nu)) + 1.e-20;
+
+        temp_cos = ck_cos_phi[coord].re + I * ck_cos_phi[coord].im;
+        temp_sin = ck_sin_phi[coord].re + I * ck_sin_phi[coord].im;
+        temp_sq = cpot_sq[coord].re + I * cpot_sq[coord].im;
+
+        temp_cpsi_plus = (temp_cos + I * temp_sin) / kmag_Delta_plus_inu;
+        temp_cpsi_min = (temp_cos - I * temp_sin) / kmag_Delta_min_inu;
+
+        // Subtract off 0.5 phi^2(x) and multiply by phase
+        temp_cpsi_plus -= 0.5 * temp_sq;
+        temp_cpsi_min -= 0.5 * temp_sq;
+        temp_cpsi_plus *= exp_plus_iphase;
+        temp_cpsi_min *= exp_min_iphase;
+
+        // Set final psi array
+        cpsi[coord].re = creal(temp_cpsi_plus) + creal(temp_cpsi_min);
+        cpsi[coord].im = cimag(temp_cpsi_plus) + cimag(temp_cpsi_min);
+
+        // Apply high-pass filter (in h/Mpc)
+        cpsi[coord].re *= 0.5 * (1 + tanh((kmag * 1000 - 0.08) / (0.01) - 1));
+        cpsi[coord].im *= 0.5 * (1 + tanh((kmag * 1000 - 0.08) / (0.01) - 1));
+
+        // Normalize from FFT
+        cpsi[coord].re /= nmesh3;
+        cpsi[coord].im /= nmesh3;
+      }
+    }
+
+  fft_free(ck_sin_phi);
+  fft_free(cpot_sq);
+
+  // Go back to real space and add psi to phi
+  MPI_Barrier(MPI_COMM_WORLD);
+  fft_inverse(psi);
+
+  #pragma omp parallel for collapse(2) private(k, coord)
+  for (i = 0; i < Local_nx; i++)
+    for (j = 0; j < Local_ny; j++)
+      for (k = 0; k < Nmesh; k++)
+      {
+        coord = (i * Local_ny + j) * (2 * (Nmesh / 2 + 1)) + k;
+        pot[coord] = pot[coord] + fnl * (psi[coord]);
+      }
+
+  fft_free(cpsi);
+
+  finalize_potential(pot, cpot);
+
+  if (ThisTask == 0)
+    print_timed_done(1);
+}
+// *** Collider Addition (End) ***
+
+
+/* Separable templates. The non-local shapes are sums of terms
+
+     Psi(k) = sum_t c_t k^{o_t} FT[ (k^{a_t} Phi)(x) (k^{b_t} Phi)(x) ]
+
+   with the powers of k in units of (4 - n_s)/3, so that k^1 stands for
+   P_Phi(k)^{-1/3} (the kmag_1_over_3 of the original code). The equilateral,
+   orthogonal and orthogonal-LSS shapes are built-in tables of such terms, the
+   `separable' one is read from the `PngTerms' parameter.
+
+   The engine transforms each distinct leg k^a Phi once to real space, merges
+   all terms with the same output power into one product grid there, and
+   transforms each of these back once: nleg inverse plus nout forward FFTs.
+   The products overwrite the legs point by point, so max(nleg, nout) grids
+   are held on top of cpot, which stays in k-space throughout.
+
+   With LOWMEM_PNG the terms are streamed instead: bundles of terms sharing a
+   leg and an output are formed one at a time in two work grids, transformed
+   back and added into a third, so that any shape needs three grids on top of
+   cpot, at the price of transforming the legs again for every bundle. */
+
+struct separable_plan
+{
+  int nterm, nleg, nout;
+  double leg[2 * MAXPNGTERMS];  /* distinct leg powers */
+  double out[MAXPNGTERMS];      /* distinct output powers */
+  double coef[MAXPNGTERMS];
+  int tleg[MAXPNGTERMS][2];     /* legs of each term */
+  int tout[MAXPNGTERMS];        /* output of each term */
+};
+
+static int same_power(double a, double b)
+{
+  return fabs(a - b) < 1e-9;
+}
+
+/* coefficient and powers of the built-in shapes, Appendix A of Coulton et al.
+   for ortog_lss; returns the number of terms */
+static int builtin_terms(int type, struct png_term *term)
+{
+  double orth_p = 27.0 / (-21.0 + 743.0 / (7 * (20.0 * pow(PI, 2.0) - 193.0)));
+  double orth_t = (2.0 + 20.0 / 9.0 * orth_p) / (6 * (1.0 + 5.0 / 9.0 * orth_p));
+  struct png_term equil[] = {
+      {-3.0, {0, 0}, 0}, {-2.0, {1, 1}, -2}, {4.0, {0, 1}, -1}, {2.0, {0, 2}, -2}};
+  struct png_term ortog[] = {
+      {-9.0, {0, 0}, 0}, {-8.0, {1, 1}, -2}, {10.0, {0, 1}, -1}, {8.0, {0, 2}, -2}};
+  struct png_term ortog_lss[] = {
+      {-3.0 * (1.0 + 1.0 / 3.0 * orth_p), {0, 0}, 0},
+      {-(2.0 + 20. / 9. * orth_p), {1, 1}, -2},
+      {6.0 * (1.0 + 5.0 / 9.0 * orth_p) * (1.0 - orth_t), {0, 1}, -1},
+      {6.0 * (1.0 + 5.0 / 9.0 * orth_p) * orth_t, {0, 2}, -2},
+      {orth_p / 9.0, {-1, -1}, 2},    /* K12D */
+      {-20.0 * orth_p / 9.0, {2, -1}, -1}, /* K12E */
+      {-4.0 * orth_p / 3.0, {0, -1}, 1},   /* K12F */
+      {10.0 / 3.0 * orth_p, {1, -1}, 0}};  /* K12G */
+
+  switch (type)
+  {
+  case PNG_EQUIL:
+    memcpy(term, equil, sizeof(equil));
+    return 4;
+  case PNG_ORTOG:
+    memcpy(term, ortog, sizeof(ortog));
+    return 4;
+  case PNG_ORTOG_LSS:
+    memcpy(term, ortog_lss, sizeof(ortog_lss));
+    return 8;
+#if defined(SEPARABLE_FNL) || defined(PNG_BATCH)
+  case PNG_SEPARABLE:
+    memcpy(term, PngTerm, NumPngTerms * sizeof(struct png_term));
+    return NumPngTerms;
+#endif
+  }
+
+  if (ThisTask == 0)
+    printf("template %s is not a separable one\n", png_template_name(type));
+  FatalError(131);
+  return 0;
+}
+
+/* merges the terms of a shape that share both legs and the output, and
+   collects the distinct legs and outputs */
+static void plan_separable(int type, struct separable_plan *plan)
+{
+  struct png_term term[MAXPNGTERMS];
+  int nterm, t, u, l, m;
+  double a, b;
+
+  nterm = builtin_terms(type, term);
+  plan->nterm = plan->nleg = plan->nout = 0;
+
+  for (t = 0; t < nterm; t++)
+  {
+    a = term[t].Leg[0];
+    b = term[t].Leg[1];
+
+    for (u = 0; u < plan->nterm; u++)
+      if (same_power(plan->out[plan->tout[u]], term[t].Out) &&
+          ((same_power(plan->leg[plan->tleg[u][0]], a) && same_power(plan->leg[plan->tleg[u][1]], b)) ||
+           (same_power(plan->leg[plan->tleg[u][0]], b) && same_power(plan->leg[plan->tleg[u][1]], a))))
+        break;
+
+    if (u < plan->nterm)
+    {
+      plan->coef[u] += term[t].Coef;
+      continue;
+    }
+
+    for (m = 0; m < 2; m++)
+    {
+      for (l = 0; l < plan->nleg; l++)
+        if (same_power(plan->leg[l], term[t].Leg[m]))
+          break;
+      if (l == plan->nleg)
+        plan->leg[plan->nleg++] = term[t].Leg[m];
+      plan->tleg[u][m] = l;
+    }
+
+    for (l = 0; l < plan->nout; l++)
+      if (same_power(plan->out[l], term[t].Out))
+        break;
+    if (l == plan->nout)
+      plan->out[plan->nout++] = term[t].Out;
+    plan->tout[u] = l;
+
+    plan->coef[u] = term[t].Coef;
+    plan->nterm++;
+  }
+}
+
+#ifdef LOWMEM_PNG
+/* Collects the next bundle of output o for the streamed engine: the terms not
+   done yet that share the leg (returned in shared) found in most of them.
+   The other legs of a bundle are summed in k-space into one, so a bundle
+   costs two inverse FFTs (one if all its terms are squares of the shared
+   leg) and one forward FFT. Returns the number of terms, 0 once output o is
+   complete. */
+static int next_bundle(struct separable_plan *plan, int o, int *done, int *bundle, int *shared)
+{
+  int t, l, n, best = 0;
+
+  for (l = 0; l < plan->nleg; l++)
+  {
+    for (t = 0, n = 0; t < plan->nterm; t++)
+      if (!done[t] && plan->tout[t] == o && (plan->tleg[t][0] == l || plan->tleg[t][1] == l))
+        n++;
+    if (n > best)
+    {
+      best = n;
+      *shared = l;
+    }
+  }
+
+  for (t = 0, n = 0; t < plan->nterm && best > 0; t++)
+    if (!done[t] && plan->tout[t] == o && (plan->tleg[t][0] == *shared || plan->tleg[t][1] == *shared))
+    {
+      done[t] = 1;
+      bundle[n++] = t;
+    }
+
+  return n;
+}
+
+/* the leg of term t that is not the shared one */
+static int other_leg(struct separable_plan *plan, int t, int shared)
+{
+  return plan->tleg[t][0] == shared ? plan->tleg[t][1] : plan->tleg[t][0];
+}
+#endif
+
+/* grids png_separable() holds on top of cpot, and its number of FFTs */
+void png_separable_cost(int type, int *grids, int *ffts)
+{
+  struct separable_plan plan;
+#ifdef LOWMEM_PNG
+  int o, t, n, shared, square, done[MAXPNGTERMS], bundle[MAXPNGTERMS];
+#endif
+
+  plan_separable(type, &plan);
+
+#ifdef LOWMEM_PNG
+  *grids = 3;
+  *ffts = 0;
+  for (t = 0; t < plan.nterm; t++)
+    done[t] = 0;
+  for (o = 0; o < plan.nout; o++)
+    while ((n = next_bundle(&plan, o, done, bundle, &shared)))
+    {
+      for (t = 0, square = 1; t < n; t++)
+        if (other_leg(&plan, bundle[t], shared) != shared)
+          square = 0;
+      *ffts += 3 - square;
+    }
+#else
+  *grids = plan.nleg > plan.nout ? plan.nleg : plan.nout;
+  *ffts = plan.nleg + plan.nout;
+#endif
+}
+
+/* k^p in the units above, from k^2; the negative powers are taken as
+   divisions, as the original kernels were */
+static double kpower(double kmag2, double p)
+{
+  if (p == 0)
+    return 1.0;
+  if (p > 0)
+    return pow(kmag2, p * (4. - PrimordialIndex) / 6.);
+  return 1.0 / pow(kmag2, -p * (4. - PrimordialIndex) / 6.);
+}
+
+/* cleg = sum_n coef[n] k^kpow[n] cpot, in k-space; the zero mode is only
+   kept by the zero powers */
+static void separable_leg(fftw_complex *cpot, fftw_complex *cleg, int n, double *coef, double *kpow)
+{
+  int i, j, k, m, coord;
+  double kmag2, fac;
+  struct kcolumn col;
+
+  #pragma omp parallel for collapse(2) private(k, m, col, coord, kmag2, fac)
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
+    {
+      kspace_column(i, j, &col);
+
+      for (k = 0; k <= Nmesh / 2; k++)
+      {
+        coord = col.coord + k;
+        kmag2 = col.kxy2 + Kgrid2[k];
+
+        for (m = 0, fac = 0; m < n; m++)
+          if (kmag2 == 0)
+            fac += (kpow[m] == 0) * coef[m];
+          else
+            fac += coef[m] * kpower(kmag2, kpow[m]);
+
+        cleg[coord].re = fac * cpot[coord].re;
+        cleg[coord].im = fac * cpot[coord].im;
+      }
+    }
+}
+
+/* cpot += fnl * sum_l k^out[l] cgrid[l] / N^3, with the zero mode removed
+   and the sphere cut applied */
+static void add_separable(fftw_complex *cpot, fftw_complex **cgrid, double *out, int nout, double fnl)
+{
+  int i, j, k, l, coord;
+  double nmesh3;
+  double kmag, kmag2, fac, re, im;
+  struct kcolumn col;
+
+  nmesh3 = (double)Nmesh * Nmesh * Nmesh;
+
+  #pragma omp parallel for collapse(2) private(k, l, col, coord, kmag, kmag2, fac, re, im)
+  for (i = 0; i < Kspace_n0; i++)
+    for (j = 0; j < Kspace_n1; j++)
+    {
+      kspace_column(i, j, &col);
+
+      for (k = 0; k <= Nmesh / 2; k++)
+      {
+        coord = col.coord + k;
+        kmag2 = col.kxy2 + Kgrid2[k];
+
+        if (kmag2 == 0)
+        {
+          cpot[coord].re = 0.;
+          cpot[coord].im = 0.;
+          continue;
+        }
+
+        // ****************************** DSJ *************************
+        if (SphereMode == 1)
+        {
+          kmag = sqrt(kmag2);
+          if (kmag * Box / (2 * PI) > Nsample / 2)
+          { /* select a sphere in k-space */
+            cpot[coord].re = 0.;
+            cpot[coord].im = 0.;
+            continue;
+          }
+        }
+        // ****************************** DSJ *************************
+
+        re = im = 0;
+        for (l = 0; l < nout; l++)
+        {
+          fac = kpower(kmag2, out[l]);
+          re += fac * cgrid[l][coord].re;
+          im += fac * cgrid[l][coord].im;
+        }
+
+        cpot[coord].re += fnl * re / nmesh3;
+        cpot[coord].im += fnl * im / nmesh3;
+      }
+    }
+}
+
+#ifdef LOWMEM_PNG
+/* Streamed engine: the bundles are formed one after the other in two work
+   grids, transformed back, and their output kernels applied while adding them
+   into cpsi. Three grids on top of cpot whatever the shape, for more FFTs. */
+static void separable_streamed(fftw_complex *cpot, struct separable_plan *plan, double fnl)
+{
+  int i, j, k, coord, o, t, n, shared, square;
+  int done[MAXPNGTERMS], bundle[MAXPNGTERMS];
+  size_t bytes;
+  double kmag2, fac, coef[MAXPNGTERMS], kpow[MAXPNGTERMS], out = 0, one = 1.0;
+  struct kcolumn col;
+  fftw_complex *(cpsi), *(cleg), *(cother);
+  fftw_real *(leg), *(other);
+
+  cpsi = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+  ASSERT_ALLOC(cpsi);
+  cleg = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+  leg = (fftw_real *)cleg;
+  ASSERT_ALLOC(cleg);
+  cother = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+  other = (fftw_real *)cother;
+  ASSERT_ALLOC(cother);
+
+  memset(cpsi, 0, bytes);
+
+  for (t = 0; t < plan->nterm; t++)
+    done[t] = 0;
+
+  for (o = 0; o < plan->nout; o++)
+    while ((n = next_bundle(plan, o, done, bundle, &shared)))
+    {
+      for (t = 0, square = 1, fac = 0; t < n; t++)
+      {
+        coef[t] = plan->coef[bundle[t]];
+        kpow[t] = plan->leg[other_leg(plan, bundle[t], shared)];
+        fac += coef[t];
+        if (other_leg(plan, bundle[t], shared) != shared)
+          square = 0;
+      }
+
+      /* the shared leg, and the sum of the others weighted by their coefficients */
+      separable_leg(cpot, cleg, 1, &one, &plan->leg[shared]);
+      if (square)
+        fft_inverse(leg);
+      else
+      {
+        separable_leg(cpot, cother, n, coef, kpow);
+        fft_inverse_many((fftw_real *[]){leg, other}, 2);
+      }
+
+      #pragma omp parallel for collapse(2) private(k, coord)
+      for (i = 0; i < Local_nx; i++)
+        for (j = 0; j < Local_ny; j++)
+          for (k = 0; k < Nmesh; k++)
+          {
+            coord = (i * Local_ny + j) * (2 * (Nmesh / 2 + 1)) + k;
+            if (square)
+              leg[coord] = fac * leg[coord] * leg[coord];
+            else
+              leg[coord] = leg[coord] * other[coord];
+          }
+
+      fft_forward(leg);
+
+      /* output kernel; the zero mode is dropped in add_separable() */
+      #pragma omp parallel for collapse(2) private(k, col, coord, kmag2, fac)
+      for (i = 0; i < Kspace_n0; i++)
+        for (j = 0; j < Kspace_n1; j++)
+        {
+          kspace_column(i, j, &col);
+
+          for (k = 0; k <= Nmesh / 2; k++)
+          {
+            coord = col.coord + k;
+            kmag2 = col.kxy2 + Kgrid2[k];
+            if (kmag2 == 0)
+              continue;
+
+            fac = kpower(kmag2, plan->out[o]);
+            cpsi[coord].re += fac * cleg[coord].re;
+            cpsi[coord].im += fac * cleg[coord].im;
+          }
+        }
+    }
+
+  fft_free(cother);
+  fft_free(cleg);
+
+  add_separable(cpot, &cpsi, &out, 1, fnl);
+
+  fft_free(cpsi);
+}
+#else
+/* Full engine: all legs are transformed at once, then all outputs */
+static void separable_full(fftw_complex *cpot, struct separable_plan *plan, double fnl)
+{
+  int i, j, k, coord, l, t, ngrid;
+  size_t bytes;
+  double one = 1.0;
+  fftw_complex *(cgrid[2 * MAXPNGTERMS]);
+  fftw_real *(grid[2 * MAXPNGTERMS]);
+
+  ngrid = plan->nleg > plan->nout ? plan->nleg : plan->nout;
+
+  for (l = 0; l < ngrid; l++)
+  {
+    cgrid[l] = (fftw_complex *)fft_malloc(bytes = sizeof(fftw_real) * TotalSizePlusAdditional);
+    grid[l] = (fftw_real *)cgrid[l];
+    ASSERT_ALLOC(cgrid[l]);
+  }
+
+  /* the legs k^a Phi */
+  for (l = 0; l < plan->nleg; l++)
+    separable_leg(cpot, cgrid[l], 1, &one, &plan->leg[l]);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  fft_inverse_many(grid, plan->nleg);
+
+  /* products of the legs, summed over the terms of each output power;
+     grid l is read before output l is written at every point */
+
+  #pragma omp parallel for collapse(2) private(k, l, t, coord)
+  for (i = 0; i < Local_nx; i++)
+    for (j = 0; j < Local_ny; j++)
+      for (k = 0; k < Nmesh; k++)
+      {
+        double leg[2 * MAXPNGTERMS], sum[MAXPNGTERMS];
+
+        coord = (i * Local_ny + j) * (2 * (Nmesh / 2 + 1)) + k;
+
+        for (l = 0; l < plan->nleg; l++)
+          leg[l] = grid[l][coord];
+        for (l = 0; l < plan->nout; l++)
+          sum[l] = 0;
+
+        for (t = 0; t < plan->nterm; t++)
+          sum[plan->tout[t]] += plan->coef[t] * leg[plan->tleg[t][0]] * leg[plan->tleg[t][1]];
+
+        for (l = 0; l < plan->nout; l++)
+          grid[l][coord] = sum[l];
+      }
+
+  for (l = plan->nout; l < ngrid; l++)
+    fft_free(cgrid[l]);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  fft_forward_many(grid, plan->nout);
+
+  /* apply the output kernels and add to the Gaussian potential,
+     removing the N^3 I got by the forward Fourier transforms */
+  add_separable(cpot, cgrid, plan->out, plan->nout, fnl);
+
+  for (l = 0; l < plan->nout; l++)
+    fft_free(cgrid[l]);
+}
+#endif
+
+void png_separable(fftw_complex *cpot, int type, double fnl)
+{
+  struct separable_plan plan;
+
+  plan_separable(type, &plan);
+
+  if (ThisTask == 0)
+  {
+    if (type == PNG_EQUIL)
+      printf("Computing equilateral non-Gaussian potential...");
+    if (type == PNG_ORTOG)
+      printf("Computing orthogonal non-Gaussian potential... ");
+    if (type == PNG_ORTOG_LSS)
+      printf("Computing orthogonal-LSS non-Gaussian potential... ");
+    if (type == PNG_SEPARABLE)
+      printf("Computing separable non-Gaussian potential (%d terms, %d legs, %d outputs)...", plan.nterm,
+             plan.nleg, plan.nout);
+    fflush(stdout);
+  };
+
+#ifdef LOWMEM_PNG
+  separable_streamed(cpot, &plan, fnl);
+#else
+  separable_full(cpot, &plan, fnl);
+#endif
+
+  if (ThisTask == 0)
+    print_timed_done(1);
+}
+
+
+/* Replaces the Gaussian potential in cpot by the non-Gaussian potential of
+   the given template shape (the grids and FFTs of each shape are tallied in
+   template_cost() of dryrun.c) */
+void png_potential(fftw_complex *cpot, int type, double fnl)
+{
+  switch (type)
+  {
+  case PNG_LOCAL:
+    png_local(cpot, fnl);
+    break;
+  case PNG_EQUIL:
+  case PNG_ORTOG:
+  case PNG_ORTOG_LSS:
+  case PNG_SEPARABLE:
+    png_separable(cpot, type, fnl);
+    break;
+  case PNG_QSFI:
+    png_qsfi(cpot, fnl);
+    break;
+  case PNG_OSC:
+    png_osc(cpot, fnl);
+    break;
+  default:
+    if (ThisTask == 0)
+      printf("unknown non-Gaussian template type %d\n", type);
+    FatalError(130);
+  }
+}
+
+
+static char *Png_template_names[] = {"local", "equil", "ortog", "ortog_lss", "qsfi", "osc", "separable"};
+
+char *png_template_name(int type)
+{
+  if (type < 0 || type >= PNG_NTYPES)
+    return "unknown";
+  return Png_template_names[type];
+}
+
+#ifdef PNG_BATCH
+/* Parses the `PngTemplates' parameter, a comma separated list of
+   <template>:<fnl> pairs, e.g. "local:100,equil:-50,ortog_lss:20".
+   Returns 0 on success. */
+int parse_png_templates(char *list)
+{
+  char buf[500], *tok, *sep, *end;
+  int type;
+
+  strcpy(buf, list);
+  NumPngTemplates = 0;
+
+  for (tok = strtok(buf, ","); tok; tok = strtok(NULL, ","))
+  {
+    if (!(sep = strchr(tok, ':')))
+    {
+      if (ThisTask == 0)
+        printf("PngTemplates: entry '%s' is not of the form <template>:<fnl>\n", tok);
+      return 1;
+    }
+    *sep = 0;
+
+    for (type = 0; type < PNG_NTYPES; type++)
+      if (strcmp(tok, Png_template_names[type]) == 0)
+        break;
+
+    if (type == PNG_NTYPES)
+    {
+      if (ThisTask == 0)
+        printf("PngTemplates: unknown template '%s' (allowed: local, equil, ortog, ortog_lss, qsfi, osc, separable)\n", tok);
+      return 1;
+    }
+
+    if (NumPngTemplates >= MAXPNGTEMPLATES)
+    {
+      if (ThisTask == 0)
+        printf("PngTemplates: at most %d templates per run are supported\n", MAXPNGTEMPLATES);
+      return 1;
+    }
+
+    PngTemplate[NumPngTemplates].Shape = type;
+    PngTemplate[NumPngTemplates].Fnl = strtod(sep + 1, &end);
+
+    if (end == sep + 1 || *end != 0)
+    {
+      if (ThisTask == 0)
+        printf("PngTemplates: cannot read fnl value '%s' for template '%s'\n", sep + 1, tok);
+      return 1;
+    }
+
+    NumPngTemplates++;
+  }
+
+  if (NumPngTemplates == 0)
+  {
+    if (ThisTask == 0)
+      printf("PngTemplates: no templates given\n");
+    return 1;
+  }
+
+  return 0;
+}
+#endif
+
+#if defined(SEPARABLE_FNL) || defined(PNG_BATCH)
+/* Parses the `PngTerms' parameter, a comma separated list of
+   <coef>:<leg1>:<leg2>:<out> terms of the separable template (see
+   png_separable()), e.g. the equilateral one is
+   "-3:0:0:0,-2:1:1:-2,4:0:1:-1,2:0:2:-2". Returns 0 on success. */
+int parse_png_terms(char *list)
+{
+  char buf[200], *tok, *p, *end;
+  double val[4];
+  int n;
+
+  strcpy(buf, list);
+  NumPngTerms = 0;
+
+  for (tok = strtok(buf, ","); tok; tok = strtok(NULL, ","))
+  {
+    for (n = 0, p = tok; n < 4; n++, p = end + 1)
+    {
+      val[n] = strtod(p, &end);
+      if (end == p || *end != (n < 3 ? ':' : 0))
+      {
+        if (ThisTask == 0)
+          printf("PngTerms: term '%s' is not of the form <coef>:<leg1>:<leg2>:<out>\n", tok);
+        return 1;
+      }
+    }
+
+    if (NumPngTerms >= MAXPNGTERMS)
+    {
+      if (ThisTask == 0)
+        printf("PngTerms: at most %d terms per template are supported\n", MAXPNGTERMS);
+      return 1;
+    }
+
+    PngTerm[NumPngTerms].Coef = val[0];
+    PngTerm[NumPngTerms].Leg[0] = val[1];
+    PngTerm[NumPngTerms].Leg[1] = val[2];
+    PngTerm[NumPngTerms].Out = val[3];
+    NumPngTerms++;
+  }
+
+  if (NumPngTerms == 0)
+  {
+    if (ThisTask == 0)
+      printf("PngTerms: no terms given\n");
+    return 1;
+  }
+
+  return 0;
+}
+#endif
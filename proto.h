@@ -7,10 +7,12 @@ double GrowthFactor(double astart, double aend);
 void   print_spec(void);
 int    FatalError(int errnum);
 void   displacement_fields(void);
+void   print_timed_done(int n);
 void   initialize_ffts(void);
 void   set_units(void);
 void   assemble_particles(void);
 void   free_ffts(void);
+void   dry_run(void);
 double fnl(double x);
 
 int find_files(char *fname);
@@ -50,6 +52,9 @@ int    compare_transfer_logk(const void *a,const void *b);
 void  write_particle_data(void);
 void  read_parameterfile(char *fname);
 void  read_glass(char *fname);
+#ifdef LATTICE_LOAD
+void  read_lattice(void);
+#endif
 
 void checkchoose(void);
 
@@ -60,10 +65,55 @@ size_t my_fread(void *ptr, size_t size, size_t nmemb, FILE * stream);
 size_t my_fwrite(void *ptr, size_t size, size_t nmemb, FILE * stream);
 
 void save_local_data(void);
+void save_aggregated_data(void);
+#ifdef ASYNC_OUTPUT
+void finish_output(void);
+#endif
+FILE *open_output(char *fname);
+void close_output(FILE *fd);
+void particle_types(long long npart_total[6], double mass[6]);
+void local_types(struct ptype_part part[6]);
+size_t block_bytes(enum snap_block block);
+void pack_block(enum snap_block block, struct ptype_part *part, int start, int n, void *buf);
+#ifdef HDF5_OUTPUT
+void write_hdf5_snapshot(void);
+#endif
+#ifdef COMPACT_OUTPUT
+void write_compact_snapshot(void);
+#endif
 void add_WDM_thermal_speeds(float *vel);
 
 int compare_type(const void *a, const void *b);
 
+void  fft_init(int *local_size);
+size_t fft_sizes(int *local_size);
+void  fft_finalize(void);
+void  fft_forward(fftw_real *data);
+void  fft_inverse(fftw_real *data);
+void  fft_forward_many(fftw_real **data, int n);
+void  fft_inverse_many(fftw_real **data, int n);
+#ifdef TRANSPOSED_KSPACE
+void  fft_transpose_kspace(fftw_real *data);
+#endif
+void *fft_malloc(size_t n);
+void  fft_free(void *p);
+
+void  philox_mode(int i, int j, int k, double *u1, double *u2);
+
+void  png_potential(fftw_complex *cpot, int type, double fnl);
+void  png_local(fftw_complex *cpot, double fnl);
+void  png_separable(fftw_complex *cpot, int type, double fnl);
+void  png_separable_cost(int type, int *grids, int *ffts);
+void  png_qsfi(fftw_complex *cpot, double fnl);
+void  png_osc(fftw_complex *cpot, double fnl);
+char *png_template_name(int type);
+#ifdef PNG_BATCH
+int   parse_png_templates(char *list);
+#endif
+#if defined(SEPARABLE_FNL) || defined(PNG_BATCH)
+int   parse_png_terms(char *list);
+#endif
+
 #ifdef OUTPUT_DF
 void write_density_field_data(void);
 void write_phi_lin_field_data(void);
@@ -1,138 +1,102 @@
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
 #include "allvars.h"
 #include "proto.h"
 
 
-
-
-void read_glass(char *fname)
+/* The tiles along one axis that can hold particles of the local cells
+   start..start+n-1, lo <= tile < hi: those overlapping the cells, and one
+   more on either side for glass particles that round into the neighbouring
+   cell at a tile boundary. */
+static void local_tiles(int start, int n, int *lo, int *hi)
 {
-  int i, j, k, n, m, slab, count, type;
-  unsigned int dummy, dummy2;
-  float *pos = 0;
-  float x, y, z;
-  FILE *fd = 0;
-  size_t bytes;
-  int *npart_Task;
-  int num, numfiles, skip, nlocal;
-  char buf[500];
-
-#define SKIP {my_fread(&dummy, sizeof(int), 1, fd);}
-#define SKIP2 {my_fread(&dummy2, sizeof(int), 1, fd);}
-
-  if(ThisTask == 0)
+  if(n == 0)
     {
-      printf("\nreading Lagrangian glass file...\n");
-      fflush(stdout);
-
-      numfiles = find_files(fname);
+      *lo = *hi = 0;
+      return;
+    }
 
-      for(num = 0, skip = 0; num < numfiles; num++)
-	{
-	  if(numfiles > 1)
-	    sprintf(buf, "%s.%d", fname, num);
-	  else
-	    sprintf(buf, "%s", fname);
+  *lo = (int) ((double) start * GlassTileFac / Nmesh) - 1;
+  *hi = (int) ((double) (start + n) * GlassTileFac / Nmesh) + 2;
 
-	  if(!(fd = fopen(buf, "r")))
-	    {
-	      printf("can't open file `%s' for reading glass file.\n", buf);
-	      FatalError(1);
-	    }
+  if(*lo < 0)
+    *lo = 0;
+  if(*hi > GlassTileFac)
+    *hi = GlassTileFac;
+}
 
-	  SKIP;
-	  my_fread(&header1, sizeof(header1), 1, fd);
-	  SKIP2;
 
-	  if(dummy != sizeof(header1) || dummy2 != sizeof(header1))
-	    {
-	      printf("incorrect header size!\n");
-	      FatalError(2);
-	    }
+/* Gathers the particle counts NumPart of all tasks into TotNumPart and
+   NTaskWithN, reports them, and allocates P. */
+static void allocate_particles(void)
+{
+  int i;
+  int *npart_Task;
+  size_t bytes;
 
-	  nlocal = 0;
+  npart_Task = malloc(sizeof(int) * NTask);
 
-	  for(k = 0; k < 6; k++)
-	    nlocal += header1.npart[k];
+  MPI_Allgather(&NumPart, 1, MPI_INT, npart_Task, 1, MPI_INT, MPI_COMM_WORLD);
 
-	  printf("reading '%s' with %d particles\n", fname, nlocal);
+  TotNumPart = 0;		/* note: This is a 64 bit integer */
+  NTaskWithN = 0;
 
-	  if(num == 0)
-	    {
-	      Nglass = 0;
+  for(i = 0; i < NTask; i++)
+    {
+      TotNumPart += npart_Task[i];
+      if(npart_Task[i] > 0)
+	NTaskWithN++;
+    }
 
-	      for(k = 0; k < 6; k++)
-		Nglass += header1.npartTotal[k];
 
-	      printf("\nNglass= %d\n\n", Nglass);
-	      pos = (float *) malloc(sizeof(float) * Nglass * 3);
+  if(ThisTask == 0)
+    {
+      for(i = 0; i < NTask; i++)
+	printf("%d particles on task=%d  (slabs=%d, rows=%d)\n", npart_Task[i], i, Local_nx_table[i],
+	       Local_ny_table[i]);
 
-	      if(!(pos))
-		{
-		  printf("failed to allocate %g Mbyte on Task %d for glass file\n",
-			 sizeof(float) * Nglass * 3.0 / (1024.0 * 1024.0), ThisTask);
-		  FatalError(112);
-		}
-	    }
+      printf("\nTotal number of particles  = %d%09d\n\n",
+	     (int) (TotNumPart / 1000000000), (int) (TotNumPart % 1000000000));
 
-	  SKIP;
-	  my_fread(&pos[3 * skip], sizeof(float), 3 * nlocal, fd);
-	  SKIP2;
+      fflush(stdout);
+    }
 
-	  if(dummy != sizeof(float) * 3 * nlocal || dummy2 != sizeof(float) * 3 * nlocal)
-	    {
-	      printf("incorrect block structure in positions block!\n");
-	      FatalError(3);
-	    }
-	  skip += nlocal;
 
-	  fclose(fd);
-	}
-    }
+  free(npart_Task);
 
-  MPI_Bcast(&Nglass, 1, MPI_INT, 0, MPI_COMM_WORLD);
-  MPI_Bcast(&header1, sizeof(header1), MPI_BYTE, 0, MPI_COMM_WORLD);
 
-  if(ThisTask != 0)
+  if(NumPart)
     {
-      pos = (float *) malloc(sizeof(float) * Nglass * 3);
+      P = (struct part_data *) malloc(bytes = sizeof(struct part_data) * NumPart);
 
-      if(!(pos))
+      if(!(P))
 	{
-	  printf("failed to allocate %g Mbyte on Task %d for glass file\n",
-		 sizeof(float) * Nglass * 3.0 / (1024.0 * 1024.0), ThisTask);
-	  FatalError(112);
+	  printf("failed to allocate %g Mbyte (%d particles) on Task %d\n", bytes / (1024.0 * 1024.0),
+		 NumPart, ThisTask);
+	  FatalError(9891);
 	}
     }
+}
 
-  MPI_Bcast(&pos[0], sizeof(float) * Nglass * 3, MPI_BYTE, 0, MPI_COMM_WORLD);
-
-
-  npart_Task = malloc(sizeof(int) * NTask);
-
-  for(i = 0; i < NTask; i++)
-    npart_Task[i] = 0;
 
-#if defined(MULTICOMPONENTGLASSFILE) && defined(DIFFERENT_TRANSFER_FUNC)
-  MinType = 7;
-  MaxType = -2;
-  for(type = 0; type < 6; type++)
-    if(header1.npartTotal[type])
-      {
-	if(MinType > type - 1)
-	  MinType = type - 1;
-
-	if(MaxType < type - 1)
-	  MaxType = type - 1;
-      }
-#endif
+/* Tiles the glass pos over the tiles of this task and returns the number of
+   particles that fall in its cells, storing them in P if fill is set. Only
+   the tiles in reach of the local slabs (and rows) are visited; the IDs are
+   those of a walk through all tiles and glass particles in turn. */
+static int tile_glass(float *pos, int fill)
+{
+  int i, j, k, n, m, i0, i1, j0, j1, slab, slab_y, count, type;
+  float x, y, z;
 
+  local_tiles(Local_x_start, Local_nx, &i0, &i1);
+  local_tiles(Local_y_start, Local_ny, &j0, &j1);
 
+  count = 0;
 
-  for(i = 0; i < GlassTileFac; i++)
-    for(j = 0; j < GlassTileFac; j++)
+  for(i = i0; i < i1; i++)
+    for(j = j0; j < j1; j++)
       for(k = 0; k < GlassTileFac; k++)
 	{
 	  for(type = 0, n = 0; type < 6; type++)
@@ -141,95 +105,276 @@ void read_glass(char *fname)
 		{
 		  x = pos[3 * n] / header1.BoxSize * (Box / GlassTileFac) + i * (Box / GlassTileFac);
 
+		  y = pos[3 * n + 1] / header1.BoxSize * (Box / GlassTileFac) + j * (Box / GlassTileFac);
+
 		  slab = x / Box * Nmesh;
 		  if(slab >= Nmesh)
 		    slab = Nmesh - 1;
 
-		  npart_Task[Slab_to_task[slab]] += 1;
+		  slab_y = y / Box * Nmesh;
+		  if(slab_y >= Nmesh)
+		    slab_y = Nmesh - 1;
+
+		  if(Slab_to_task[slab] + Slab_to_task_y[slab_y] == ThisTask)
+		    {
+		      if(fill)
+			{
+			  z = pos[3 * n + 2] / header1.BoxSize * (Box / GlassTileFac) + k * (Box / GlassTileFac);
+
+			  P[count].Pos[0] = x;
+			  P[count].Pos[1] = y;
+			  P[count].Pos[2] = z;
+#ifdef  MULTICOMPONENTGLASSFILE
+			  P[count].Type = type - 1;
+#endif
+			  P[count].ID = (((long long) i * GlassTileFac + j) * GlassTileFac + k) * Nglass + n + 1;
+			}
+
+		      count++;
+		    }
 		}
 	    }
 	}
 
-  TotNumPart = 0;		/* note: This is a 64 bit integer */
-  NTaskWithN = 0;
+  return count;
+}
 
-  NumPart = npart_Task[ThisTask];
 
-  for(i = 0; i < NTask; i++)
+/* Opens glass file num of numfiles and reads its header into head, leaving
+   the file at the length of the positions block. */
+static FILE *open_glass_file(char *fname, int num, int numfiles, struct io_header_1 *head)
+{
+  unsigned int dummy, dummy2;
+  FILE *fd;
+  char buf[500];
+
+  if(numfiles > 1)
+    sprintf(buf, "%s.%d", fname, num);
+  else
+    sprintf(buf, "%s", fname);
+
+  if(!(fd = fopen(buf, "r")))
     {
-      TotNumPart += npart_Task[i];
-      if(npart_Task[i] > 0)
-	NTaskWithN++;
+      printf("can't open file `%s' for reading glass file.\n", buf);
+      FatalError(1);
     }
 
+  my_fread(&dummy, sizeof(int), 1, fd);
+  my_fread(head, sizeof(*head), 1, fd);
+  my_fread(&dummy2, sizeof(int), 1, fd);
+
+  if(dummy != sizeof(*head) || dummy2 != sizeof(*head))
+    {
+      printf("incorrect header size in `%s'!\n", buf);
+      FatalError(2);
+    }
+
+  return fd;
+}
+
+
+/* Reads the glass particles first <= n < last, counted through the files in
+   turn (file num starts at file_first[num]), into pos[3 * n]. Only the files
+   that hold some of them are opened, and only the part needed is read. */
+static void read_glass_range(char *fname, int numfiles, int *file_first, int first, int last, float *pos)
+{
+  struct io_header_1 head;
+  unsigned int dummy;
+  int num, lo, hi, nlocal;
+  FILE *fd;
+
+  for(num = 0; num < numfiles; num++)
+    {
+      lo = (first > file_first[num]) ? first : file_first[num];
+      hi = (last < file_first[num + 1]) ? last : file_first[num + 1];
+
+      if(lo >= hi)
+	continue;
+
+      fd = open_glass_file(fname, num, numfiles, &head);
+
+      nlocal = file_first[num + 1] - file_first[num];
+
+      my_fread(&dummy, sizeof(int), 1, fd);
+
+      if(dummy != sizeof(float) * 3 * nlocal)
+	{
+	  printf("incorrect block structure in positions block!\n");
+	  FatalError(3);
+	}
+
+      fseek(fd, (long) sizeof(float) * 3 * (lo - file_first[num]), SEEK_CUR);
+      my_fread(&pos[3 * lo], sizeof(float), 3 * (hi - lo), fd);
+
+      fclose(fd);
+    }
+}
+
+
+/* Reads the glass in parallel and tiles it. The headers of the files are
+   read by as many tasks as there are files; the positions are held once per
+   node, in an MPI-3 shared-memory window. Every task reads its share of the
+   positions straight into the window of its node, the shares of a node
+   making up one contiguous range, and the nodes then swap their ranges. */
+void read_glass(char *fname)
+{
+  int k, count, num, numfiles, nlocal, first, last, tasks_before, node_task, node_ntask, nnodes,
+    leader_task;
+  int *file_first, *range, *counts, *offsets;
+#if defined(MULTICOMPONENTGLASSFILE) && defined(DIFFERENT_TRANSFER_FUNC)
+  int type;
+#endif
+  float *pos;
+  struct io_header_1 head;
+  MPI_Comm node, leaders;
+  MPI_Datatype xyz;
+  MPI_Win win;
+  MPI_Aint winsize;
+  int disp_unit;
+  FILE *fd;
 
   if(ThisTask == 0)
     {
-      for(i = 0; i < NTask; i++)
-	printf("%d particles on task=%d  (slabs=%d)\n", npart_Task[i], i, Local_nx_table[i]);
+      printf("\nreading Lagrangian glass file...\n");
+      fflush(stdout);
 
-      printf("\nTotal number of particles  = %d%09d\n\n",
-	     (int) (TotNumPart / 1000000000), (int) (TotNumPart % 1000000000));
+      numfiles = find_files(fname);
+    }
+
+  MPI_Bcast(&numfiles, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+  /* the particle numbers of the files, the header of file num read by task num % NTask */
+  file_first = malloc(sizeof(int) * (numfiles + 1));
+  memset(file_first, 0, sizeof(int) * (numfiles + 1));
+
+  for(num = ThisTask; num < numfiles; num += NTask)
+    {
+      fd = open_glass_file(fname, num, numfiles, &head);
+      fclose(fd);
+
+      for(k = 0, nlocal = 0; k < 6; k++)
+	nlocal += head.npart[k];
+
+      file_first[num + 1] = nlocal;
+
+      if(num == 0)
+	header1 = head;
+    }
 
+  MPI_Allreduce(MPI_IN_PLACE, file_first, numfiles + 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Bcast(&header1, sizeof(header1), MPI_BYTE, 0, MPI_COMM_WORLD);
+
+  for(num = 0; num < numfiles; num++)
+    file_first[num + 1] += file_first[num];
+
+  for(k = 0, Nglass = 0; k < 6; k++)
+    Nglass += header1.npartTotal[k];
+
+  if(ThisTask == 0)
+    {
+      for(num = 0; num < numfiles; num++)
+	printf("reading '%s' with %d particles\n", fname, file_first[num + 1] - file_first[num]);
+
+      printf("\nNglass= %d\n\n", Nglass);
       fflush(stdout);
     }
 
+  if(file_first[numfiles] != Nglass)
+    {
+      if(ThisTask == 0)
+	printf("the glass files hold %d particles, their header says %d\n", file_first[numfiles], Nglass);
+      FatalError(4);
+    }
 
-  free(npart_Task);
+  /* one copy of the glass per node, allocated by its first task */
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, ThisTask, MPI_INFO_NULL, &node);
+  MPI_Comm_rank(node, &node_task);
+  MPI_Comm_size(node, &node_ntask);
+  MPI_Comm_split(MPI_COMM_WORLD, (node_task == 0) ? 0 : MPI_UNDEFINED, ThisTask, &leaders);
 
+  winsize = (node_task == 0) ? sizeof(float) * 3 * (MPI_Aint) Nglass : 0;
+  MPI_Win_allocate_shared(winsize, sizeof(float), MPI_INFO_NULL, node, &pos, &win);
+  MPI_Win_shared_query(win, 0, &winsize, &disp_unit, &pos);
 
-  if(NumPart)
+  /* this node reads a share of the glass in proportion to its tasks */
+  tasks_before = 0;
+  if(node_task == 0)
     {
-      P = (struct part_data *) malloc(bytes = sizeof(struct part_data) * NumPart);
+      MPI_Exscan(&node_ntask, &tasks_before, 1, MPI_INT, MPI_SUM, leaders);
+      MPI_Comm_rank(leaders, &leader_task);
+      if(leader_task == 0)
+	tasks_before = 0;
+    }
+  MPI_Bcast(&tasks_before, 1, MPI_INT, 0, node);
 
-      if(!(P))
+  first = (long long) Nglass * (tasks_before + node_task) / NTask;
+  last = (long long) Nglass * (tasks_before + node_task + 1) / NTask;
+
+  MPI_Win_fence(0, win);
+  read_glass_range(fname, numfiles, file_first, first, last, pos);
+  MPI_Win_fence(0, win);
+
+  if(node_task == 0)
+    {
+      MPI_Comm_size(leaders, &nnodes);
+
+      range = malloc(sizeof(int) * 2 * nnodes);
+      counts = malloc(sizeof(int) * nnodes);
+      offsets = malloc(sizeof(int) * nnodes);
+
+      first = (long long) Nglass * tasks_before / NTask;
+      last = (long long) Nglass * (tasks_before + node_ntask) / NTask;
+
+      MPI_Allgather(&first, 1, MPI_INT, range, 1, MPI_INT, leaders);
+      MPI_Allgather(&last, 1, MPI_INT, range + nnodes, 1, MPI_INT, leaders);
+
+      /* counted in particles, which fit an int where their coordinates may not */
+      for(k = 0; k < nnodes; k++)
 	{
-	  printf("failed to allocate %g Mbyte (%d particles) on Task %d\n", bytes / (1024.0 * 1024.0),
-		 NumPart, ThisTask);
-	  FatalError(9891);
+	  offsets[k] = range[k];
+	  counts[k] = range[nnodes + k] - range[k];
 	}
-    }
 
+      MPI_Type_contiguous(3, MPI_FLOAT, &xyz);
+      MPI_Type_commit(&xyz);
 
-  count = 0;
+      MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, pos, counts, offsets, xyz, leaders);
 
+      MPI_Type_free(&xyz);
 
-  IDStart = 1;
+      free(offsets);
+      free(counts);
+      free(range);
+      MPI_Comm_free(&leaders);
+    }
 
-  for(i = 0; i < GlassTileFac; i++)
-    for(j = 0; j < GlassTileFac; j++)
-      for(k = 0; k < GlassTileFac; k++)
-	{
-	  for(type = 0, n = 0; type < 6; type++)
-	    {
-	      for(m = 0; m < header1.npartTotal[type]; m++, n++)
-		{
-		  x = pos[3 * n] / header1.BoxSize * (Box / GlassTileFac) + i * (Box / GlassTileFac);
+  MPI_Win_fence(0, win);
 
-		  slab = x / Box * Nmesh;
-		  if(slab >= Nmesh)
-		    slab = Nmesh - 1;
+  free(file_first);
 
-		  if(Slab_to_task[slab] == ThisTask)
-		    {
-		      y = pos[3 * n + 1] / header1.BoxSize * (Box / GlassTileFac) + j * (Box / GlassTileFac);
-		      z = pos[3 * n + 2] / header1.BoxSize * (Box / GlassTileFac) + k * (Box / GlassTileFac);
 
-		      P[count].Pos[0] = x;
-		      P[count].Pos[1] = y;
-		      P[count].Pos[2] = z;
-#ifdef  MULTICOMPONENTGLASSFILE
-		      P[count].Type = type - 1;
+#if defined(MULTICOMPONENTGLASSFILE) && defined(DIFFERENT_TRANSFER_FUNC)
+  MinType = 7;
+  MaxType = -2;
+  for(type = 0; type < 6; type++)
+    if(header1.npartTotal[type])
+      {
+	if(MinType > type - 1)
+	  MinType = type - 1;
+
+	if(MaxType < type - 1)
+	  MaxType = type - 1;
+      }
 #endif
-		      P[count].ID = IDStart;
 
-		      count++;
-		    }
+  NumPart = tile_glass(pos, 0);
 
-		  IDStart++;
-		}
-	    }
-	}
+  allocate_particles();
+
+
+  count = tile_glass(pos, 1);
+
+  IDStart = (long long) GlassTileFac * GlassTileFac * GlassTileFac * Nglass + 1;
 
   if(count != NumPart)
     {
@@ -237,10 +382,76 @@ void read_glass(char *fname)
       FatalError(1);
     }
 
-  free(pos);
+  MPI_Win_free(&win);
+  MPI_Comm_free(&node);
 }
 
 
+
+#if defined(LATTICE_LOAD) && defined(MULTICOMPONENTGLASSFILE)
+#error "LATTICE_LOAD lays out a single component, it does not go with MULTICOMPONENTGLASSFILE"
+#endif
+
+#if defined(LATTICE_LOAD) && defined(CORRECT_CIC)
+#error "LATTICE_LOAD reads the fields at the nodes, there is no CIC to correct for"
+#endif
+
+#ifdef LATTICE_LOAD
+
+/* Lays out a lattice of GlassTileFac^3 particles at the corners of the tiles,
+   where the one-particle glass `glass1_le' puts them: the same positions, IDs
+   and order as read_glass() on that file. Each task generates only the
+   lattice planes and rows that fall in its own slab, without a file to read
+   and broadcast, and the IDs follow from the node. The tiles have to be
+   whole cells, so that the particles sit on the nodes of the mesh and the
+   readout can copy the fields there (see cic_stencil()). */
+void read_lattice(void)
+{
+  int i, j, k, s, i0, i1, j0, j1, count;
+
+  if(Nmesh % GlassTileFac)
+    {
+      if(ThisTask == 0)
+	printf("Nmesh = %d is not a multiple of GlassTileFac = %d: the lattice would not be on the mesh\n",
+	       Nmesh, GlassTileFac);
+      FatalError(113);
+    }
+
+  s = Nmesh / GlassTileFac;
+  Nglass = 1;
+
+  /* lattice planes i0 <= i < i1 and rows j0 <= j < j1 of this task */
+  i0 = (Local_x_start + s - 1) / s;
+  i1 = (Local_x_start + Local_nx + s - 1) / s;
+  j0 = (Local_y_start + s - 1) / s;
+  j1 = (Local_y_start + Local_ny + s - 1) / s;
+
+  NumPart = (i1 - i0) * (j1 - j0) * GlassTileFac;
+
+  if(ThisTask == 0)
+    printf("\nlattice of %d^3 particles, one every %d cells\n\n", GlassTileFac, s);
+
+  allocate_particles();
+
+  count = 0;
+
+  for(i = i0; i < i1; i++)
+    for(j = j0; j < j1; j++)
+      for(k = 0; k < GlassTileFac; k++)
+	{
+	  P[count].Pos[0] = i * (Box / GlassTileFac);
+	  P[count].Pos[1] = j * (Box / GlassTileFac);
+	  P[count].Pos[2] = k * (Box / GlassTileFac);
+	  P[count].ID = ((long long) i * GlassTileFac + j) * GlassTileFac + k + 1;
+
+	  count++;
+	}
+
+  IDStart = (long long) GlassTileFac * GlassTileFac * GlassTileFac + 1;
+}
+#endif
+
+
 int find_files(char *fname)
 {
   FILE *fd;
@@ -64,9 +64,21 @@ void read_parameterfile(char *fname)
   addr[nt] = &Redshift;
   id[nt++] = FLOAT;
 
+#ifndef PNG_BATCH
   strcpy(tag[nt], "Fnl");
   addr[nt] = &Fnl;
   id[nt++] = FLOAT;
+#else
+  strcpy(tag[nt], "PngTemplates"); // comma separated <template>:<fnl> pairs, e.g. local:100,equil:-50
+  addr[nt] = PngTemplates;
+  id[nt++] = STRING;
+#endif
+
+#if defined(SEPARABLE_FNL) || defined(PNG_BATCH)
+  strcpy(tag[nt], "PngTerms"); // comma separated <coef>:<leg1>:<leg2>:<out> terms of the `separable' template
+  addr[nt] = PngTerms;
+  id[nt++] = STRING;
+#endif
 
 // *** Collider Addition (Start) ***
 
@@ -103,6 +115,10 @@ void read_parameterfile(char *fname)
   strcpy(tag[nt], "PhaseFlip");
   addr[nt] = &PhaseFlip;
   id[nt++] = INT;
+
+  strcpy(tag[nt], "PairedOutput");
+  addr[nt] = &PairedOutput;
+  id[nt++] = INT;
 // ********** FAVN/DSJ  ************
 
   strcpy(tag[nt], "Nmesh");
@@ -113,9 +129,11 @@ void read_parameterfile(char *fname)
   addr[nt] = &Nsample;
   id[nt++] = INT;
 
+#ifndef LATTICE_LOAD
   strcpy(tag[nt], "GlassFile");
   addr[nt] = GlassFile;
   id[nt++] = STRING;
+#endif
 
   strcpy(tag[nt], "FileWithInputSpectrum");
   addr[nt] = FileWithInputSpectrum;
@@ -141,6 +159,36 @@ void read_parameterfile(char *fname)
   addr[nt] = &NumFilesWrittenInParallel;
   id[nt++] = INT;
 
+  strcpy(tag[nt], "NumFilesPerSnapshot");
+  addr[nt] = &NumFilesPerSnapshot;
+  id[nt++] = INT;
+
+#ifdef USE_FFTW3
+  strcpy(tag[nt], "FFTWPlannerRigor");
+  addr[nt] = &FFTWPlannerRigor;
+  id[nt++] = INT;
+
+  strcpy(tag[nt], "FFTWWisdomDir");
+  addr[nt] = FFTWWisdomDir;
+  id[nt++] = STRING;
+#endif
+
+#ifdef PENCIL
+  strcpy(tag[nt], "ProcessGridY");
+  addr[nt] = &ProcessGridY;
+  id[nt++] = INT;
+#endif
+
+#ifdef HDF5_OUTPUT
+  strcpy(tag[nt], "HDF5ChunkSize");
+  addr[nt] = &HDF5ChunkSize;
+  id[nt++] = INT;
+
+  strcpy(tag[nt], "HDF5Alignment");
+  addr[nt] = &HDF5Alignment;
+  id[nt++] = INT;
+#endif
+
   strcpy(tag[nt], "OutputDir");
   addr[nt] = OutputDir;
   id[nt++] = STRING;
@@ -250,6 +298,23 @@ void read_parameterfile(char *fname)
 	}
     }
 
+#ifdef PNG_BATCH
+  if(!errorFlag)
+    errorFlag = parse_png_templates(PngTemplates);
+
+  /* the terms only need to make sense if the separable template is used */
+  for(i = 0; i < NumPngTemplates && !errorFlag; i++)
+    if(PngTemplate[i].Shape == PNG_SEPARABLE)
+      {
+	errorFlag = parse_png_terms(PngTerms);
+	break;
+      }
+#endif
+#ifdef SEPARABLE_FNL
+  if(!errorFlag)
+    errorFlag = parse_png_terms(PngTerms);
+#endif
+
   if(errorFlag)
     {
       MPI_Finalize();
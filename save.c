@@ -1,6 +1,10 @@
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#ifdef ASYNC_OUTPUT
+#include <pthread.h>
+#endif
 
 #include "allvars.h"
 #include "proto.h"
@@ -157,7 +161,9 @@ void write_phi_lin_field_data(void)
 
 void write_particle_data(void)
 {
+#if !defined(HDF5_OUTPUT) && !defined(COMPACT_OUTPUT) && !defined(ASYNC_OUTPUT)
   int nprocgroup, groupTask, masterTask;
+#endif
 
   if (ThisTask == 0)
     printf("\nwriting initial conditions... \n");
@@ -167,368 +173,464 @@ void write_particle_data(void)
     FatalError(24131);
   }
 
-  nprocgroup = NTask / NumFilesWrittenInParallel;
+#ifdef ASYNC_OUTPUT
+  finish_output(); /* the previous snapshot may still be on its way to disk */
+#endif
 
-  if ((NTask % NumFilesWrittenInParallel))
-    nprocgroup++;
+#if defined(HDF5_OUTPUT)
+  write_hdf5_snapshot(); /* each file written by its group of tasks at once */
+#elif defined(COMPACT_OUTPUT)
+  write_compact_snapshot(); /* each file written by the first task of its group */
+#else
+  if (NumFilesPerSnapshot > 0)
+    save_aggregated_data();
+#ifdef ASYNC_OUTPUT
+  else /* one file per task with particles, all written at once */
+    save_local_data();
+#else
+  else /* one file per task with particles, NumFilesWrittenInParallel at a time */
+  {
+    nprocgroup = NTask / NumFilesWrittenInParallel;
 
-  masterTask = (ThisTask / nprocgroup) * nprocgroup;
+    if ((NTask % NumFilesWrittenInParallel))
+      nprocgroup++;
 
-  for (groupTask = 0; groupTask < nprocgroup; groupTask++)
-  {
-    if (ThisTask == (masterTask + groupTask)) /* ok, it's this processor's turn */
-      save_local_data();
+    masterTask = (ThisTask / nprocgroup) * nprocgroup;
 
-    /* wait inside the group */
-    MPI_Barrier(MPI_COMM_WORLD);
+    for (groupTask = 0; groupTask < nprocgroup; groupTask++)
+    {
+      if (ThisTask == (masterTask + groupTask)) /* ok, it's this processor's turn */
+        save_local_data();
+
+      /* wait inside the group */
+      MPI_Barrier(MPI_COMM_WORLD);
+    }
   }
+#endif
+#endif
 
   if (ThisTask == 0)
+#ifdef ASYNC_OUTPUT
+    printf("done with assembling initial conditions, writing them in the background.\n");
+#else
     printf("done with writing initial conditions.\n");
+#endif
 }
 
-void save_local_data(void)
+/* The number of particles of each type in the snapshot, over all files,
+   and their masses. */
+void particle_types(long long npart_total[6], double mass[6])
 {
-#define BUFFER 10
-  size_t bytes;
-  float *block;
-  int *blockid;
-#ifndef NO64BITID
-  long long *blocklongid;
-#endif
-  int blockmaxlen, maxlongidlen;
-  int4byte dummy;
-  FILE *fd;
-  char buf[300];
-  int i, k, pc;
-#ifdef PRODUCEGAS
-  double meanspacing, shift_gas, shift_dm;
-#endif
-
-  if (NumPart == 0)
-    return;
-
-  if (NTaskWithN > 1)
-    sprintf(buf, "%s/%s.%d", OutputDir, FileBase, ThisTask);
-  else
-    sprintf(buf, "%s/%s", OutputDir, FileBase);
-
-  if (!(fd = fopen(buf, "w")))
-  {
-    printf("Error. Can't write in file '%s'\n", buf);
-    FatalError(10);
-  }
+  int i;
 
   for (i = 0; i < 6; i++)
   {
-    header.npart[i] = 0;
-    header.npartTotal[i] = 0;
-    header.mass[i] = 0;
+    npart_total[i] = 0;
+    mass[i] = 0;
   }
 
 #ifdef MULTICOMPONENTGLASSFILE
-  qsort(P, NumPart, sizeof(struct part_data), compare_type); /* sort particles by type, because that's how they should be stored in a gadget binary file */
-
   for (i = 0; i < 3; i++)
-    header.npartTotal[i] = header1.npartTotal[i + 1] * GlassTileFac * GlassTileFac * GlassTileFac;
+    npart_total[i] = (long long)header1.npartTotal[i + 1] * GlassTileFac * GlassTileFac * GlassTileFac;
 
-  for (i = 0; i < NumPart; i++)
-    header.npart[P[i].Type]++;
+  if (npart_total[0])
+    mass[0] = (OmegaBaryon) * 3 * Hubble * Hubble / (8 * PI * G) * pow(Box, 3) / (npart_total[0]);
 
-  if (header.npartTotal[0])
-    header.mass[0] =
-        (OmegaBaryon) * 3 * Hubble * Hubble / (8 * PI * G) * pow(Box, 3) / (header.npartTotal[0]);
+  if (npart_total[1])
+    mass[1] = (Omega - OmegaBaryon - OmegaDM_2ndSpecies) * 3 * Hubble * Hubble / (8 * PI * G) * pow(Box, 3) /
+              (npart_total[1]);
 
-  if (header.npartTotal[1])
-    header.mass[1] =
-        (Omega - OmegaBaryon - OmegaDM_2ndSpecies) * 3 * Hubble * Hubble / (8 * PI * G) * pow(Box, 3) /
-        (header.npartTotal[1]);
-
-  if (header.npartTotal[2])
-    header.mass[2] =
-        (OmegaDM_2ndSpecies) * 3 * Hubble * Hubble / (8 * PI * G) * pow(Box, 3) / (header.npartTotal[2]);
+  if (npart_total[2])
+    mass[2] = (OmegaDM_2ndSpecies) * 3 * Hubble * Hubble / (8 * PI * G) * pow(Box, 3) / (npart_total[2]);
 
 #else
 
-  header.npart[1] = NumPart;
-  header.npartTotal[1] = TotNumPart;
-  header.npartTotal[2] = (TotNumPart >> 32);
-  header.mass[1] = (Omega) * 3 * Hubble * Hubble / (8 * PI * G) * pow(Box, 3) / TotNumPart;
+  npart_total[1] = TotNumPart;
+  mass[1] = (Omega) * 3 * Hubble * Hubble / (8 * PI * G) * pow(Box, 3) / TotNumPart;
 
 #ifdef PRODUCEGAS
-  header.npart[0] = NumPart;
-  header.npartTotal[0] = TotNumPart;
-  header.mass[0] = (OmegaBaryon) * 3 * Hubble * Hubble / (8 * PI * G) * pow(Box, 3) / TotNumPart;
-  header.mass[1] = (Omega - OmegaBaryon) * 3 * Hubble * Hubble / (8 * PI * G) * pow(Box, 3) / TotNumPart;
+  npart_total[0] = TotNumPart;
+  mass[0] = (OmegaBaryon) * 3 * Hubble * Hubble / (8 * PI * G) * pow(Box, 3) / TotNumPart;
+  mass[1] = (Omega - OmegaBaryon) * 3 * Hubble * Hubble / (8 * PI * G) * pow(Box, 3) / TotNumPart;
 #endif
 #endif
+}
 
-  header.time = InitTime;
-  header.redshift = 1.0 / InitTime - 1;
-
-  header.flag_sfr = 0;
-  header.flag_feedback = 0;
-  header.flag_cooling = 0;
-  header.flag_stellarage = 0;
-  header.flag_metals = 0;
+/* The particles of this task by type, in the order the snapshot files hold
+   them. */
+void local_types(struct ptype_part part[6])
+{
+  int t;
+#ifdef MULTICOMPONENTGLASSFILE
+  int i;
+#endif
+#ifdef PRODUCEGAS
+  double meanspacing;
+#endif
 
-  header.num_files = NTaskWithN;
+  memset(part, 0, 6 * sizeof(struct ptype_part));
 
-  header.BoxSize = Box;
-  header.Omega0 = Omega;
-  header.OmegaLambda = OmegaLambda;
-  header.HubbleParam = HubbleParam;
+#ifdef MULTICOMPONENTGLASSFILE
+  qsort(P, NumPart, sizeof(struct part_data), compare_type); /* sort particles by type, because that's how they should be stored in a gadget binary file */
 
-  header.flag_stellarage = 0;
-  header.flag_metals = 0;
-  header.hashtabsize = 0;
+  for (i = 0; i < NumPart; i++)
+    part[P[i].Type].n++;
 
-  dummy = sizeof(header);
-  my_fwrite(&dummy, sizeof(dummy), 1, fd);
-  my_fwrite(&header, sizeof(header), 1, fd);
-  my_fwrite(&dummy, sizeof(dummy), 1, fd);
+  for (t = 1; t < 6; t++)
+    part[t].first = part[t - 1].first + part[t - 1].n;
+#else
+  part[1].n = NumPart;
 
 #ifdef PRODUCEGAS
+  /* the gas is a copy of the dark matter, the two shifted apart by half a mean spacing */
   meanspacing = Box / pow(TotNumPart, 1.0 / 3);
-  shift_gas = -0.5 * (Omega - OmegaBaryon) / (Omega)*meanspacing;
-  shift_dm = +0.5 * OmegaBaryon / (Omega)*meanspacing;
+
+  part[0].n = NumPart;
+  part[0].shift = -0.5 * (Omega - OmegaBaryon) / (Omega)*meanspacing;
+  part[1].shift = +0.5 * OmegaBaryon / (Omega)*meanspacing;
+  part[1].idshift = TotNumPart;
 #endif
+#endif
+
+  for (t = 0; t < 6; t++)
+    part[t].thermal = (t == 1 && WDM_On == 1 && WDM_Vtherm_On == 1);
+}
 
-  if (!(block = malloc(bytes = BUFFER * 1024 * 1024)))
+/* bytes per particle in a block */
+size_t block_bytes(enum snap_block block)
+{
+  switch (block)
   {
-    printf("failed to allocate memory for `block' (%g bytes).\n", (double)bytes);
-    FatalError(24);
+  case BLOCK_POS:
+  case BLOCK_VEL:
+    return 3 * sizeof(float);
+  case BLOCK_ID:
+#ifdef NO64BITID
+    return sizeof(int);
+#else
+    return sizeof(long long);
+#endif
+  default:
+    return sizeof(float);
   }
+}
 
-  blockmaxlen = bytes / (3 * sizeof(float));
-
-  blockid = (int *)block;
-#ifndef NO64BITID
-  blocklongid = (long long *)block;
-#endif
-  maxlongidlen = bytes / (sizeof(long long));
+/* Fills buf with the block data of particles start..start+n-1 of part. */
+void pack_block(enum snap_block block, struct ptype_part *part, int start, int n, void *buf)
+{
+  float *fbuf = buf;
+  struct part_data *p;
+  int i, k;
 
-  /* write coordinates */
-  dummy = sizeof(float) * 3 * NumPart;
-#ifdef PRODUCEGAS
-  dummy *= 2;
-#endif
-  my_fwrite(&dummy, sizeof(dummy), 1, fd);
-  for (i = 0, pc = 0; i < NumPart; i++)
+  for (i = 0; i < n; i++)
   {
-    for (k = 0; k < 3; k++)
+    p = &P[part->first + start + i];
+
+    switch (block)
     {
-      block[3 * pc + k] = P[i].Pos[k];
+    case BLOCK_POS:
+      for (k = 0; k < 3; k++)
 #ifdef PRODUCEGAS
-      block[3 * pc + k] = periodic_wrap(P[i].Pos[k] + shift_gas);
+        fbuf[3 * i + k] = periodic_wrap(p->Pos[k] + part->shift);
+#else
+        fbuf[3 * i + k] = p->Pos[k];
+#endif
+      break;
+    case BLOCK_VEL:
+      for (k = 0; k < 3; k++)
+        fbuf[3 * i + k] = p->Vel[k];
+      if (part->thermal)
+        add_WDM_thermal_speeds(&fbuf[3 * i]);
+      break;
+    case BLOCK_ID:
+#ifdef NO64BITID
+      ((int *)buf)[i] = p->ID + part->idshift;
+#else
+      ((long long *)buf)[i] = p->ID + part->idshift;
 #endif
+      break;
+    case BLOCK_U: /* zero temperatures */
+      fbuf[i] = 0;
+      break;
+    case BLOCK_MASS:
+      fbuf[i] = part->mass;
+      break;
+    case BLOCK_HSML:
+      fbuf[i] = part->hsml;
+      break;
     }
+  }
+}
 
-    pc++;
+#ifdef ASYNC_OUTPUT
+/* The file this task writes in the background (ASYNC_OUTPUT): its image is
+   assembled in memory, and a thread of its own writes it out while the
+   computation goes on. The thread does no MPI, and one file at most is in
+   flight: the next snapshot waits for it in finish_output(). */
+static struct
+{
+  pthread_t thread;
+  int active;
+  char fname[300];
+  char *image;
+  size_t size;
+  int error;
+} Pending;
+
+static void *write_image(void *arg)
+{
+  FILE *fd;
 
-    if (pc == blockmaxlen)
-    {
-      my_fwrite(block, sizeof(float), 3 * pc, fd);
-      pc = 0;
-    }
-  }
-  if (pc > 0)
-    my_fwrite(block, sizeof(float), 3 * pc, fd);
-#ifdef PRODUCEGAS
-  for (i = 0, pc = 0; i < NumPart; i++)
+  if (!(fd = fopen(Pending.fname, "w")))
+    Pending.error = 10;
+  else
   {
-    for (k = 0; k < 3; k++)
-    {
-      block[3 * pc + k] = periodic_wrap(P[i].Pos[k] + shift_dm);
-    }
+    if (fwrite(Pending.image, 1, Pending.size, fd) != Pending.size)
+      Pending.error = 777;
+    if (fclose(fd))
+      Pending.error = 777;
+  }
 
-    pc++;
+  return NULL;
+}
 
-    if (pc == blockmaxlen)
-    {
-      my_fwrite(block, sizeof(float), 3 * pc, fd);
-      pc = 0;
-    }
-  }
-  if (pc > 0)
-    my_fwrite(block, sizeof(float), 3 * pc, fd);
-#endif
-  my_fwrite(&dummy, sizeof(dummy), 1, fd);
+/* Waits for the file still being written, if any. */
+void finish_output(void)
+{
+  if (!Pending.active)
+    return;
 
-  /* write velocities */
-  dummy = sizeof(float) * 3 * NumPart;
-#ifdef PRODUCEGAS
-  dummy *= 2;
-#endif
-  my_fwrite(&dummy, sizeof(dummy), 1, fd);
-  for (i = 0, pc = 0; i < NumPart; i++)
-  {
-    for (k = 0; k < 3; k++)
-      block[3 * pc + k] = P[i].Vel[k];
+  pthread_join(Pending.thread, NULL);
+  Pending.active = 0;
+  free(Pending.image);
 
-#ifdef MULTICOMPONENTGLASSFILE
-    if (WDM_On == 1 && WDM_Vtherm_On == 1 && P[i].Type == 1)
-      add_WDM_thermal_speeds(&block[3 * pc]);
-#else
-#ifndef PRODUCEGAS
-    if (WDM_On == 1 && WDM_Vtherm_On == 1)
-      add_WDM_thermal_speeds(&block[3 * pc]);
-#endif
+  if (Pending.error)
+  {
+    printf("I/O error on task=%d writing file '%s'.\n", ThisTask, Pending.fname);
+    fflush(stdout);
+    FatalError(Pending.error);
+  }
+}
 #endif
 
-    pc++;
+/* Opens the snapshot file fname for writing. With ASYNC_OUTPUT the file is
+   assembled in memory, and close_output() hands it to the writer thread;
+   the task writing a file for a group of tasks (NumFilesPerSnapshot) then
+   holds the particles of the whole group, checkchoose() warns if that is
+   many tasks. */
+FILE *open_output(char *fname)
+{
+  FILE *fd;
 
-    if (pc == blockmaxlen)
-    {
-      my_fwrite(block, sizeof(float), 3 * pc, fd);
-      pc = 0;
-    }
+#ifdef ASYNC_OUTPUT
+  strcpy(Pending.fname, fname);
+  if (!(fd = open_memstream(&Pending.image, &Pending.size)))
+  {
+    printf("failed to open a memory stream for file '%s'\n", fname);
+    FatalError(10);
   }
-  if (pc > 0)
-    my_fwrite(block, sizeof(float), 3 * pc, fd);
-#ifdef PRODUCEGAS
-  for (i = 0, pc = 0; i < NumPart; i++)
+#else
+  if (!(fd = fopen(fname, "w")))
   {
-    for (k = 0; k < 3; k++)
-      block[3 * pc + k] = P[i].Vel[k];
+    printf("Error. Can't write in file '%s'\n", fname);
+    FatalError(10);
+  }
+#endif
 
-    if (WDM_On == 1 && WDM_Vtherm_On == 1)
-      add_WDM_thermal_speeds(&block[3 * pc]);
+  return fd;
+}
 
-    pc++;
+void close_output(FILE *fd)
+{
+  fclose(fd);
 
-    if (pc == blockmaxlen)
-    {
-      my_fwrite(block, sizeof(float), 3 * pc, fd);
-      pc = 0;
-    }
+#ifdef ASYNC_OUTPUT
+  Pending.error = 0;
+  if (pthread_create(&Pending.thread, NULL, write_image, NULL))
+  {
+    printf("failed to start the writer thread for file '%s'\n", Pending.fname);
+    FatalError(11);
   }
-  if (pc > 0)
-    my_fwrite(block, sizeof(float), 3 * pc, fd);
+  Pending.active = 1;
 #endif
-  my_fwrite(&dummy, sizeof(dummy), 1, fd);
+}
 
-  /* write particle ID */
-#ifdef NO64BITID
-  dummy = sizeof(int) * NumPart;
-#else
-  dummy = sizeof(long long) * NumPart;
-#endif
-#ifdef PRODUCEGAS
-  dummy *= 2;
-#endif
-  my_fwrite(&dummy, sizeof(dummy), 1, fd);
-  for (i = 0, pc = 0; i < NumPart; i++)
-  {
-#ifdef NO64BITID
-    blockid[pc] = P[i].ID;
-#else
-    blocklongid[pc] = P[i].ID;
-#endif
+/* Writes the Gadget file fname, one of num_files, with the particles of
+   the tasks of comm. The first task of comm writes, and the others send it
+   their particles in turn, type by type, block by block, one buffer at a
+   time. */
+static void write_gadget_file(char *fname, MPI_Comm comm, int num_files)
+{
+#define BUFFER 10
+  struct ptype_part part[6];
+  MPI_Status status;
+  size_t bytes, rowbytes;
+  long long npart_total[6];
+  int nlocal[6], npart_file[6], *count = NULL;
+  int comm_task, comm_ntask, task, maxlen, t, n, done;
+  enum snap_block block;
+  int4byte dummy;
+  FILE *fd = NULL;
+  void *buf;
 
-    pc++;
+  MPI_Comm_rank(comm, &comm_task);
+  MPI_Comm_size(comm, &comm_ntask);
 
-    if (pc == maxlongidlen)
-    {
-#ifdef NO64BITID
-      my_fwrite(blockid, sizeof(int), pc, fd);
-#else
-      my_fwrite(blocklongid, sizeof(long long), pc, fd);
-#endif
-      pc = 0;
-    }
-  }
-  if (pc > 0)
+  local_types(part);
+
+  for (t = 0; t < 6; t++)
+    nlocal[t] = part[t].n;
+
+  if (comm_task == 0)
+    count = malloc(comm_ntask * 6 * sizeof(int));
+
+  MPI_Gather(nlocal, 6, MPI_INT, count, 6, MPI_INT, 0, comm);
+
+  if (!(buf = malloc(bytes = BUFFER * 1024 * 1024)))
   {
-#ifdef NO64BITID
-    my_fwrite(blockid, sizeof(int), pc, fd);
-#else
-    my_fwrite(blocklongid, sizeof(long long), pc, fd);
-#endif
+    printf("failed to allocate memory for `block' (%g bytes).\n", (double)bytes);
+    FatalError(24);
   }
 
-#ifdef PRODUCEGAS
-  for (i = 0, pc = 0; i < NumPart; i++)
+  if (comm_task == 0)
   {
-#ifdef NO64BITID
-    blockid[pc] = P[i].ID + TotNumPart;
-#else
-    blocklongid[pc] = P[i].ID + TotNumPart;
-#endif
+    for (t = 0; t < 6; t++)
+      for (task = 0, npart_file[t] = 0; task < comm_ntask; task++)
+        npart_file[t] += count[6 * task + t];
+
+    fd = open_output(fname);
 
-    pc++;
+    particle_types(npart_total, header.mass);
 
-    if (pc == maxlongidlen)
+    for (t = 0; t < 6; t++)
     {
-#ifdef NO64BITID
-      my_fwrite(blockid, sizeof(int), pc, fd);
-#else
-      my_fwrite(blocklongid, sizeof(long long), pc, fd);
-#endif
-      pc = 0;
+      header.npart[t] = npart_file[t];
+      header.npartTotal[t] = npart_total[t];
     }
-  }
-  if (pc > 0)
-  {
-#ifdef NO64BITID
-    my_fwrite(blockid, sizeof(int), pc, fd);
-#else
-    my_fwrite(blocklongid, sizeof(long long), pc, fd);
+#ifndef MULTICOMPONENTGLASSFILE
+    header.npartTotal[2] = (TotNumPart >> 32);
 #endif
+
+    header.time = InitTime;
+    header.redshift = 1.0 / InitTime - 1;
+
+    header.flag_sfr = 0;
+    header.flag_feedback = 0;
+    header.flag_cooling = 0;
+    header.flag_stellarage = 0;
+    header.flag_metals = 0;
+
+    header.num_files = num_files;
+
+    header.BoxSize = Box;
+    header.Omega0 = Omega;
+    header.OmegaLambda = OmegaLambda;
+    header.HubbleParam = HubbleParam;
+
+    header.hashtabsize = 0;
+
+    dummy = sizeof(header);
+    my_fwrite(&dummy, sizeof(dummy), 1, fd);
+    my_fwrite(&header, sizeof(header), 1, fd);
+    my_fwrite(&dummy, sizeof(dummy), 1, fd);
   }
-#endif
 
-  my_fwrite(&dummy, sizeof(dummy), 1, fd);
+  MPI_Bcast(npart_file, 6, MPI_INT, 0, comm);
 
-  /* write zero temperatures if needed */
-#ifdef PRODUCEGAS
-  dummy = sizeof(float) * NumPart;
-  my_fwrite(&dummy, sizeof(dummy), 1, fd);
-  for (i = 0, pc = 0; i < NumPart; i++)
+  for (block = BLOCK_POS; block <= BLOCK_U; block++)
   {
-    block[pc] = 0;
+    /* zero temperatures for the gas, if there is any */
+    if (block == BLOCK_U && npart_file[0] == 0)
+      break;
 
-    pc++;
+    rowbytes = block_bytes(block);
+    maxlen = bytes / rowbytes;
+
+    if (comm_task == 0)
+    {
+      for (t = 0, dummy = 0; t < 6; t++)
+        if (block != BLOCK_U || t == 0)
+          dummy += rowbytes * npart_file[t];
+      my_fwrite(&dummy, sizeof(dummy), 1, fd);
+    }
 
-    if (pc == blockmaxlen)
+    for (t = 0; t < 6; t++)
     {
-      my_fwrite(block, sizeof(float), pc, fd);
-      pc = 0;
+      if (block == BLOCK_U && t > 0)
+        break;
+
+      if (comm_task == 0)
+        for (task = 0; task < comm_ntask; task++)
+          for (done = 0; done < count[6 * task + t]; done += n)
+          {
+            n = (count[6 * task + t] - done < maxlen) ? count[6 * task + t] - done : maxlen;
+
+            if (task == 0)
+              pack_block(block, &part[t], done, n, buf);
+            else
+              MPI_Recv(buf, n * rowbytes, MPI_BYTE, task, block, comm, &status);
+
+            my_fwrite(buf, rowbytes, n, fd);
+          }
+      else
+        for (done = 0; done < part[t].n; done += n)
+        {
+          n = (part[t].n - done < maxlen) ? part[t].n - done : maxlen;
+
+          pack_block(block, &part[t], done, n, buf);
+          MPI_Send(buf, n * rowbytes, MPI_BYTE, 0, block, comm);
+        }
     }
+
+    if (comm_task == 0)
+      my_fwrite(&dummy, sizeof(dummy), 1, fd);
   }
-  if (pc > 0)
-    my_fwrite(block, sizeof(float), pc, fd);
-  my_fwrite(&dummy, sizeof(dummy), 1, fd);
-#endif
 
-  /* write zero temperatures if needed */
-#ifdef MULTICOMPONENTGLASSFILE
-  if (header.npart[0])
+  free(buf);
+
+  if (comm_task == 0)
   {
-    dummy = sizeof(float) * header.npart[0];
-    my_fwrite(&dummy, sizeof(dummy), 1, fd);
+    close_output(fd);
+    free(count);
+  }
+}
 
-    for (i = 0, pc = 0; i < header.npart[0]; i++)
-    {
-      block[pc] = 0;
+/* one file per task with particles */
+void save_local_data(void)
+{
+  char buf[300];
 
-      pc++;
+  if (NumPart == 0)
+    return;
 
-      if (pc == blockmaxlen)
-      {
-        my_fwrite(block, sizeof(float), pc, fd);
-        pc = 0;
-      }
-    }
-    if (pc > 0)
-      my_fwrite(block, sizeof(float), pc, fd);
-    my_fwrite(&dummy, sizeof(dummy), 1, fd);
-  }
-#endif
+  if (NTaskWithN > 1)
+    sprintf(buf, "%s/%s.%d", OutputDir, FileBase, ThisTask);
+  else
+    sprintf(buf, "%s/%s", OutputDir, FileBase);
 
-  free(block);
+  write_gadget_file(buf, MPI_COMM_SELF, NTaskWithN);
+}
 
-  fclose(fd);
+/* NumFilesPerSnapshot files, written at the same time, each by the first of
+   the consecutive tasks whose particles it holds */
+void save_aggregated_data(void)
+{
+  char buf[300];
+  MPI_Comm comm;
+  int file_num;
+
+  file_num = (long long)ThisTask * NumFilesPerSnapshot / NTask;
+
+  MPI_Comm_split(MPI_COMM_WORLD, file_num, ThisTask, &comm);
+
+  if (NumFilesPerSnapshot > 1)
+    sprintf(buf, "%s/%s.%d", OutputDir, FileBase, file_num);
+  else
+    sprintf(buf, "%s/%s", OutputDir, FileBase);
+
+  write_gadget_file(buf, comm, NumFilesPerSnapshot);
+
+  MPI_Comm_free(&comm);
 }
 
 /* This catches I/O errors occuring for my_fwrite(). In this case we better stop.
@@ -0,0 +1,307 @@
+#ifdef COMPACT_OUTPUT
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allvars.h"
+#include "proto.h"
+#include "lptc/lptc.h"
+
+/* Compact output of a lattice load (COMPACT_OUTPUT), in the format of
+   lptc/lptc.h: per particle the displacement from its lattice point in 16
+   bits a component, and what the Zel'dovich velocity of that displacement
+   misses in 8 bits, with IDs implicit. The quantization steps are common to
+   the snapshot, set by the largest displacement and remainder. The tasks
+   are split into NumFilesPerSnapshot groups of consecutive tasks; the first
+   task of a group writes its file, with the brick of lattice points of each
+   task of the group in turn. If NumFilesPerSnapshot is 0, every task with
+   particles writes a file of its own, numbered over those tasks, as
+   save_local_data() does. */
+
+#ifndef LATTICE_LOAD
+#error "COMPACT_OUTPUT stores the particles relative to their lattice points, it needs LATTICE_LOAD"
+#endif
+#ifdef PRODUCEGAS
+#error "COMPACT_OUTPUT holds one particle type, it cannot be used with PRODUCEGAS"
+#endif
+#ifdef HDF5_OUTPUT
+#error "COMPACT_OUTPUT and HDF5_OUTPUT are two different formats"
+#endif
+
+#define BUFFER 10
+
+#define DISP_MAX 32767
+#define VRES_MAX 127
+
+/* the lattice points of this task, from the IDs read_lattice() gave them */
+static void local_brick(struct lptc_brick *brick)
+{
+  long long l, i, j, imin, imax, jmin, jmax;
+  int n;
+
+  memset(brick, 0, sizeof(struct lptc_brick));
+
+  if (NumPart == 0)
+    return;
+
+  imin = jmin = GlassTileFac;
+  imax = jmax = -1;
+
+  for (n = 0; n < NumPart; n++)
+  {
+    l = P[n].ID - 1;
+    i = l / ((long long)GlassTileFac * GlassTileFac);
+    j = l / GlassTileFac % GlassTileFac;
+
+    if (i < imin)
+      imin = i;
+    if (i > imax)
+      imax = i;
+    if (j < jmin)
+      jmin = j;
+    if (j > jmax)
+      jmax = j;
+  }
+
+  brick->x0 = imin;
+  brick->nx = imax - imin + 1;
+  brick->y0 = jmin;
+  brick->ny = jmax - jmin + 1;
+
+  if ((long long)brick->nx * brick->ny * GlassTileFac != NumPart)
+  {
+    printf("task %d: the %d particles are not a brick of the lattice\n", ThisTask, NumPart);
+    FatalError(114);
+  }
+}
+
+/* displacement of particle n from its lattice point, along axis k */
+static double displacement(int n, int k)
+{
+  long long l = P[n].ID - 1, ijk;
+  double d;
+
+  if (k == 0)
+    ijk = l / ((long long)GlassTileFac * GlassTileFac);
+  else if (k == 1)
+    ijk = l / GlassTileFac % GlassTileFac;
+  else
+    ijk = l % GlassTileFac;
+
+  d = P[n].Pos[k] - ijk * (Box / GlassTileFac);
+
+  if (d >= 0.5 * Box)
+    d -= Box;
+  if (d < -0.5 * Box)
+    d += Box;
+
+  return d;
+}
+
+/* the index of particle n in its brick, z fastest */
+static long long brick_index(int n, struct lptc_brick *brick)
+{
+  long long l = P[n].ID - 1, i, j, k;
+
+  i = l / ((long long)GlassTileFac * GlassTileFac);
+  j = l / GlassTileFac % GlassTileFac;
+  k = l % GlassTileFac;
+
+  return ((i - brick->x0) * brick->ny + (j - brick->y0)) * GlassTileFac + k;
+}
+
+void write_compact_snapshot(void)
+{
+  struct lptc_header head;
+  struct lptc_brick brick, *bricks = NULL;
+  MPI_Comm comm;
+  MPI_Status status;
+  long long npart_total[6];
+  double mass[6], hubble_a, dmax, rmax, r;
+  float *vel;
+  int16_t *disp;
+  int8_t *vres;
+  char *data, *buf, fname[300], base[300];
+  size_t bytes, rowbytes;
+  long long idx;
+  int nfiles, file_num, comm_task, comm_ntask, task, block, n, k, nb, maxlen, count, done, len;
+  FILE *fd = NULL;
+
+  particle_types(npart_total, mass);
+  local_brick(&brick);
+
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, LPTC_MAGIC, 4);
+  head.version = LPTC_VERSION;
+  head.lattice = GlassTileFac;
+  head.npart_total = TotNumPart;
+  head.mass = mass[1];
+  head.time = InitTime;
+  head.redshift = 1.0 / InitTime - 1;
+  head.BoxSize = Box;
+  head.Omega0 = Omega;
+  head.OmegaLambda = OmegaLambda;
+  head.HubbleParam = HubbleParam;
+  head.spacing = Box / GlassTileFac;
+
+  /* the Zel'dovich velocity per unit displacement, as in lpt_displacements() */
+  hubble_a = Hubble * sqrt(Omega / pow(InitTime, 3) + (1 - Omega - OmegaLambda) / pow(InitTime, 2) + OmegaLambda);
+  head.vel_fac = InitTime * hubble_a * F_Omega(InitTime) / sqrt(InitTime);
+
+  disp = malloc(3 * sizeof(int16_t) * NumPart + 1);
+  vres = malloc(3 * sizeof(int8_t) * NumPart + 1);
+  vel = malloc(3 * sizeof(float) * NumPart + 1);
+  if (!disp || !vres || !vel)
+  {
+    printf("failed to allocate %g Mbyte on Task %d\n",
+           3.0 * (sizeof(int16_t) + sizeof(int8_t) + sizeof(float)) * NumPart / (1024.0 * 1024.0), ThisTask);
+    printf("bailing out.\n");
+    FatalError(1);
+  }
+
+  for (n = 0, dmax = 0; n < NumPart; n++)
+    for (k = 0; k < 3; k++)
+      if (fabs(displacement(n, k)) > dmax)
+        dmax = fabs(displacement(n, k));
+
+  MPI_Allreduce(MPI_IN_PLACE, &dmax, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  head.disp_step = (dmax > 0) ? dmax / DISP_MAX : head.spacing / DISP_MAX;
+
+  /* the velocities as the Gadget file has them, WDM thermal speeds included */
+  for (n = 0, rmax = 0; n < NumPart; n++)
+  {
+    idx = brick_index(n, &brick);
+
+    for (k = 0; k < 3; k++)
+    {
+      disp[3 * idx + k] = lrint(displacement(n, k) / head.disp_step);
+      vel[3 * idx + k] = P[n].Vel[k];
+    }
+
+    if (WDM_On == 1 && WDM_Vtherm_On == 1)
+      add_WDM_thermal_speeds(&vel[3 * idx]);
+
+    for (k = 0; k < 3; k++)
+      if (fabs(vel[3 * idx + k] - head.vel_fac * head.disp_step * disp[3 * idx + k]) > rmax)
+        rmax = fabs(vel[3 * idx + k] - head.vel_fac * head.disp_step * disp[3 * idx + k]);
+  }
+
+  MPI_Allreduce(MPI_IN_PLACE, &rmax, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  head.vel_step = (rmax > 0) ? rmax / VRES_MAX : 1;
+
+  for (idx = 0; idx < 3 * (long long)NumPart; idx++)
+  {
+    r = (vel[idx] - head.vel_fac * head.disp_step * disp[idx]) / head.vel_step;
+    vres[idx] = (r > VRES_MAX) ? VRES_MAX : ((r < -VRES_MAX) ? -VRES_MAX : lrint(r));
+  }
+
+  free(vel);
+
+  /* file file_num is written by the first of the tasks with ThisTask * nfiles / NTask == file_num,
+     or by the file_num-th task with particles */
+  if (NumFilesPerSnapshot > 0)
+  {
+    nfiles = NumFilesPerSnapshot;
+    file_num = (long long)ThisTask * nfiles / NTask;
+  }
+  else
+  {
+    nfiles = NTaskWithN;
+    n = (NumPart > 0);
+    file_num = 0;
+    MPI_Exscan(&n, &file_num, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (ThisTask == 0)
+      file_num = 0;
+  }
+
+  MPI_Comm_split(MPI_COMM_WORLD, (NumFilesPerSnapshot > 0 || NumPart > 0) ? file_num : MPI_UNDEFINED, ThisTask,
+                 &comm);
+
+  if (comm == MPI_COMM_NULL)
+  {
+    free(vres);
+    free(disp);
+    return;
+  }
+  MPI_Comm_rank(comm, &comm_task);
+  MPI_Comm_size(comm, &comm_ntask);
+
+  if (comm_task == 0)
+    bricks = malloc(comm_ntask * sizeof(struct lptc_brick));
+
+  MPI_Gather(&brick, 4, MPI_INT, bricks, 4, MPI_INT, 0, comm);
+
+  if (!(buf = malloc(bytes = BUFFER * 1024 * 1024)))
+  {
+    printf("failed to allocate memory for `block' (%g bytes).\n", (double)bytes);
+    FatalError(24);
+  }
+
+  if (comm_task == 0)
+  {
+    head.num_files = nfiles;
+    head.file_num = file_num;
+
+    /* the bricks with particles */
+    for (task = 0, nb = 0; task < comm_ntask; task++)
+      if ((long long)bricks[task].nx * bricks[task].ny > 0)
+      {
+        bricks[nb++] = bricks[task];
+        head.npart_file += (long long)bricks[task].nx * bricks[task].ny * GlassTileFac;
+      }
+    head.nbricks = nb;
+
+    snprintf(base, sizeof(base), "%s/%s", OutputDir, FileBase);
+    lptc_filename(fname, sizeof(fname), base, file_num, nfiles);
+
+    fd = open_output(fname);
+    my_fwrite(&head, sizeof(head), 1, fd);
+    my_fwrite(bricks, sizeof(struct lptc_brick), nb, fd);
+  }
+
+  for (block = 0; block < 2; block++)
+  {
+    data = (block == 0) ? (char *)disp : (char *)vres;
+    rowbytes = (block == 0) ? 3 * sizeof(int16_t) : 3 * sizeof(int8_t);
+    maxlen = bytes / rowbytes;
+
+    if (comm_task == 0)
+    {
+      my_fwrite(data, rowbytes, NumPart, fd);
+
+      /* the other tasks of the group, in the order of their bricks */
+      for (task = 1; task < comm_ntask; task++)
+      {
+        MPI_Recv(&count, 1, MPI_INT, task, block, comm, &status);
+
+        for (done = 0; done < count; done += len)
+        {
+          len = (count - done < maxlen) ? count - done : maxlen;
+          MPI_Recv(buf, len * rowbytes, MPI_BYTE, task, block, comm, &status);
+          my_fwrite(buf, rowbytes, len, fd);
+        }
+      }
+    }
+    else
+    {
+      MPI_Send(&NumPart, 1, MPI_INT, 0, block, comm);
+
+      for (done = 0; done < NumPart; done += len)
+      {
+        len = (NumPart - done < maxlen) ? NumPart - done : maxlen;
+        MPI_Send(data + done * rowbytes, len * rowbytes, MPI_BYTE, 0, block, comm);
+      }
+    }
+  }
+
+  if (comm_task == 0)
+  {
+    close_output(fd);
+    free(bricks);
+  }
+
+  free(buf);
+  free(vres);
+  free(disp);
+  MPI_Comm_free(&comm);
+}
+#endif
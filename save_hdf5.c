@@ -0,0 +1,244 @@
+#ifdef HDF5_OUTPUT
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <hdf5.h>
+#include "allvars.h"
+#include "proto.h"
+
+/* Snapshot output in HDF5 (HDF5_OUTPUT), in the layout Gadget-4 and SWIFT
+   read their initial conditions from: a Header group with the usual
+   attributes, and a group PartType<t> for every particle type present, with
+   the datasets Coordinates, Velocities, ParticleIDs and Masses (and
+   InternalEnergy and SmoothingLength for gas, the mean interparticle
+   spacing; SWIFT needs Masses and SmoothingLength, it does not read the
+   MassTable). The tasks are split into NumFilesPerSnapshot groups of
+   consecutive tasks (NumFilesWrittenInParallel if that is 0), and each
+   group writes one file with collective MPI-IO: every task its particles as
+   a hyperslab of the datasets, staged through a buffer of BUFFER MB in as
+   many rounds as the fullest task of the group needs. */
+
+#ifndef H5_HAVE_PARALLEL
+#error "HDF5_OUTPUT writes with MPI-IO, it needs a parallel build of HDF5"
+#endif
+
+#define BUFFER 10
+
+static void write_attribute(hid_t group, char *name, hid_t type, void *data, int n)
+{
+  hid_t space, attr;
+  hsize_t dim = n;
+
+  space = (n > 1) ? H5Screate_simple(1, &dim, NULL) : H5Screate(H5S_SCALAR);
+  attr = H5Acreate(group, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+  H5Awrite(attr, type, data);
+  H5Aclose(attr);
+  H5Sclose(space);
+}
+
+static void write_header(hid_t file, long long npart_file[6], long long npart_total[6], double mass[6], int nfiles)
+{
+  hid_t group;
+  unsigned int highword[6] = {0, 0, 0, 0, 0, 0};
+  int flags[6] = {0, 0, 0, 0, 0, 0};
+  double redshift = 1.0 / InitTime - 1;
+
+  group = H5Gcreate(file, "/Header", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+  /* NumPart_Total in full, in 64 bits as Gadget-4 has it; the high words are
+     zero, for the readers that add them on (SWIFT, Gadget-2/3) */
+  write_attribute(group, "NumPart_ThisFile", H5T_NATIVE_LLONG, npart_file, 6);
+  write_attribute(group, "NumPart_Total", H5T_NATIVE_LLONG, npart_total, 6);
+  write_attribute(group, "NumPart_Total_HighWord", H5T_NATIVE_UINT, highword, 6);
+  write_attribute(group, "MassTable", H5T_NATIVE_DOUBLE, mass, 6);
+  write_attribute(group, "Time", H5T_NATIVE_DOUBLE, &InitTime, 1);
+  write_attribute(group, "Redshift", H5T_NATIVE_DOUBLE, &redshift, 1);
+  write_attribute(group, "BoxSize", H5T_NATIVE_DOUBLE, &Box, 1);
+  write_attribute(group, "NumFilesPerSnapshot", H5T_NATIVE_INT, &nfiles, 1);
+  write_attribute(group, "Omega0", H5T_NATIVE_DOUBLE, &Omega, 1);
+  write_attribute(group, "OmegaLambda", H5T_NATIVE_DOUBLE, &OmegaLambda, 1);
+  write_attribute(group, "HubbleParam", H5T_NATIVE_DOUBLE, &HubbleParam, 1);
+  write_attribute(group, "Flag_Sfr", H5T_NATIVE_INT, &flags[0], 1);
+  write_attribute(group, "Flag_Cooling", H5T_NATIVE_INT, &flags[0], 1);
+  write_attribute(group, "Flag_StellarAge", H5T_NATIVE_INT, &flags[0], 1);
+  write_attribute(group, "Flag_Metals", H5T_NATIVE_INT, &flags[0], 1);
+  write_attribute(group, "Flag_Feedback", H5T_NATIVE_INT, &flags[0], 1);
+  write_attribute(group, "Flag_DoublePrecision", H5T_NATIVE_INT, &flags[0], 1);
+  write_attribute(group, "Flag_Entropy_ICs", H5T_NATIVE_INT, flags, 6);
+
+  H5Gclose(group);
+}
+
+/* Writes one dataset of a particle type: the particles of this task go to
+   rows offset..offset+part->n-1 of the ntot in the file, collectively over
+   the tasks of the file. */
+static void write_block(hid_t group, char *name, enum snap_block block, struct ptype_part *part, long long offset,
+                        long long ntot, MPI_Comm comm, hid_t dxpl, void *buf, int maxlen)
+{
+  hid_t type, space, dcpl, dset, filespace, memspace;
+  hsize_t dims[2], start[2], count[2], chunk[2];
+  int ncol, rank, rounds, r, n, done;
+
+  ncol = (block == BLOCK_POS || block == BLOCK_VEL) ? 3 : 1;
+  rank = (ncol > 1) ? 2 : 1;
+
+  if (block == BLOCK_ID)
+#ifdef NO64BITID
+    type = H5T_NATIVE_UINT;
+#else
+    type = H5T_NATIVE_ULLONG;
+#endif
+  else
+    type = H5T_NATIVE_FLOAT;
+
+  dims[0] = ntot;
+  dims[1] = ncol;
+  space = H5Screate_simple(rank, dims, NULL);
+
+  dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  if (HDF5ChunkSize > 0)
+  {
+    chunk[0] = (HDF5ChunkSize < ntot) ? HDF5ChunkSize : ntot;
+    chunk[1] = ncol;
+    H5Pset_chunk(dcpl, rank, chunk);
+  }
+
+  dset = H5Dcreate(group, name, type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+
+  rounds = (part->n + maxlen - 1) / maxlen;
+  MPI_Allreduce(MPI_IN_PLACE, &rounds, 1, MPI_INT, MPI_MAX, comm);
+
+  for (r = 0, done = 0; r < rounds; r++, done += n)
+  {
+    n = (part->n - done < maxlen) ? part->n - done : maxlen;
+
+    pack_block(block, part, done, n, buf);
+
+    /* a task that is done takes part with an empty selection */
+    start[0] = offset + done;
+    start[1] = 0;
+    count[0] = (n > 0) ? n : 1;
+    count[1] = ncol;
+
+    filespace = H5Dget_space(dset);
+    memspace = H5Screate_simple(rank, count, NULL);
+
+    if (n > 0)
+      H5Sselect_hyperslab(filespace, H5S_SELECT_SET, start, NULL, count, NULL);
+    else
+    {
+      H5Sselect_none(filespace);
+      H5Sselect_none(memspace);
+    }
+
+    if (H5Dwrite(dset, type, memspace, filespace, dxpl, buf) < 0)
+    {
+      printf("I/O error (H5Dwrite) on task=%d has occured.\n", ThisTask);
+      fflush(stdout);
+      FatalError(777);
+    }
+
+    H5Sclose(memspace);
+    H5Sclose(filespace);
+  }
+
+  H5Dclose(dset);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+}
+
+void write_hdf5_snapshot(void)
+{
+  struct ptype_part part[6];
+  long long nlocal[6], npart_file[6], npart_total[6], offset[6];
+  double mass[6];
+  int t, nfiles, file_num, comm_task, maxlen;
+  char buf[300], name[20];
+  MPI_Comm comm;
+  hid_t fapl, dxpl, file, group;
+  void *block;
+  size_t bytes;
+
+  /* file file_num is written by the tasks with ThisTask * nfiles / NTask == file_num */
+  nfiles = (NumFilesPerSnapshot > 0) ? NumFilesPerSnapshot : NumFilesWrittenInParallel;
+  file_num = (long long)ThisTask * nfiles / NTask;
+
+  MPI_Comm_split(MPI_COMM_WORLD, file_num, ThisTask, &comm);
+  MPI_Comm_rank(comm, &comm_task);
+
+  particle_types(npart_total, mass);
+  local_types(part);
+
+  for (t = 0; t < 6; t++)
+  {
+    nlocal[t] = part[t].n;
+    part[t].mass = mass[t];
+    if (npart_total[t] > 0)
+      part[t].hsml = Box / pow(npart_total[t], 1.0 / 3);
+  }
+
+  MPI_Allreduce(nlocal, npart_file, 6, MPI_LONG_LONG, MPI_SUM, comm);
+  MPI_Exscan(nlocal, offset, 6, MPI_LONG_LONG, MPI_SUM, comm);
+  if (comm_task == 0)
+    for (t = 0; t < 6; t++)
+      offset[t] = 0;
+
+  if (nfiles > 1)
+    sprintf(buf, "%s/%s.%d.hdf5", OutputDir, FileBase, file_num);
+  else
+    sprintf(buf, "%s/%s.hdf5", OutputDir, FileBase);
+
+  fapl = H5Pcreate(H5P_FILE_ACCESS);
+  H5Pset_fapl_mpio(fapl, comm, MPI_INFO_NULL);
+  H5Pset_coll_metadata_write(fapl, 1);
+  if (HDF5Alignment > 0)
+    H5Pset_alignment(fapl, HDF5Alignment, HDF5Alignment); /* the objects of at least one unit start on one */
+
+  if ((file = H5Fcreate(buf, H5F_ACC_TRUNC, H5P_DEFAULT, fapl)) < 0)
+  {
+    printf("Error. Can't write in file '%s'\n", buf);
+    FatalError(10);
+  }
+
+  dxpl = H5Pcreate(H5P_DATASET_XFER);
+  H5Pset_dxpl_mpio(dxpl, H5FD_MPIO_COLLECTIVE);
+
+  write_header(file, npart_file, npart_total, mass, nfiles);
+
+  if (!(block = malloc(bytes = BUFFER * 1024 * 1024)))
+  {
+    printf("failed to allocate memory for `block' (%g bytes).\n", (double)bytes);
+    FatalError(24);
+  }
+
+  maxlen = bytes / (3 * sizeof(float));
+
+  for (t = 0; t < 6; t++)
+    if (npart_file[t] > 0)
+    {
+      sprintf(name, "/PartType%d", t);
+      group = H5Gcreate(file, name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+      write_block(group, "Coordinates", BLOCK_POS, &part[t], offset[t], npart_file[t], comm, dxpl, block, maxlen);
+      write_block(group, "Velocities", BLOCK_VEL, &part[t], offset[t], npart_file[t], comm, dxpl, block, maxlen);
+      write_block(group, "ParticleIDs", BLOCK_ID, &part[t], offset[t], npart_file[t], comm, dxpl, block, maxlen);
+      write_block(group, "Masses", BLOCK_MASS, &part[t], offset[t], npart_file[t], comm, dxpl, block, maxlen);
+      if (t == 0)
+      {
+        write_block(group, "InternalEnergy", BLOCK_U, &part[t], offset[t], npart_file[t], comm, dxpl, block,
+                    maxlen);
+        write_block(group, "SmoothingLength", BLOCK_HSML, &part[t], offset[t], npart_file[t], comm, dxpl, block,
+                    maxlen);
+      }
+
+      H5Gclose(group);
+    }
+
+  free(block);
+
+  H5Pclose(dxpl);
+  H5Fclose(file);
+  H5Pclose(fapl);
+  MPI_Comm_free(&comm);
+}
+#endif